@@ -28,6 +28,7 @@
 #ifndef _CPL_ALLOCATOR_H_
 #define _CPL_ALLOCATOR_H_
 
+#include <stdint.h>
 #include <stdlib.h>
 
 /**
@@ -42,6 +43,75 @@ void* cpl_allocator_allocate(cpl_allocator_ref, size_t);
 void cpl_allocator_free(cpl_allocator_ref, void*);
 void* cpl_allocator_realloc(cpl_allocator_ref, void*, size_t);
 
+/**
+ * Alloc() and Realloc() of chunks aligned to _align_ bytes, a power of two.
+ * Chunks are freed with cpl_allocator_free(). The default, DL and arena
+ * allocators support any alignment; the VM allocator up to the page size,
+ * pools only the one their chunk size gives, and other allocators only word
+ * alignment. Return 0 if the alignment cannot be met, leaving the chunk
+ * passed to realloc untouched.
+ */
+void* cpl_allocator_allocate_aligned(cpl_allocator_ref, size_t size, size_t align);
+void* cpl_allocator_realloc_aligned(cpl_allocator_ref, void* ptr, size_t size, size_t align);
+
+/**
+ * Bytes usable in a chunk, which may be more than were asked for. Returns 0
+ * if the allocator does not know the size of its chunks.
+ */
+size_t cpl_allocator_usable_size(cpl_allocator_ref, void* ptr);
+
+/**
+ * Grows a chunk to _size_ bytes without moving it. Returns _CPL_OK if the chunk
+ * holds _size_ bytes now, _CPL_NOMEM if there is no room after it, and
+ * _CPL_INVALID_ARG if the allocator cannot tell.
+ */
+int cpl_allocator_try_expand(cpl_allocator_ref, void* ptr, size_t size);
+
+/**
+ * Allocates _n_ chunks of _size_ bytes into _ptrs_ at once. Returns how many
+ * were allocated, fewer than _n_ if memory runs out.
+ */
+size_t cpl_allocator_allocate_batch(cpl_allocator_ref, size_t size, size_t n, void** ptrs);
+
+/**
+ * Frees _n_ chunks of _ptrs_ at once, null pointers are skipped.
+ */
+void cpl_allocator_free_batch(cpl_allocator_ref, void** ptrs, size_t n);
+
+/**
+ * Snapshot of allocator statistics. Byte counts are of chunks handed out,
+ * which may be larger than requested. Fields an allocator does not track
+ * are zero.
+ */
+#define CPL_ALLOCATOR_STATS_NBUCKETS    16
+
+typedef struct cpl_allocator_stats
+{
+    size_t      live_bytes;     /* in chunks currently allocated */
+    size_t      peak_bytes;     /* high watermark of live_bytes */
+    size_t      mapped_bytes;   /* taken from the OS or backing allocator */
+    uint64_t    nallocs;
+    uint64_t    nfrees;
+    uint64_t    histogram[CPL_ALLOCATOR_STATS_NBUCKETS]; /* by request size: <=16, <=32, ... */
+    size_t      free_chunks;    /* count of free chunks in the heap */
+    size_t      largest_free;   /* size of the largest free chunk */
+} cpl_allocator_stats_t;
+
+/**
+ * Fills _stats_ with a snapshot of allocator counters. Cheap enough to be
+ * called periodically. Thread-safe allocators keep sharded counters instead of
+ * shared ones, so their peak_bytes is approximate. Returns _CPL_INVALID_ARG if
+ * the allocator keeps no statistics.
+ */
+int cpl_allocator_get_stats(cpl_allocator_ref, cpl_allocator_stats_t* stats);
+
+/**
+ * Gives free memory of an allocator back to the OS, keeping at most _pad_
+ * bytes at the end of the heap for future allocations. Returns the number of
+ * bytes released, 0 if the allocator cannot trim or does not report it.
+ */
+size_t cpl_allocator_trim(cpl_allocator_ref, size_t pad);
+
 /**
  * Default allocator accessor. Represents basic allocation routines, such as
  * malloc() and free().
@@ -49,15 +119,249 @@ void* cpl_allocator_realloc(cpl_allocator_ref, void*, size_t);
 cpl_allocator_ref cpl_allocator_get_default();
 
 /**
- * Constructor and Destructor for pool allocator.
+ * Options for the memory of allocators that map it up front, so that hot paths
+ * take no page faults or TLB misses on first touch:
+ *  - HUGEPAGE asks for transparent huge pages, a hint that may be ignored;
+ *  - HUGETLB maps explicit huge pages, falling back to HUGEPAGE if none are
+ *    reserved;
+ *  - POPULATE prefaults all pages at creation;
+ *  - LOCK locks the pages in RAM, creation fails if RLIMIT_MEMLOCK is too low.
+ */
+#define CPL_ALLOCATOR_MAP_HUGEPAGE      0x1
+#define CPL_ALLOCATOR_MAP_HUGETLB       0x2
+#define CPL_ALLOCATOR_MAP_POPULATE      0x4
+#define CPL_ALLOCATOR_MAP_LOCK          0x8
+
+/**
+ * Constructor and Destructor for pool allocator. The _ex variant maps the
+ * pool with CPL_ALLOCATOR_MAP_* _flags_.
  */
 cpl_allocator_ref cpl_allocator_create_pool(size_t chunkSize, int nChunks);
+cpl_allocator_ref cpl_allocator_create_pool_ex(size_t chunkSize, int nChunks, unsigned flags);
 void cpl_allocator_destroy_pool(cpl_allocator_ref);
 
 /**
- * Constructor and Destructor for Doug Lea's allocator.
+ * Constructor for thread-safe pool allocator. Chunks are kept in a lock-free
+ * stack, so any number of threads may allocate and free them concurrently.
+ * Destroyed with cpl_allocator_destroy_pool().
+ */
+cpl_allocator_ref cpl_allocator_create_pool_lockfree(size_t chunkSize, int nChunks);
+
+/**
+ * Constructor and Destructor for growable pool allocator. Slabs of at least
+ * _nChunksPerSlab_ chunks are mapped on demand. Slabs with no chunk in use
+ * are unmapped once more than _nMaxEmptySlabs_ of them are kept.
+ */
+cpl_allocator_ref cpl_allocator_create_pool_growable(size_t chunkSize, int nChunksPerSlab, int nMaxEmptySlabs);
+void cpl_allocator_destroy_pool_growable(cpl_allocator_ref);
+
+/**
+ * Constructor and Destructor for slab allocator. Serves objects from 16 bytes
+ * up to 8 KB in size classes, each backed by its own slabs. Freed objects are
+ * cached in per-thread magazines exchanged through a per-class depot.
+ * Thread-safe. Larger allocations are mapped directly.
+ */
+cpl_allocator_ref cpl_allocator_create_slab();
+void cpl_allocator_destroy_slab(cpl_allocator_ref);
+
+/**
+ * Constructor and Destructor for monotonic arena allocator. Chunks are cut
+ * from chained blocks of _blockSize_ bytes (0 picks a default) by bumping a
+ * pointer. Free is a no-op: memory goes back in bulk by releasing the arena to
+ * a mark or resetting it. Realloc of the most recent chunk happens in place.
+ */
+cpl_allocator_ref cpl_allocator_create_arena(size_t blockSize);
+void cpl_allocator_destroy_arena(cpl_allocator_ref);
+
+/**
+ * Position in an arena to release to later.
+ */
+typedef struct cpl_arena_mark
+{
+    void*       block;
+    size_t      offset;
+} cpl_arena_mark_t;
+
+/**
+ * Mark, release and reset routines of arena allocator. Releasing to a mark
+ * frees everything allocated after the mark was taken; reset frees everything.
+ */
+cpl_arena_mark_t cpl_allocator_arena_mark(cpl_allocator_ref);
+void cpl_allocator_arena_release_to_mark(cpl_allocator_ref, cpl_arena_mark_t);
+void cpl_allocator_arena_reset(cpl_allocator_ref);
+
+/**
+ * Constructor and Destructor for Doug Lea's allocator. Reserves _max_size_
+ * bytes of address space and grows the heap within it. When the free top of
+ * the heap grows past 1 MB it is trimmed, and pages inside free chunks of
+ * 256 KB and more are released, so RSS shrinks after bursts. The _ex variant
+ * maps the whole heap with CPL_ALLOCATOR_MAP_* _flags_; heaps mapped with
+ * HUGETLB, POPULATE or LOCK keep their pages and are never trimmed.
  */
 cpl_allocator_ref cpl_allocator_create_dl(size_t max_size);
+cpl_allocator_ref cpl_allocator_create_dl_ex(size_t max_size, unsigned flags);
 void cpl_allocator_destroy_dl(cpl_allocator_ref);
 
+/**
+ * Constructor and Destructor for thread-safe Doug Lea's allocator. Keeps
+ * _nArenas_ independent heaps of _arena_size_ bytes, each with its own lock.
+ * Threads are spread over the arenas; chunks are returned to the arena they
+ * were cut from.
+ */
+cpl_allocator_ref cpl_allocator_create_dl_arenas(size_t arena_size, int nArenas);
+void cpl_allocator_destroy_dl_arenas(cpl_allocator_ref);
+
+/**
+ * Sets the chunk size from which a DL allocator, single or multi-arena, maps
+ * chunks directly instead of cutting them from the heap. Such chunks do not
+ * fragment the heap, grow with mremap() where available and are unmapped on
+ * free. Defaults to 1 MB; (size_t)-1 keeps all chunks in the heap.
+ */
+void cpl_allocator_dl_set_mmap_threshold(cpl_allocator_ref, size_t threshold);
+
+/**
+ * Constructor and Destructor for DL allocator kept in a file at _path_, so a
+ * restarted process can attach to the heap again. A new file is sized to
+ * _max_size_ bytes and mapped at _base_, or anywhere if _base_ is 0. An
+ * existing file is mapped where it was created, since the heap holds plain
+ * pointers; attaching fails if that range is taken, _base_ differs or a heap
+ * that was not destroyed properly does not pass the consistency check. Such a
+ * heap gets its free lists rebuilt from the chunks. A failed create leaves an
+ * empty file, and a file left by a create that did not finish is laid out
+ * anew. All chunks stay in the file, mmap threshold does not apply.
+ * Destructor writes the heap back and marks it clean. Not for use from
+ * several processes.
+ */
+cpl_allocator_ref cpl_allocator_create_dl_file(const char* path, size_t max_size, void* base);
+void cpl_allocator_destroy_dl_file(cpl_allocator_ref);
+
+/**
+ * Writes the heap of a file DL allocator back to the file.
+ * Returns _CPL_OK or _CPL_IO_ERROR.
+ */
+int cpl_allocator_dl_sync(cpl_allocator_ref);
+
+/**
+ * Constructor and Destructor for DL allocator shared between processes. The
+ * heap lives in a shared memory object named _name_, or in an anonymous one
+ * if _name_ is 0, and is guarded by a process-shared lock. Other processes
+ * attach by name or by a descriptor they got through fork or a unix socket.
+ * The heap holds plain pointers and is mapped at the same address in every
+ * process: at _base_, or anywhere if _base_ is 0. Attaching fails if that
+ * range is taken, so unrelated processes should agree on a _base_ that is
+ * free in all of them; with 0 only children forked after create are sure to
+ * have the range, they inherit it. Every attached process destroys its own
+ * allocator; the creator also removes the name, the memory goes away with
+ * the last mapping.
+ */
+cpl_allocator_ref cpl_allocator_create_dl_shared(const char* name, size_t max_size, void* base);
+cpl_allocator_ref cpl_allocator_attach_dl_shared(const char* name);
+cpl_allocator_ref cpl_allocator_attach_dl_shared_fd(int fd);
+void cpl_allocator_destroy_dl_shared(cpl_allocator_ref);
+
+/**
+ * Descriptor of the shared memory object of a shared DL allocator, to pass
+ * to other processes. Owned by the allocator.
+ */
+int cpl_allocator_dl_shared_fd(cpl_allocator_ref);
+
+/**
+ * Converts chunks of a shared DL allocator to offsets from the start of the
+ * shared memory object and back, to pass them between processes. Offset 0
+ * stands for a null pointer.
+ */
+size_t cpl_allocator_dl_shared_offset(cpl_allocator_ref, const void* ptr);
+void* cpl_allocator_dl_shared_pointer(cpl_allocator_ref, size_t offset);
+
+/**
+ * Root pointer of a file or shared DL allocator. It survives destroy and
+ * create, so objects stored in the heap can be found again after restart or
+ * from another process.
+ */
+void* cpl_allocator_dl_get_root(cpl_allocator_ref);
+void cpl_allocator_dl_set_root(cpl_allocator_ref, void* root);
+
+/**
+ * Constructor and Destructor for thread-safe virtual memory allocator, meant
+ * for large buffers that keep growing. Every chunk of a page and more reserves
+ * _reserve_ bytes of address space, or its own size if larger, and makes only
+ * the pages in use accessible. Growth within the range commits pages and never
+ * copies; past it the range is remapped with mremap() where available. Smaller
+ * chunks come from malloc(). Alignment is limited to the page size.
+ */
+cpl_allocator_ref cpl_allocator_create_vm(size_t reserve);
+void cpl_allocator_destroy_vm(cpl_allocator_ref);
+
+/**
+ * Constructor and Destructor for thread caching allocator. Small chunks are
+ * served from per-thread caches that are refilled from and flushed to the
+ * _backing_ allocator in batches under a lock, so the backing allocator need
+ * not be thread-safe. Chunks may be freed by any thread. They are aligned to
+ * a word only, whatever the alignment of the backing allocator.
+ */
+cpl_allocator_ref cpl_allocator_create_cache(cpl_allocator_ref backing);
+void cpl_allocator_destroy_cache(cpl_allocator_ref);
+
+/**
+ * Constructor and Destructor for tracing allocator. Forwards every call to the
+ * _backing_ allocator and appends a record of it to the file _fd_, so that a
+ * workload can be replayed against other allocators later. Calls are
+ * serialized, which keeps the trace in order. The destructor flushes the trace
+ * but does not close _fd_.
+ */
+cpl_allocator_ref cpl_allocator_create_trace(cpl_allocator_ref backing, int fd);
+void cpl_allocator_destroy_trace(cpl_allocator_ref);
+
+/**
+ * Writes buffered records of tracing allocator out. Returns _CPL_IO_ERROR or
+ * _CPL_NOMEM if a record was lost, in which case the trace is incomplete and
+ * recording stops.
+ */
+int cpl_allocator_trace_flush(cpl_allocator_ref);
+
+/**
+ * Recorded trace loaded into memory.
+ */
+typedef struct cpl_allocator_trace cpl_allocator_trace_t;
+
+typedef struct cpl_allocator_trace_info
+{
+    uint64_t    nops;
+    size_t      min_size;       /* of requests */
+    size_t      max_size;
+    size_t      max_chunks;     /* live at once */
+    size_t      max_bytes;      /* requested and live at once */
+} cpl_allocator_trace_info_t;
+
+/**
+ * Loads and validates a trace written by tracing allocator. Returns
+ * _CPL_INVALID_ARG for a malformed trace.
+ */
+int cpl_allocator_trace_load(int fd, cpl_allocator_trace_t** trace);
+void cpl_allocator_trace_free(cpl_allocator_trace_t* trace);
+void cpl_allocator_trace_get_info(const cpl_allocator_trace_t* trace, cpl_allocator_trace_info_t* info);
+
+typedef struct cpl_allocator_replay_result
+{
+    uint64_t    nops;
+    uint64_t    nfailed;        /* allocations the allocator refused */
+    uint64_t    elapsed_ns;     /* spent in allocator calls and first touch */
+    double      ns_per_op;
+    size_t      peak_rss;       /* sampled resident set size of the process */
+    size_t      peak_footprint; /* mapped_bytes of the allocator, or RSS growth
+                                   if it does not report them */
+    double      fragmentation;  /* 1 - requested live bytes / footprint at
+                                   the peak of live bytes */
+} cpl_allocator_replay_result_t;
+
+/**
+ * Replays a trace against _allocator_ in a single thread. Every new chunk is
+ * touched once per page, like a real workload would. If _chunkSize_ is not 0
+ * each request is made for exactly _chunkSize_ bytes, to replay against pool
+ * allocators; larger requests are then rejected with _CPL_INVALID_ARG.
+ * Chunks still live at the end of the trace are freed.
+ */
+int cpl_allocator_trace_replay(cpl_allocator_ref allocator, const cpl_allocator_trace_t* trace,
+                               size_t chunkSize, cpl_allocator_replay_result_t* result);
+
 #endif // _CPL_ALLOCATOR_H_
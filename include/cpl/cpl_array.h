@@ -58,6 +58,21 @@ cpl_array_ref cpl_array_create(size_t sz, size_t nreserv);
  */
 int cpl_array_init(cpl_array_ref a, size_t sz, size_t nreserv);
 
+/*
+ * Initialize array of items of size _sz_ over _nbytes_ of _storage_ owned by
+ * the caller. The array moves to the heap once it outgrows the storage.
+ */
+void cpl_array_init_inline(cpl_array_ref a, size_t sz, void* storage, size_t nbytes);
+
+/*
+ * An array followed by storage of its own for _n_ items of _type_, to be put
+ * on the stack or embedded into other structs. Must not be moved while the
+ * items are in the storage.
+ */
+#define CPL_ARRAY_WITH_STORAGE(type, n) struct { cpl_array_t array; type storage[n]; }
+#define cpl_array_init_with_storage(s)  cpl_array_init_inline(&(s)->array, sizeof((s)->storage[0]), \
+                                                              (s)->storage, sizeof((s)->storage))
+
 /*
  * Deinitialize stack-allocated array.
  */
@@ -33,4 +33,22 @@
 int32_t cpl_atomic_increment(volatile int32_t* value);
 int64_t cpl_atomic_increment64(volatile int64_t* value);
 
+/**
+ * Decrements *value and returns the result. Full barrier, so that a reference
+ * count dropping to zero sees all writes of former owners.
+ */
+int32_t cpl_atomic_decrement(volatile int32_t* value);
+
+/**
+ * Stores _new_value_ if *value equals _old_value_. Full barrier.
+ * Returns non-zero on success.
+ */
+int cpl_atomic_compare_and_swap(volatile int32_t* value, int32_t old_value, int32_t new_value);
+
+/**
+ * Stores _new_value_ if *value equals _old_value_. Full barrier.
+ * Returns non-zero on success.
+ */
+int cpl_atomic_compare_and_swap64(volatile int64_t* value, int64_t old_value, int64_t new_value);
+
 #endif // _CPL_ATOMIC_H_
@@ -31,5 +31,6 @@
 #define _CPL_OK                     0
 #define _CPL_INVALID_ARG            1
 #define _CPL_NOMEM                  2
+#define _CPL_IO_ERROR               3
 
 #endif // _CPL_ERROR_H_
@@ -80,6 +80,11 @@ static inline void __cpl_dlist_add(struct cpl_dlist* item,
     prev->next = item;
 }
 
+static inline void cpl_dlist_add(struct cpl_dlist *item, struct cpl_dlist* head)
+{
+    __cpl_dlist_add(item, head, head->next);
+}
+
 static inline void cpl_dlist_add_tail(struct cpl_dlist *item, struct cpl_dlist* next)
 {
     __cpl_dlist_add(item, next->prev, next);
@@ -91,6 +96,21 @@ static inline void cpl_dlist_del(struct cpl_dlist* item)
     item->next->prev = item->prev;
 }
 
+/**
+ * move all entries of _list_ to the end of _head_, leaving _list_ empty
+ */
+static inline void cpl_dlist_splice_tail(struct cpl_dlist* list, struct cpl_dlist* head)
+{
+    if(!cpl_dlist_empty(list))
+    {
+        list->next->prev = head->prev;
+        head->prev->next = list->next;
+        list->prev->next = head;
+        head->prev = list->prev;
+        list->next = list->prev = list;
+    }
+}
+
 /**
  * get the struct for the entry
  */
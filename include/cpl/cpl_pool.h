@@ -0,0 +1,88 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * C Primitives Library. Inline fast path of the pool allocator.
+ */
+
+#ifndef _CPL_POOL_H_
+#define _CPL_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cpl/cpl_allocator.h>
+#include <cpl/cpl_list.h>
+
+/**
+ * Free list and counters of a single-threaded pool allocator. The allocator
+ * interface and the inline routines below share them, so calls through both
+ * may be mixed on the same pool.
+ */
+struct cpl_pool
+{
+    cpl_slist_t list;           /* free chunks */
+    size_t      nInUse;
+    size_t      nPeakInUse;
+    uint64_t    nallocs;
+    uint64_t    nfrees;
+};
+typedef struct cpl_pool cpl_pool_t;
+typedef struct cpl_pool* cpl_pool_ref;
+
+/**
+ * Pool of an allocator made by cpl_allocator_create_pool(), or 0 for any other
+ * allocator, the lock-free pool included.
+ */
+cpl_pool_ref cpl_allocator_get_pool(cpl_allocator_ref allocator);
+
+/**
+ * Takes a chunk of the pool's chunk size, or returns 0 if the pool is empty.
+ */
+static inline void* cpl_pool_alloc_inline(cpl_pool_ref pool)
+{
+    cpl_slist_ref chunk = pool->list.next;
+    if(chunk)
+    {
+        pool->list.next = chunk->next;
+        ++pool->nallocs;
+        if(++pool->nInUse > pool->nPeakInUse)
+        {
+            pool->nPeakInUse = pool->nInUse;
+        }
+    }
+    return chunk;
+}
+
+/**
+ * Gives a chunk back to the pool. _ptr_ must not be 0.
+ */
+static inline void cpl_pool_free_inline(cpl_pool_ref pool, void* ptr)
+{
+    cpl_slist_ref chunk = (cpl_slist_ref)ptr;
+    chunk->next = pool->list.next;
+    pool->list.next = chunk;
+    ++pool->nfrees;
+    --pool->nInUse;
+}
+
+#endif // _CPL_POOL_H_
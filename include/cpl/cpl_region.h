@@ -28,6 +28,7 @@
 #ifndef _CPL_REGION_H_
 #define _CPL_REGION_H_
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <cpl/cpl_allocator.h>
 
@@ -39,19 +40,134 @@ struct cpl_region
     size_t      alloc;
     size_t      offset;
     void        *data;
+    unsigned    flags;
 };
 
+/* data is storage of the owner, not taken from the allocator */
+#define CPL_REGION_INLINE           0x1
+
+/**
+ * Regions grow by doubling, in place when the allocator can expand the buffer
+ * and by reallocating otherwise. Over cpl_allocator_create_vm() a large region
+ * grows by committing pages and its bytes are never copied.
+ */
 cpl_region_ref cpl_region_create(cpl_allocator_ref allocator, size_t sz);
 int cpl_region_init(cpl_allocator_ref allocator, cpl_region_ref __restrict r, size_t sz);
 
-#define cpl_region_create_default() cpl_region_create(0)
+#define cpl_region_create_default() cpl_region_create(cpl_allocator_get_default(), 0)
+
+/**
+ * Initializes a region over _sz_ bytes of _storage_ owned by the caller, e.g.
+ * on the stack or inside a parent struct. Nothing is allocated until the
+ * region outgrows the storage, then it moves to _allocator_ for good. The
+ * storage must stay in place as long as the region uses it.
+ */
+void cpl_region_init_inline(cpl_allocator_ref allocator, cpl_region_ref __restrict r, void* storage, size_t sz);
+
+/**
+ * A region followed by _n_ bytes of its own storage.
+ */
+#define CPL_REGION_WITH_STORAGE(n)  struct { cpl_region_t region; char storage[n] __attribute__((aligned(16))); }
+#define cpl_region_init_with_storage(allocator, s) \
+                                    cpl_region_init_inline(allocator, &(s)->region, (s)->storage, sizeof((s)->storage))
 
-#define cpl_region_deinit(r)        free((r)->data)
-#define cpl_region_destroy(r)       free((r)->data);free(r)
+void cpl_region_deinit(cpl_region_ref __restrict r);
+#define cpl_region_destroy(r)       do { cpl_allocator_ref _a = (r)->allocator; \
+                                         cpl_region_deinit(r); cpl_allocator_free(_a, (r)); } while(0)
 
 int cpl_region_append_data(cpl_region_ref __restrict r, const void* __restrict data, size_t sz);
 #define cpl_region_append_region(r, o) cpl_region_append_data(r, (o)->data, (o)->offset)
 
+/**
+ * Returns the end of a region with room for at least _sz_ bytes, growing it if
+ * needed, or 0 if out of memory. Bytes written there become part of the
+ * region once committed; cpl_region_room() tells how many fit.
+ */
+void* cpl_region_reserve(cpl_region_ref __restrict r, size_t sz);
+void cpl_region_commit(cpl_region_ref __restrict r, size_t sz);
+
+#define cpl_region_room(r)          ((r)->alloc - (r)->offset)
+
 int cpl_region_resize(cpl_region_ref __restrict r, size_t sz);
 
+/**
+ * Reads up to _sz_ bytes from _fd_ straight into the end of a region, growing
+ * it as needed; (size_t)-1 reads to the end of file. Stops early at the end of
+ * file or when a non-blocking descriptor has no more data, the offset tells
+ * how much was read. Returns _CPL_OK, _CPL_NOMEM or _CPL_IO_ERROR.
+ */
+int cpl_region_read_fd(cpl_region_ref __restrict r, int fd, size_t sz);
+
+/**
+ * Writes all bytes of a region to a blocking descriptor _fd_, retrying partial
+ * writes. Returns _CPL_OK or _CPL_IO_ERROR.
+ */
+int cpl_region_write_fd(cpl_region_ref __restrict r, int fd);
+
+/**
+ * Initializes a read-only region over the contents of the regular file _fd_,
+ * mapped for sequential access. Appends to it fail with _CPL_NOMEM. The
+ * descriptor may be closed afterwards; cpl_region_deinit() unmaps the file.
+ */
+int cpl_region_init_mapped(cpl_region_ref __restrict r, int fd);
+
+/**
+ * Buffer given up by a region to be shared by slices. It is freed with the
+ * last slice, which may be released by any thread, so the allocator of the
+ * region must be thread-safe if slices travel between threads.
+ */
+typedef struct cpl_region_buffer cpl_region_buffer_t;
+struct cpl_region_buffer
+{
+    volatile int32_t refs;
+    int         readonly;
+    cpl_allocator_ref allocator;
+    void        *data;
+    size_t      size;
+};
+
+/**
+ * Handle of a reference to _length_ bytes at _offset_ of a shared buffer.
+ * Every handle holds a reference of its own; handing a slice to another
+ * thread hands the reference over.
+ */
+typedef struct cpl_region_slice cpl_region_slice_t;
+typedef struct cpl_region_slice* cpl_region_slice_ref;
+struct cpl_region_slice
+{
+    cpl_region_buffer_t* buffer;
+    size_t      offset;
+    size_t      length;
+};
+
+/**
+ * Moves the data of a region into a shared buffer without copying, _s_ gets
+ * the first reference to all of it. The region is left empty and may be used
+ * again. Regions over storage of their owner are copied; mapped regions give
+ * the mapping away and continue with the default allocator.
+ */
+int cpl_region_share(cpl_region_ref __restrict r, cpl_region_slice_ref __restrict s);
+
+/**
+ * Makes _s_ a new reference to _length_ bytes at _offset_ of slice _o_.
+ */
+void cpl_region_slice_sub(cpl_region_slice_ref __restrict s, const cpl_region_slice_t* __restrict o,
+                          size_t offset, size_t length);
+#define cpl_region_slice_dup(s, o)  cpl_region_slice_sub(s, o, 0, (o)->length)
+
+/**
+ * Drops the reference of a slice, the buffer is freed with the last one.
+ */
+void cpl_region_slice_release(cpl_region_slice_ref __restrict s);
+
+#define cpl_region_slice_data(s)    ((const void*)((const char*)(s)->buffer->data + (s)->offset))
+#define cpl_region_slice_length(s)  ((s)->length)
+
+/**
+ * Returns the bytes of a slice for writing. The buffer is written in place
+ * if the slice holds the only reference to it; otherwise, the bytes of the
+ * slice are copied to a buffer of its own first. Returns 0 if out of memory.
+ */
+void* cpl_region_slice_writable(cpl_region_slice_ref __restrict s);
+
 #endif // _CPL_REGION_H_
@@ -0,0 +1,101 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * C Primitives Library. Rope (aka segmented memory buffer) implementation.
+ */
+
+#ifndef _CPL_ROPE_H_
+#define _CPL_ROPE_H_
+
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <cpl/cpl_allocator.h>
+#include <cpl/cpl_list.h>
+
+/**
+ * Bytes of a rope are kept in a chain of blocks, so appending never moves
+ * what is already there and whole ropes are spliced without copying. Blocks
+ * are _block_size_ bytes, or larger to take a big append whole.
+ */
+typedef struct cpl_rope_block cpl_rope_block_t;
+struct cpl_rope_block
+{
+    cpl_dlist_t link;
+    size_t      size;           /* bytes available in data */
+    size_t      begin;          /* first byte not consumed yet */
+    size_t      end;            /* past the last byte written */
+    char        data[] __attribute__((aligned(16)));
+};
+
+typedef struct cpl_rope cpl_rope_t;
+typedef struct cpl_rope* cpl_rope_ref;
+struct cpl_rope
+{
+    cpl_allocator_ref allocator;
+    size_t      block_size;
+    size_t      length;         /* bytes in all blocks */
+    cpl_dlist_t blocks;
+};
+
+/**
+ * Constructor and initializer of a rope. _block_size_ of 0 picks a default.
+ * An initialized rope must not be moved, its chain points back to it.
+ */
+cpl_rope_ref cpl_rope_create(cpl_allocator_ref allocator, size_t block_size);
+void cpl_rope_init(cpl_allocator_ref allocator, cpl_rope_ref __restrict r, size_t block_size);
+
+#define cpl_rope_create_default()   cpl_rope_create(cpl_allocator_get_default(), 0)
+
+void cpl_rope_deinit(cpl_rope_ref __restrict r);
+#define cpl_rope_destroy(r)         do { cpl_allocator_ref _a = (r)->allocator; \
+                                         cpl_rope_deinit(r); cpl_allocator_free(_a, (r)); } while(0)
+
+#define cpl_rope_length(r)          ((r)->length)
+
+/**
+ * Copies _sz_ bytes to the end of a rope. Takes at most one new block, and
+ * leaves the rope untouched if it cannot be allocated.
+ */
+int cpl_rope_append_data(cpl_rope_ref __restrict r, const void* __restrict data, size_t sz);
+#define cpl_rope_append_region(r, o) cpl_rope_append_data(r, (o)->data, (o)->offset)
+
+/**
+ * Moves all blocks of _o_ to the end of _r_ in O(1), _o_ is left empty. Both
+ * ropes must share the allocator.
+ */
+void cpl_rope_splice(cpl_rope_ref __restrict r, cpl_rope_ref __restrict o);
+
+/**
+ * Describes the bytes of a rope from the start by at most _n_ entries of
+ * _iov_, for writev() or sendmsg(). Returns the number of entries filled.
+ */
+size_t cpl_rope_iovec(cpl_rope_ref __restrict r, struct iovec* iov, size_t n);
+
+/**
+ * Drops _sz_ bytes from the start of a rope, e.g. once they were written.
+ * Blocks emptied are freed.
+ */
+void cpl_rope_consume(cpl_rope_ref __restrict r, size_t sz);
+
+#endif // _CPL_ROPE_H_
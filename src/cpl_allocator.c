@@ -21,40 +21,298 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#include "cpl_allocator.h"
+#include "cpl_allocator_private.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 #include <string.h>
+#include <unistd.h>
+
+#include "cpl_error.h"
+
+#if defined(__APPLE__)
+#   include <mach/vm_statistics.h>
+#   include <malloc/malloc.h>
+#   define cpl_malloc_usable_size(p)   malloc_size(p)
+#else
+#   include <malloc.h>
+#   define cpl_malloc_usable_size(p)   malloc_usable_size(p)
+#endif
+
+#ifndef MAP_ANONYMOUS
+#   ifdef MAP_ANON
+#       define MAP_ANONYMOUS MAP_ANON
+#   endif
+#endif
+
+#define CPL_HUGE_PAGE_SIZE      ((size_t)0x200000)
 
 /********************** Default Allocator Implementation **********************/
-struct cpl_allocator
+static struct cpl_stats_shards _default_stats;
+static pthread_once_t _default_stats_once = PTHREAD_ONCE_INIT;
+
+static void cpl_default_stats_init(void)
 {
-    void* (*xAllocate)(struct cpl_allocator*, size_t);
-    void* (*xRealloc)(struct cpl_allocator*, void* ptr, size_t);
-    void  (*xFree)(struct cpl_allocator*, void* ptr);
-};
+    int rc = cpl_stats_shards_init(&_default_stats);
+    assert(rc);
+}
 
-static inline void* cpl_default_malloc(struct cpl_allocator* pAllocator, size_t sz)
+static inline struct cpl_allocator_counters* cpl_default_counters()
 {
-    return malloc(sz);
+    pthread_once(&_default_stats_once, cpl_default_stats_init);
+    return cpl_stats_shards_local(&_default_stats);
 }
 
-static inline void* cpl_default_realloc(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
+static inline void* cpl_default_malloc(struct cpl_allocator* pAllocator, size_t sz)
 {
-    return realloc(ptr, sz);
+    void* ptr = malloc(sz);
+    if(ptr)
+    {
+        size_t usable = cpl_malloc_usable_size(ptr);
+        cpl_counters_alloc(cpl_default_counters(), sz, usable);
+    }
+    return ptr;
 }
 
 static inline void cpl_default_free(struct cpl_allocator* pAllocator, void* ptr)
 {
+    if(ptr)
+    {
+        cpl_counters_free(cpl_default_counters(), cpl_malloc_usable_size(ptr));
+    }
     free(ptr);
 }
 
+static inline void* cpl_default_realloc(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
+{
+    if(ptr && !sz)
+    {
+        /* glibc frees the chunk and returns 0, do so everywhere and count it */
+        cpl_default_free(pAllocator, ptr);
+        return 0;
+    }
+    
+    size_t old_usable = ptr ? cpl_malloc_usable_size(ptr) : 0;
+    void* new_ptr = realloc(ptr, sz);
+    if(new_ptr)
+    {
+        size_t usable = cpl_malloc_usable_size(new_ptr);
+        struct cpl_allocator_counters* counters = cpl_default_counters();
+        if(ptr)
+        {
+            cpl_counters_resize(counters, old_usable, usable);
+        }
+        else
+        {
+            cpl_counters_alloc(counters, sz, usable);
+        }
+    }
+    return new_ptr;
+}
+
+static void cpl_default_stats(struct cpl_allocator* pAllocator, cpl_allocator_stats_t* stats)
+{
+    pthread_once(&_default_stats_once, cpl_default_stats_init);
+    cpl_stats_shards_collect(&_default_stats, stats);
+}
+
+static size_t cpl_default_trim(struct cpl_allocator* pAllocator, size_t pad)
+{
+#if defined(__APPLE__)
+    return malloc_zone_pressure_relief(0, 0);
+#elif defined(__GLIBC__)
+    malloc_trim(pad);
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+/****************************** Page Mapping **********************************/
+/*
+ * Explicit huge pages come from a reserved pool: MAP_HUGETLB on Linux and
+ * superpages on Darwin. Either may be missing or exhausted, in which case
+ * normal pages are mapped.
+ */
+static void* cpl_map_huge(size_t* size, int populate)
+{
+    size_t huge_size = (*size + CPL_HUGE_PAGE_SIZE - 1) & ~(CPL_HUGE_PAGE_SIZE - 1);
+    void* addr = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+    addr = mmap(0, huge_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|populate, -1, 0);
+#elif defined(VM_FLAGS_SUPERPAGE_SIZE_2MB)
+    addr = mmap(0, huge_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, VM_FLAGS_SUPERPAGE_SIZE_2MB, 0);
+#endif
+    if(addr != MAP_FAILED)
+    {
+        *size = huge_size;
+    }
+    return addr;
+}
+
+void* cpl_allocator_map(size_t* size, unsigned flags)
+{
+    int populate = 0;
+#if defined(MAP_POPULATE)
+    if(flags & CPL_ALLOCATOR_MAP_POPULATE)
+    {
+        populate = MAP_POPULATE;
+        flags &= ~CPL_ALLOCATOR_MAP_POPULATE;
+    }
+#endif
+    
+    void* addr = MAP_FAILED;
+    if(flags & CPL_ALLOCATOR_MAP_HUGETLB)
+    {
+        addr = cpl_map_huge(size, populate);
+    }
+    
+    if(addr == MAP_FAILED)
+    {
+        addr = mmap(0, *size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|populate, -1, 0);
+        if(addr == MAP_FAILED)
+        {
+            return MAP_FAILED;
+        }
+#if defined(MADV_HUGEPAGE)
+        if(flags & (CPL_ALLOCATOR_MAP_HUGEPAGE|CPL_ALLOCATOR_MAP_HUGETLB))
+        {
+            /* THP may be disabled, it is only a hint anyway */
+            madvise(addr, *size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    
+    if(flags & CPL_ALLOCATOR_MAP_POPULATE)
+    {
+        /* no MAP_POPULATE, fault the pages in by hand */
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        for(size_t off = 0; off < *size; off += page_size)
+        {
+            ((volatile char *)addr)[off] = 0;
+        }
+    }
+    
+    if((flags & CPL_ALLOCATOR_MAP_LOCK) && mlock(addr, *size))
+    {
+        munmap(addr, *size);
+        return MAP_FAILED;
+    }
+    
+    return addr;
+}
+
+static size_t cpl_default_usable_size(struct cpl_allocator* pAllocator, void* ptr)
+{
+    return cpl_malloc_usable_size(ptr);
+}
+
+static size_t cpl_default_malloc_batch(struct cpl_allocator* pAllocator, size_t sz, size_t n, void** ptrs)
+{
+#if defined(__APPLE__)
+    /* the zone fills a run of chunks from one magazine */
+    size_t count = 0;
+    while(count < n)
+    {
+        unsigned num = (n - count > UINT_MAX)?UINT_MAX:(unsigned)(n - count);
+        unsigned got = malloc_zone_batch_malloc(malloc_default_zone(), sz, ptrs + count, num);
+        count += got;
+        if(got < num)
+        {
+            break;
+        }
+    }
+#else
+    size_t count = 0;
+    while(count < n && (ptrs[count] = malloc(sz)))
+    {
+        ++count;
+    }
+#endif
+    
+    size_t usable = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        usable += cpl_malloc_usable_size(ptrs[i]);
+    }
+    cpl_counters_alloc_n(cpl_default_counters(), sz, usable, count);
+    return count;
+}
+
+static void cpl_default_free_batch(struct cpl_allocator* pAllocator, void** ptrs, size_t n)
+{
+    size_t usable = 0, count = 0;
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(ptrs[i])
+        {
+            usable += cpl_malloc_usable_size(ptrs[i]);
+            ++count;
+#if !defined(__APPLE__)
+            free(ptrs[i]);
+#endif
+        }
+    }
+    cpl_counters_free_n(cpl_default_counters(), usable, count);
+    
+#if defined(__APPLE__)
+    /* skips null pointers as well */
+    while(n)
+    {
+        unsigned num = (n > UINT_MAX)?UINT_MAX:(unsigned)n;
+        malloc_zone_batch_free(malloc_default_zone(), ptrs, num);
+        ptrs += num;
+        n -= num;
+    }
+#endif
+}
+
+static void* cpl_default_malloc_aligned(struct cpl_allocator* pAllocator, size_t sz, size_t align)
+{
+    void* ptr = 0;
+    if(posix_memalign(&ptr, (align < sizeof(void *))?sizeof(void *):align, sz))
+    {
+        return 0;
+    }
+    cpl_counters_alloc(cpl_default_counters(), sz, cpl_malloc_usable_size(ptr));
+    return ptr;
+}
+
+static void* cpl_default_realloc_aligned(struct cpl_allocator* pAllocator, void* ptr, size_t sz, size_t align)
+{
+    if(!ptr)
+    {
+        return cpl_default_malloc_aligned(pAllocator, sz, align);
+    }
+    
+    /* realloc() may move the chunk to a less aligned address, so it is only
+     * kept when it fits already */
+    size_t old_usable = cpl_malloc_usable_size(ptr);
+    if(sz <= old_usable && !((size_t)ptr & (align - 1)))
+    {
+        return ptr;
+    }
+    
+    void* new_ptr = cpl_default_malloc_aligned(pAllocator, sz, align);
+    if(new_ptr)
+    {
+        memcpy(new_ptr, ptr, (sz < old_usable)?sz:old_usable);
+        cpl_default_free(pAllocator, ptr);
+    }
+    return new_ptr;
+}
+
 /*********************** Public Allocator routines  ***************************/
 cpl_allocator_ref cpl_allocator_get_default()
 {
-    static struct cpl_allocator _default_allocator = { cpl_default_malloc, cpl_default_realloc, cpl_default_free };
+    static struct cpl_allocator _default_allocator = { cpl_default_malloc, cpl_default_realloc, cpl_default_free,
+                                                       cpl_default_stats, cpl_default_trim,
+                                                       cpl_default_malloc_aligned, cpl_default_realloc_aligned,
+                                                       cpl_default_usable_size, 0,
+                                                       cpl_default_malloc_batch, cpl_default_free_batch };
     return &_default_allocator;
 }
 
@@ -72,3 +330,99 @@ void* cpl_allocator_realloc(cpl_allocator_ref allocator, void* ptr, size_t sz)
 {
     return allocator->xRealloc(allocator, ptr, sz);
 }
+
+void* cpl_allocator_allocate_aligned(cpl_allocator_ref allocator, size_t sz, size_t align)
+{
+    if(!align || (align & (align - 1)))
+    {
+        return 0;
+    }
+    if(allocator->xAllocateAligned)
+    {
+        return allocator->xAllocateAligned(allocator, sz, align);
+    }
+    
+    /* every allocator aligns chunks to a word at least */
+    return (align <= sizeof(void *))?allocator->xAllocate(allocator, sz):0;
+}
+
+void* cpl_allocator_realloc_aligned(cpl_allocator_ref allocator, void* ptr, size_t sz, size_t align)
+{
+    if(!align || (align & (align - 1)))
+    {
+        return 0;
+    }
+    if(allocator->xReallocAligned)
+    {
+        return allocator->xReallocAligned(allocator, ptr, sz, align);
+    }
+    return (align <= sizeof(void *))?allocator->xRealloc(allocator, ptr, sz):0;
+}
+
+size_t cpl_allocator_usable_size(cpl_allocator_ref allocator, void* ptr)
+{
+    return allocator->xUsableSize ? allocator->xUsableSize(allocator, ptr) : 0;
+}
+
+int cpl_allocator_try_expand(cpl_allocator_ref allocator, void* ptr, size_t sz)
+{
+    if(allocator->xTryExpand)
+    {
+        return allocator->xTryExpand(allocator, ptr, sz);
+    }
+    if(allocator->xUsableSize)
+    {
+        /* chunks of fixed size only grow into their slack */
+        return (sz <= allocator->xUsableSize(allocator, ptr))?_CPL_OK:_CPL_NOMEM;
+    }
+    return _CPL_INVALID_ARG;
+}
+
+size_t cpl_allocator_allocate_batch(cpl_allocator_ref allocator, size_t sz, size_t n, void** ptrs)
+{
+    if(allocator->xAllocateBatch)
+    {
+        return allocator->xAllocateBatch(allocator, sz, n, ptrs);
+    }
+    
+    size_t i = 0;
+    while(i < n && (ptrs[i] = allocator->xAllocate(allocator, sz)))
+    {
+        ++i;
+    }
+    return i;
+}
+
+void cpl_allocator_free_batch(cpl_allocator_ref allocator, void** ptrs, size_t n)
+{
+    if(allocator->xFreeBatch)
+    {
+        allocator->xFreeBatch(allocator, ptrs, n);
+        return ;
+    }
+    
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(ptrs[i])
+        {
+            allocator->xFree(allocator, ptrs[i]);
+        }
+    }
+}
+
+size_t cpl_allocator_trim(cpl_allocator_ref allocator, size_t pad)
+{
+    return allocator->xTrim ? allocator->xTrim(allocator, pad) : 0;
+}
+
+int cpl_allocator_get_stats(cpl_allocator_ref allocator, cpl_allocator_stats_t* stats)
+{
+    if(!allocator->xStats)
+    {
+        return _CPL_INVALID_ARG;
+    }
+    
+    memset(stats, 0, sizeof(cpl_allocator_stats_t));
+    allocator->xStats(allocator, stats);
+    return _CPL_OK;
+}
@@ -0,0 +1,389 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cpl_allocator_private.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cpl_error.h"
+
+/******************** Monotonic Arena Allocator Implementation ****************/
+
+#define ARENA_ALIGNMENT         16
+
+/* empty chunks take space too, or they would share the address of the next */
+static inline size_t arena_align(size_t sz)
+{
+    return sz?(sz + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1):ARENA_ALIGNMENT;
+}
+
+struct arena_block
+{
+    struct arena_block* prev;
+    size_t      size;           /* bytes available in data */
+    size_t      used;
+    char        data[] __attribute__((aligned(ARENA_ALIGNMENT)));
+};
+
+#define ARENA_BLOCK_HEADER      (offsetof(struct arena_block, data))
+
+/* bytes to skip in a block for the next chunk to be aligned to _a_ */
+#define arena_padding(b, a)     ((-(size_t)((b)->data + (b)->used)) & ((a) - 1))
+
+struct cpl_arena_allocator
+{
+    /* struct cpl_allocator */
+    CPL_ALLOCATOR_INTERFACE
+    
+    /* arena-specific data */
+    struct arena_block* current;
+    struct arena_block* spare;  /* the last released block, reused first */
+    size_t      blockSize;
+    char*       last;           /* most recent allocation, may grow in place */
+    /* live and mapped bytes are computed from the blocks */
+    struct cpl_allocator_counters counters;
+};
+
+static struct arena_block* arena_new_block(struct cpl_arena_allocator* pArena, size_t sz)
+{
+    struct arena_block* block = pArena->spare;
+    if(block && block->size >= sz)
+    {
+        pArena->spare = 0;
+    }
+    else
+    {
+        size_t size = (sz > pArena->blockSize)?sz:pArena->blockSize;
+        if(size > (size_t)-1 - ARENA_BLOCK_HEADER)
+        {
+            return 0;
+        }
+        
+        block = malloc(ARENA_BLOCK_HEADER + size);
+        if(!block)
+        {
+            return 0;
+        }
+        block->size = size;
+    }
+    
+    block->used = 0;
+    block->prev = pArena->current;
+    pArena->current = block;
+    return block;
+}
+
+static size_t arena_used(struct cpl_arena_allocator* pArena)
+{
+    size_t used = 0;
+    for(struct arena_block* block = pArena->current; block; block = block->prev)
+    {
+        used += block->used;
+    }
+    return used;
+}
+
+/*
+ * The peak is sampled whenever memory is about to be released.
+ */
+static void arena_sample_peak(struct cpl_arena_allocator* pArena)
+{
+    size_t used = arena_used(pArena);
+    if(used > pArena->counters.peak)
+    {
+        pArena->counters.peak = used;
+    }
+}
+
+static void arena_drop_block(struct cpl_arena_allocator* pArena, struct arena_block* block)
+{
+    if(!pArena->spare && block->size == pArena->blockSize)
+    {
+        pArena->spare = block;
+    }
+    else
+    {
+        free(block);
+    }
+}
+
+static void* arena_malloc(struct cpl_arena_allocator* pArena, size_t sz, size_t align)
+{
+    size_t size = arena_align(sz);
+    if(size < sz)
+    {
+        return 0;
+    }
+    
+    struct arena_block* block = pArena->current;
+    size_t pad = block ? arena_padding(block, align) : 0;
+    if(!block || block->size - block->used < pad || block->size - block->used - pad < size)
+    {
+        /* blocks are aligned to ARENA_ALIGNMENT only */
+        size_t worst = size + ((align > ARENA_ALIGNMENT)?align - ARENA_ALIGNMENT:0);
+        if(worst < size || !(block = arena_new_block(pArena, worst)))
+        {
+            return 0;
+        }
+        pad = arena_padding(block, align);
+    }
+    
+    pArena->last = block->data + block->used + pad;
+    block->used += pad + size;
+    
+    ++pArena->counters.nallocs;
+    ++pArena->counters.histogram[cpl_stats_bucket(sz)];
+    return pArena->last;
+}
+
+static void* cpl_arena_malloc(struct cpl_allocator* pAllocator, size_t sz)
+{
+    return arena_malloc((struct cpl_arena_allocator *)pAllocator, sz, ARENA_ALIGNMENT);
+}
+
+static void* cpl_arena_malloc_aligned(struct cpl_allocator* pAllocator, size_t sz, size_t align)
+{
+    return arena_malloc((struct cpl_arena_allocator *)pAllocator, sz, align);
+}
+
+static void cpl_arena_free(struct cpl_allocator* pAllocator, void* ptr)
+{
+    /* memory is released with the whole arena or to a mark */
+    if(ptr)
+    {
+        ++((struct cpl_arena_allocator *)pAllocator)->counters.nfrees;
+    }
+}
+
+/* resizes the most recent allocation in place, returns 1 on success */
+static int arena_resize_last(struct cpl_arena_allocator* pArena, void* ptr, size_t size)
+{
+    struct arena_block* block = pArena->current;
+    if(ptr != pArena->last || !block)
+    {
+        return 0;
+    }
+    
+    size_t offset = (char *)ptr - block->data;
+    if(block->size - offset < size)
+    {
+        return 0;
+    }
+    block->used = offset + size;
+    return 1;
+}
+
+static void* arena_realloc(struct cpl_arena_allocator* pArena, void* ptr, size_t sz, size_t align)
+{
+    if(!ptr)
+    {
+        return arena_malloc(pArena, sz, align);
+    }
+    
+    size_t size = arena_align(sz);
+    if(size < sz)
+    {
+        return 0;
+    }
+    
+    /* find the block the chunk was cut from */
+    struct arena_block* block = pArena->current;
+    while(block && !((char *)ptr >= block->data && (char *)ptr < block->data + block->used))
+    {
+        block = block->prev;
+    }
+    assert(block);
+    if(!block)
+    {
+        return 0;
+    }
+    
+    /* sizes are not kept, but a chunk spans at most to the end of used
+     * space of its block */
+    size_t old_sz = block->data + block->used - (char *)ptr;
+    if(!((size_t)ptr & (align - 1)) && arena_resize_last(pArena, ptr, size))
+    {
+        /* the most recent allocation grows or shrinks in place */
+        return ptr;
+    }
+    
+    void* new_ptr = arena_malloc(pArena, sz, align);
+    if(new_ptr)
+    {
+        memcpy(new_ptr, ptr, (sz < old_sz)?sz:old_sz);
+    }
+    return new_ptr;
+}
+
+static void* cpl_arena_realloc(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
+{
+    return arena_realloc((struct cpl_arena_allocator *)pAllocator, ptr, sz, ARENA_ALIGNMENT);
+}
+
+static void* cpl_arena_realloc_aligned(struct cpl_allocator* pAllocator, void* ptr, size_t sz, size_t align)
+{
+    return arena_realloc((struct cpl_arena_allocator *)pAllocator, ptr, sz, align);
+}
+
+static size_t cpl_arena_usable_size(struct cpl_allocator* pAllocator, void* ptr)
+{
+    struct cpl_arena_allocator* pArena = (struct cpl_arena_allocator *)pAllocator;
+    
+    /* only the most recent allocation knows where it ends */
+    return (ptr == pArena->last) ? (size_t)(pArena->current->data + pArena->current->used - (char *)ptr) : 0;
+}
+
+static int cpl_arena_try_expand(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
+{
+    size_t size = arena_align(sz);
+    if(size < sz)
+    {
+        return _CPL_NOMEM;
+    }
+    if(sz <= cpl_arena_usable_size(pAllocator, ptr))
+    {
+        return _CPL_OK;
+    }
+    return arena_resize_last((struct cpl_arena_allocator *)pAllocator, ptr, size)?_CPL_OK:_CPL_NOMEM;
+}
+
+static void cpl_arena_stats(struct cpl_allocator* pAllocator, cpl_allocator_stats_t* stats)
+{
+    struct cpl_arena_allocator* pArena = (struct cpl_arena_allocator *)pAllocator;
+    arena_sample_peak(pArena);
+    
+    struct cpl_allocator_counters counters = pArena->counters;
+    counters.live = arena_used(pArena);
+    counters.mapped = pArena->spare ? ARENA_BLOCK_HEADER + pArena->spare->size : 0;
+    for(struct arena_block* block = pArena->current; block; block = block->prev)
+    {
+        counters.mapped += ARENA_BLOCK_HEADER + block->size;
+    }
+    cpl_counters_collect(&counters, stats);
+}
+
+static size_t cpl_arena_trim(struct cpl_allocator* pAllocator, size_t pad)
+{
+    struct cpl_arena_allocator* pArena = (struct cpl_arena_allocator *)pAllocator;
+    if(!pArena->spare)
+    {
+        return 0;
+    }
+    
+    size_t released = ARENA_BLOCK_HEADER + pArena->spare->size;
+    free(pArena->spare);
+    pArena->spare = 0;
+    return released;
+}
+
+/********************* Public Arena Allocator routines  ***********************/
+cpl_allocator_ref cpl_allocator_create_arena(size_t blockSize)
+{
+    struct cpl_arena_allocator* arena = malloc(sizeof(struct cpl_arena_allocator));
+    if(!arena)
+    {
+        return 0;
+    }
+    
+    arena->xAllocate = cpl_arena_malloc;
+    arena->xRealloc = cpl_arena_realloc;
+    arena->xFree = cpl_arena_free;
+    arena->xStats = cpl_arena_stats;
+    arena->xTrim = cpl_arena_trim;
+    arena->xAllocateAligned = cpl_arena_malloc_aligned;
+    arena->xReallocAligned = cpl_arena_realloc_aligned;
+    arena->xUsableSize = cpl_arena_usable_size;
+    arena->xTryExpand = cpl_arena_try_expand;
+    arena->xAllocateBatch = 0;
+    arena->xFreeBatch = 0;
+    arena->current = 0;
+    arena->spare = 0;
+    arena->blockSize = arena_align(blockSize ? blockSize : 0x10000 - ARENA_BLOCK_HEADER);
+    arena->last = 0;
+    memset(&arena->counters, 0, sizeof(arena->counters));
+    
+    return (cpl_allocator_ref)arena;
+}
+
+void cpl_allocator_destroy_arena(cpl_allocator_ref allocator)
+{
+    assert(allocator != cpl_allocator_get_default());
+    struct cpl_arena_allocator* pArena = (struct cpl_arena_allocator *)allocator;
+    
+    cpl_allocator_arena_reset(allocator);
+    free(pArena->current);
+    free(pArena->spare);
+    free(pArena);
+}
+
+cpl_arena_mark_t cpl_allocator_arena_mark(cpl_allocator_ref allocator)
+{
+    struct cpl_arena_allocator* pArena = (struct cpl_arena_allocator *)allocator;
+    cpl_arena_mark_t mark;
+    mark.block = pArena->current;
+    mark.offset = pArena->current ? pArena->current->used : 0;
+    return mark;
+}
+
+void cpl_allocator_arena_release_to_mark(cpl_allocator_ref allocator, cpl_arena_mark_t mark)
+{
+    struct cpl_arena_allocator* pArena = (struct cpl_arena_allocator *)allocator;
+    arena_sample_peak(pArena);
+    
+    while(pArena->current != mark.block)
+    {
+        assert(pArena->current);
+        struct arena_block* block = pArena->current;
+        pArena->current = block->prev;
+        arena_drop_block(pArena, block);
+    }
+    
+    if(pArena->current)
+    {
+        assert(mark.offset <= pArena->current->used);
+        pArena->current->used = mark.offset;
+    }
+    pArena->last = 0;
+}
+
+void cpl_allocator_arena_reset(cpl_allocator_ref allocator)
+{
+    struct cpl_arena_allocator* pArena = (struct cpl_arena_allocator *)allocator;
+    arena_sample_peak(pArena);
+    
+    /* keep the first block around for the next round */
+    while(pArena->current && pArena->current->prev)
+    {
+        struct arena_block* block = pArena->current;
+        pArena->current = block->prev;
+        arena_drop_block(pArena, block);
+    }
+    
+    if(pArena->current)
+    {
+        pArena->current->used = 0;
+    }
+    pArena->last = 0;
+}
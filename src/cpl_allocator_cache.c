@@ -0,0 +1,445 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cpl_allocator_private.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cpl_error.h"
+#include "cpl_list.h"
+
+/******************** Thread Caching Allocator Implementation *****************/
+
+/* size classes: multiples of 16 bytes up to 1 KB */
+#define CACHE_CLASS_SHIFT       (4U)
+#define CACHE_NCLASSES          (64U)
+#define CACHE_MAX_SIZE          ((size_t)CACHE_NCLASSES << CACHE_CLASS_SHIFT)
+#define CACHE_LARGE_CLASS       (CACHE_NCLASSES)
+
+#define cache_class_index(s)    ((unsigned)(((s) + (1U << CACHE_CLASS_SHIFT) - 1) >> CACHE_CLASS_SHIFT) - 1)
+#define cache_class_size(i)     ((size_t)((i) + 1) << CACHE_CLASS_SHIFT)
+
+/* objects moved between a thread cache and the backing allocator at once */
+#define cache_batch_count(i)    (cache_class_size(i) > 256 ? 8 : 32)
+
+/*
+ * Every chunk is prefixed with a header that remembers its size class, so
+ * that it can be put back to the proper list by whichever thread frees it.
+ * Chunks served by the backing allocator directly keep their size on top of
+ * CACHE_LARGE_CLASS. The header takes a word, the only alignment every
+ * backing allocator guarantees, so chunks are aligned to a word as well.
+ */
+struct cache_header
+{
+    size_t      cls;
+};
+typedef struct cache_header cache_header;
+
+#define cache_hdr2ptr(h)        ((void *)((cache_header *)(h) + 1))
+#define cache_ptr2hdr(p)        ((cache_header *)(p) - 1)
+#define cache_is_large(h)       ((h)->cls >= CACHE_LARGE_CLASS)
+#define cache_large_size(h)     ((h)->cls - CACHE_LARGE_CLASS)
+
+struct cache_bin
+{
+    cpl_slist_t list;
+    size_t      count;
+};
+
+struct cache_tls
+{
+    struct cache_bin   bins[CACHE_NCLASSES];
+    struct cpl_cache_allocator* owner;
+    cpl_dlist_t        link;
+};
+
+struct cpl_cache_allocator
+{
+    /* struct cpl_allocator */
+    CPL_ALLOCATOR_INTERFACE
+    
+    /* cache-specific data */
+    cpl_allocator_ref   backing;
+    pthread_mutex_t     lock;       /* guards backing, caches and held */
+    pthread_key_t       key;
+    cpl_dlist_t         caches;     /* all thread caches */
+    size_t              held;       /* bytes taken from backing */
+    struct cpl_stats_shards shards;
+};
+
+static void cache_flush_bin(struct cpl_cache_allocator* pCacheAllocator, struct cache_bin* bin, unsigned cls, size_t n)
+{
+    size_t sz = sizeof(cache_header) + cache_class_size(cls);
+    
+    pthread_mutex_lock(&pCacheAllocator->lock);
+    while(n-- && bin->count)
+    {
+        cpl_allocator_free(pCacheAllocator->backing, cpl_slist_pop(&bin->list));
+        --bin->count;
+        pCacheAllocator->held -= sz;
+    }
+    pthread_mutex_unlock(&pCacheAllocator->lock);
+}
+
+static void cache_refill_bin(struct cpl_cache_allocator* pCacheAllocator, struct cache_bin* bin, unsigned cls)
+{
+    size_t sz = sizeof(cache_header) + cache_class_size(cls);
+    size_t n = cache_batch_count(cls);
+    
+    pthread_mutex_lock(&pCacheAllocator->lock);
+    while(n--)
+    {
+        cache_header* hdr = cpl_allocator_allocate(pCacheAllocator->backing, sz);
+        if(!hdr)
+        {
+            break;
+        }
+        cpl_slist_add(&bin->list, (cpl_slist_ref)hdr);
+        ++bin->count;
+        pCacheAllocator->held += sz;
+    }
+    pthread_mutex_unlock(&pCacheAllocator->lock);
+}
+
+/*
+ * Returns all cached chunks of a thread to the backing allocator.
+ * Must be called with the lock held.
+ */
+static void cache_release_tls(struct cpl_cache_allocator* pCacheAllocator, struct cache_tls* tls)
+{
+    for(unsigned i = 0; i < CACHE_NCLASSES; ++i)
+    {
+        cpl_slist_ref entry;
+        while((entry = cpl_slist_pop(&tls->bins[i].list)) != 0)
+        {
+            cpl_allocator_free(pCacheAllocator->backing, entry);
+            pCacheAllocator->held -= sizeof(cache_header) + cache_class_size(i);
+        }
+    }
+    cpl_dlist_del(&tls->link);
+    free(tls);
+}
+
+static void cache_thread_exit(void* arg)
+{
+    struct cache_tls* tls = (struct cache_tls *)arg;
+    struct cpl_cache_allocator* pCacheAllocator = tls->owner;
+    
+    pthread_mutex_lock(&pCacheAllocator->lock);
+    cache_release_tls(pCacheAllocator, tls);
+    pthread_mutex_unlock(&pCacheAllocator->lock);
+}
+
+static struct cache_tls* cache_get_tls(struct cpl_cache_allocator* pCacheAllocator)
+{
+    struct cache_tls* tls = pthread_getspecific(pCacheAllocator->key);
+    if(tls)
+    {
+        return tls;
+    }
+    
+    tls = calloc(1, sizeof(struct cache_tls));
+    if(!tls)
+    {
+        return 0;
+    }
+    tls->owner = pCacheAllocator;
+    
+    pthread_mutex_lock(&pCacheAllocator->lock);
+    cpl_dlist_add_tail(&tls->link, &pCacheAllocator->caches);
+    pthread_mutex_unlock(&pCacheAllocator->lock);
+    
+    pthread_setspecific(pCacheAllocator->key, tls);
+    return tls;
+}
+
+static void* cpl_cache_malloc(struct cpl_allocator* pAllocator, size_t sz)
+{
+    struct cpl_cache_allocator* pCacheAllocator = (struct cpl_cache_allocator *)pAllocator;
+    struct cache_tls* tls;
+    
+    if(sz > CACHE_MAX_SIZE || !(tls = cache_get_tls(pCacheAllocator)))
+    {
+        if(sz > (size_t)-1 - sizeof(cache_header))
+        {
+            return 0;
+        }
+        
+        pthread_mutex_lock(&pCacheAllocator->lock);
+        cache_header* hdr = cpl_allocator_allocate(pCacheAllocator->backing, sizeof(cache_header) + sz);
+        if(hdr)
+        {
+            pCacheAllocator->held += sizeof(cache_header) + sz;
+        }
+        pthread_mutex_unlock(&pCacheAllocator->lock);
+        if(!hdr)
+        {
+            return 0;
+        }
+        
+        hdr->cls = CACHE_LARGE_CLASS + sz;
+        cpl_counters_alloc(cpl_stats_shards_local(&pCacheAllocator->shards), sz, sz);
+        return cache_hdr2ptr(hdr);
+    }
+    
+    unsigned cls = sz ? cache_class_index(sz) : 0;
+    struct cache_bin* bin = &tls->bins[cls];
+    if(!bin->count)
+    {
+        cache_refill_bin(pCacheAllocator, bin, cls);
+        if(!bin->count)
+        {
+            return 0;
+        }
+    }
+    
+    /* the link of a cached chunk overlaps its header */
+    cache_header* hdr = (cache_header *)cpl_slist_pop(&bin->list);
+    hdr->cls = cls;
+    --bin->count;
+    cpl_counters_alloc(cpl_stats_shards_local(&pCacheAllocator->shards), sz, cache_class_size(cls));
+    return cache_hdr2ptr(hdr);
+}
+
+static void cpl_cache_free(struct cpl_allocator* pAllocator, void* ptr)
+{
+    struct cpl_cache_allocator* pCacheAllocator = (struct cpl_cache_allocator *)pAllocator;
+    if(!ptr)
+    {
+        return ;
+    }
+    
+    cache_header* hdr = cache_ptr2hdr(ptr);
+    struct cache_tls* tls;
+    
+    if(cache_is_large(hdr))
+    {
+        size_t sz = cache_large_size(hdr);
+        cpl_counters_free(cpl_stats_shards_local(&pCacheAllocator->shards), sz);
+        
+        pthread_mutex_lock(&pCacheAllocator->lock);
+        cpl_allocator_free(pCacheAllocator->backing, hdr);
+        pCacheAllocator->held -= sizeof(cache_header) + sz;
+        pthread_mutex_unlock(&pCacheAllocator->lock);
+        return ;
+    }
+    
+    unsigned cls = (unsigned)hdr->cls;
+    cpl_counters_free(cpl_stats_shards_local(&pCacheAllocator->shards), cache_class_size(cls));
+    if(!(tls = cache_get_tls(pCacheAllocator)))
+    {
+        pthread_mutex_lock(&pCacheAllocator->lock);
+        cpl_allocator_free(pCacheAllocator->backing, hdr);
+        pCacheAllocator->held -= sizeof(cache_header) + cache_class_size(cls);
+        pthread_mutex_unlock(&pCacheAllocator->lock);
+        return ;
+    }
+    
+    /* the chunk may come from another thread, it joins the local cache */
+    struct cache_bin* bin = &tls->bins[cls];
+    cpl_slist_add(&bin->list, (cpl_slist_ref)hdr);
+    ++bin->count;
+    
+    if(bin->count > 2 * cache_batch_count(cls))
+    {
+        cache_flush_bin(pCacheAllocator, bin, cls, cache_batch_count(cls));
+    }
+}
+
+static void* cpl_cache_realloc(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
+{
+    if(!ptr)
+    {
+        return cpl_cache_malloc(pAllocator, sz);
+    }
+    
+    cache_header* hdr = cache_ptr2hdr(ptr);
+    if(!cache_is_large(hdr))
+    {
+        size_t old_sz = cache_class_size(hdr->cls);
+        if(sz <= CACHE_MAX_SIZE && (sz ? cache_class_index(sz) : 0) == hdr->cls)
+        {
+            /* fits into the same size class */
+            return ptr;
+        }
+        
+        void* new_ptr = cpl_cache_malloc(pAllocator, sz);
+        if(new_ptr)
+        {
+            memcpy(new_ptr, ptr, (sz < old_sz)?sz:old_sz);
+            cpl_cache_free(pAllocator, ptr);
+        }
+        return new_ptr;
+    }
+    
+    struct cpl_cache_allocator* pCacheAllocator = (struct cpl_cache_allocator *)pAllocator;
+    if(sz <= CACHE_MAX_SIZE || sz > (size_t)-1 - sizeof(cache_header))
+    {
+        /* shrinking below the cached sizes keeps the large chunk */
+        return (sz <= CACHE_MAX_SIZE)?ptr:0;
+    }
+    
+    size_t old_sz = cache_large_size(hdr);
+    pthread_mutex_lock(&pCacheAllocator->lock);
+    hdr = cpl_allocator_realloc(pCacheAllocator->backing, hdr, sizeof(cache_header) + sz);
+    if(hdr)
+    {
+        pCacheAllocator->held += sz - old_sz;
+    }
+    pthread_mutex_unlock(&pCacheAllocator->lock);
+    if(!hdr)
+    {
+        return 0;
+    }
+    
+    hdr->cls = CACHE_LARGE_CLASS + sz;
+    cpl_counters_resize(cpl_stats_shards_local(&pCacheAllocator->shards), old_sz, sz);
+    return cache_hdr2ptr(hdr);
+}
+
+static size_t cpl_cache_usable_size(struct cpl_allocator* pAllocator, void* ptr)
+{
+    cache_header* hdr = cache_ptr2hdr(ptr);
+    return cache_is_large(hdr) ? cache_large_size(hdr) : cache_class_size(hdr->cls);
+}
+
+static int cpl_cache_try_expand(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
+{
+    struct cpl_cache_allocator* pCacheAllocator = (struct cpl_cache_allocator *)pAllocator;
+    cache_header* hdr = cache_ptr2hdr(ptr);
+    
+    if(sz <= cpl_cache_usable_size(pAllocator, ptr))
+    {
+        return _CPL_OK;
+    }
+    if(!cache_is_large(hdr) || sz > (size_t)-1 - sizeof(cache_header))
+    {
+        /* cached chunks cannot leave their size class */
+        return _CPL_NOMEM;
+    }
+    
+    size_t old_sz = cache_large_size(hdr);
+    pthread_mutex_lock(&pCacheAllocator->lock);
+    int rc = cpl_allocator_try_expand(pCacheAllocator->backing, hdr, sizeof(cache_header) + sz);
+    if(rc == _CPL_OK)
+    {
+        pCacheAllocator->held += sz - old_sz;
+    }
+    pthread_mutex_unlock(&pCacheAllocator->lock);
+    if(rc != _CPL_OK)
+    {
+        return rc;
+    }
+    
+    hdr->cls = CACHE_LARGE_CLASS + sz;
+    cpl_counters_resize(cpl_stats_shards_local(&pCacheAllocator->shards), old_sz, sz);
+    return _CPL_OK;
+}
+
+static void cpl_cache_stats(struct cpl_allocator* pAllocator, cpl_allocator_stats_t* stats)
+{
+    struct cpl_cache_allocator* pCacheAllocator = (struct cpl_cache_allocator *)pAllocator;
+    cpl_stats_shards_collect(&pCacheAllocator->shards, stats);
+    
+    pthread_mutex_lock(&pCacheAllocator->lock);
+    stats->mapped_bytes += pCacheAllocator->held;
+    pthread_mutex_unlock(&pCacheAllocator->lock);
+}
+
+static size_t cpl_cache_trim(struct cpl_allocator* pAllocator, size_t pad)
+{
+    struct cpl_cache_allocator* pCacheAllocator = (struct cpl_cache_allocator *)pAllocator;
+    
+    /* chunks in thread caches stay there, only the backing allocator trims */
+    pthread_mutex_lock(&pCacheAllocator->lock);
+    size_t released = cpl_allocator_trim(pCacheAllocator->backing, pad);
+    pthread_mutex_unlock(&pCacheAllocator->lock);
+    return released;
+}
+
+/****************** Public Thread Caching Allocator routines  *****************/
+cpl_allocator_ref cpl_allocator_create_cache(cpl_allocator_ref backing)
+{
+    assert(backing);
+    
+    struct cpl_cache_allocator* cacheAllocator = malloc(sizeof(struct cpl_cache_allocator));
+    if(!cacheAllocator)
+    {
+        return 0;
+    }
+    
+    if(pthread_key_create(&cacheAllocator->key, cache_thread_exit))
+    {
+        free(cacheAllocator);
+        return 0;
+    }
+    
+    if(!cpl_stats_shards_init(&cacheAllocator->shards))
+    {
+        pthread_key_delete(cacheAllocator->key);
+        free(cacheAllocator);
+        return 0;
+    }
+    
+    cacheAllocator->xAllocate = cpl_cache_malloc;
+    cacheAllocator->xRealloc = cpl_cache_realloc;
+    cacheAllocator->xFree = cpl_cache_free;
+    cacheAllocator->xStats = cpl_cache_stats;
+    cacheAllocator->xTrim = cpl_cache_trim;
+    cacheAllocator->xAllocateAligned = 0;
+    cacheAllocator->xReallocAligned = 0;
+    cacheAllocator->xUsableSize = cpl_cache_usable_size;
+    cacheAllocator->xTryExpand = cpl_cache_try_expand;
+    cacheAllocator->xAllocateBatch = 0;
+    cacheAllocator->xFreeBatch = 0;
+    cacheAllocator->backing = backing;
+    cacheAllocator->held = 0;
+    pthread_mutex_init(&cacheAllocator->lock, 0);
+    cacheAllocator->caches.next = cacheAllocator->caches.prev = &cacheAllocator->caches;
+    
+    return (cpl_allocator_ref)cacheAllocator;
+}
+
+void cpl_allocator_destroy_cache(cpl_allocator_ref allocator)
+{
+    assert(allocator != cpl_allocator_get_default());
+    struct cpl_cache_allocator* pCacheAllocator = (struct cpl_cache_allocator *)allocator;
+    
+    /* threads still alive keep their key values, so drop the caches here */
+    pthread_key_delete(pCacheAllocator->key);
+    
+    pthread_mutex_lock(&pCacheAllocator->lock);
+    while(!cpl_dlist_empty(&pCacheAllocator->caches))
+    {
+        struct cache_tls* tls = cpl_dlist_entry(pCacheAllocator->caches.next, struct cache_tls, link);
+        cache_release_tls(pCacheAllocator, tls);
+    }
+    pthread_mutex_unlock(&pCacheAllocator->lock);
+    
+    cpl_stats_shards_destroy(&pCacheAllocator->shards);
+    pthread_mutex_destroy(&pCacheAllocator->lock);
+    free(pCacheAllocator);
+}
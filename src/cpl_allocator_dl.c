@@ -21,13 +21,27 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#include "cpl_allocator.h"
+#if defined(__linux__)
+#   define _GNU_SOURCE          /* mremap */
+#endif
+
+#include "cpl_allocator_private.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "cpl_atomic.h"
+#include "cpl_error.h"
 #include "cpl_list.h"
 
 #ifndef MAP_ANONYMOUS
@@ -36,14 +50,21 @@
 #   endif
 #endif
 
+/* Darwin reclaims MADV_FREE pages at once, Linux only under pressure */
+#if defined(__APPLE__)
+#   define DL_MADV_RELEASE      MADV_FREE
+#else
+#   define DL_MADV_RELEASE      MADV_DONTNEED
+#endif
+
 /********************* Doug Lea's Allocator routines  *************************/
 
 /* flags */
 #define DL_PINUSE_BIT           ((size_t)0x1)
 #define DL_CINUSE_BIT           ((size_t)0x2)
-#define DL_RESERV_BIT           ((size_t)0x4)
+#define DL_MMAPPED_BIT          ((size_t)0x4)
 #define DL_INUSE_BITS           (DL_CINUSE_BIT | DL_PINUSE_BIT)
-#define DL_FLAGS_MASK           (DL_INUSE_BITS | DL_RESERV_BIT)
+#define DL_FLAGS_MASK           (DL_INUSE_BITS | DL_MMAPPED_BIT)
 
 /* calculation helpers */
 #define dl_chunk_plus_offset(c, o)  ((dl_chunk *)((char *)(c) + (o)))
@@ -52,18 +73,20 @@
 /* flag getters */
 #define dl_pinuse(c)            ((c)->head & DL_PINUSE_BIT)
 #define dl_cinuse(c)            ((c)->head & DL_CINUSE_BIT)
+#define dl_is_mmapped(c)        ((c)->head & DL_MMAPPED_BIT)
 
 /* flag setters */
 #define set_pinuse(c)           ((c)->head |= DL_PINUSE_BIT)
 #define clear_pinuse(c)         ((c)->head &= ~DL_PINUSE_BIT)
-#define set_inuse(c, s)         ((c)->head = dl_pinuse(c) | DL_CINUSE_BIT | (s)), \
-set_pinuse(dl_chunk_plus_offset(c, s))
+#define set_inuse(c, s)         ((c)->head = dl_pinuse(c) | DL_CINUSE_BIT | (s))
+
 /* chunk sizes */
 #define DL_CHUNK_SIZE           (sizeof(struct dl_chunk))
 #define DL_CHUNK_OVERHEAD       (sizeof(size_t))
+#define DL_MIN_REQUEST          (DL_CHUNK_SIZE - DL_CHUNK_OVERHEAD)
 
 #define dl_pad_request(s)       (((s) + DL_CHUNK_OVERHEAD + DL_FLAGS_MASK) & ~DL_FLAGS_MASK)
-#define request2size(s)         ((s) < DL_CHUNK_SIZE ? DL_CHUNK_SIZE : dl_pad_request(s))
+#define request2size(s)         ((s) < DL_MIN_REQUEST ? DL_CHUNK_SIZE : dl_pad_request(s))
 #define ok_address(c, a)        (((size_t)(c) >= (size_t)(a)->start_addr) && \
 ((size_t)(c) < (size_t)(a)->end_addr))
 
@@ -72,17 +95,46 @@ set_pinuse(dl_chunk_plus_offset(c, s))
 #define chunk2ptr(c)            ((void*)&((c)->list))
 #define ptr2chunk(ptr)          ((dl_chunk*)((char*)(ptr) - offsetof(dl_chunk, list)))
 
-struct cpl_dl_allocator
-{
-    void*       (*xAllocate)(struct cpl_allocator*, size_t);
-    void*       (*xRealloc)(struct cpl_allocator*, void* ptr, size_t);
-    void        (*xFree)(struct cpl_allocator*, void* ptr);
-    /* The Heap */
-    void*       start_addr;
-    void*       end_addr;
-    void*       max_addr;
-    cpl_dlist_t head;
-};
+/* bins */
+#define DL_NSMALLBINS           (32U)
+#define DL_NTREEBINS            (32U)
+#define DL_SMALLBIN_SHIFT       (3U)
+#define DL_TREEBIN_SHIFT        (8U)
+#define DL_SIZE_T_BITSIZE       (sizeof(size_t) << 3)
+
+#define dl_is_small(s)          (((s) >> DL_SMALLBIN_SHIFT) < DL_NSMALLBINS)
+#define dl_small_index(s)       ((unsigned)((s) >> DL_SMALLBIN_SHIFT))
+#define dl_leftshift_for_tree_index(i) \
+((i) == DL_NTREEBINS - 1 ? 0 : ((DL_SIZE_T_BITSIZE - 1) - (((i) >> 1) + DL_TREEBIN_SHIFT - 2)))
+
+/* bitmap helpers */
+#define dl_idx2bit(i)           ((uint32_t)1 << (i))
+#define dl_least_bit(x)         ((x) & -(x))
+#define dl_left_bits(x)         (((x) << 1) | -((x) << 1))
+#define dl_bit2idx(x)           ((unsigned)__builtin_ctz(x))
+
+/* page release */
+#define DL_PAGE_SIZE            ((size_t)0x1000)
+#define dl_page_align(s)        (((s) + DL_PAGE_SIZE - 1) & ~(DL_PAGE_SIZE - 1))
+#define dl_page_floor(s)        ((s) & ~(DL_PAGE_SIZE - 1))
+#define DL_TRIM_THRESHOLD       ((size_t)0x100000)  /* top size to trim at */
+#define DL_TOP_PAD              ((size_t)0x10000)   /* top size kept by trimming */
+#define DL_RELEASE_THRESHOLD    ((size_t)0x40000)   /* free chunk size to release pages of */
+#define DL_RELEASE_BUDGET       ((size_t)0x1000000) /* bytes of such chunks freed between sweeps */
+
+/* direct mapping */
+#define DL_MMAP_THRESHOLD       ((size_t)0x100000)  /* default chunk size to map directly */
+
+/* alignment */
+#define DL_MIN_ALIGNMENT        (DL_FLAGS_MASK + 1)
+#define dl_is_aligned(p, a)     (((size_t)(p) & ((a) - 1)) == 0)
+
+/* heap lives in a shared file mapping, next to the CPL_ALLOCATOR_MAP_* flags */
+#define DL_MAP_FILE             (0x100U)
+
+/* pages of prefaulted, locked, huge page or file heaps are never given back */
+#define DL_KEEP_PAGES           (CPL_ALLOCATOR_MAP_HUGETLB | CPL_ALLOCATOR_MAP_POPULATE | CPL_ALLOCATOR_MAP_LOCK | DL_MAP_FILE)
+#define dl_keeps_pages(m)       ((m)->map_flags & DL_KEEP_PAGES)
 
 struct dl_chunk
 {
@@ -92,445 +144,2245 @@ struct dl_chunk
 };
 typedef struct dl_chunk dl_chunk;
 
-static dl_chunk* dl_find_smallest_chunk(struct cpl_dl_allocator* dl_allocator, size_t sz)
+/*
+ * Free chunks of DL_NSMALLBINS << DL_SMALLBIN_SHIFT bytes and above are kept
+ * in bitwise digital trees keyed by size. Chunks of equal size hang off the
+ * tree node in a circular fd/bk ring; only the node itself has a parent.
+ */
+struct dl_tchunk
+{
+    size_t      prev_foot;
+    size_t      head;
+    struct dl_tchunk *fd, *bk;
+    struct dl_tchunk *child[2];
+    struct dl_tchunk *parent;
+    unsigned    index;
+};
+typedef struct dl_tchunk dl_tchunk;
+
+#define dl_leftmost_child(t)    ((t)->child[0] != 0 ? (t)->child[0] : (t)->child[1])
+
+/*
+ * Chunks of mmap_threshold bytes and above get a mapping of their own with
+ * this header in front. The chunk follows it and spans to the end of the
+ * mapping, it has no neighbours and never enters the bins. The header starts
+ * the mapping unless the chunk is aligned further than DL_MMAP_ALIGNMENT.
+ */
+struct dl_mmap_header
+{
+    cpl_dlist_t link;                   /* in the owner's list of mappings */
+    struct cpl_dl_allocator* owner;
+    size_t      size;                   /* of the whole mapping */
+    size_t      lead;                   /* bytes of the mapping before the header */
+} __attribute__((aligned(16)));
+
+#define DL_MMAP_OFFSET          (sizeof(struct dl_mmap_header))
+#define DL_MMAP_OVERHEAD        (DL_MMAP_OFFSET + offsetof(dl_chunk, list))
+#define DL_MMAP_ALIGNMENT       (DL_MMAP_OVERHEAD)  /* of the memory of a mapped chunk */
+#define dl_mmap_header(c)       ((struct dl_mmap_header *)((char *)(c) - DL_MMAP_OFFSET))
+#define dl_mmap_base(h)         ((char *)(h) - (h)->lead)
+#define dl_usable_size(c)       (dl_size(c) - (dl_is_mmapped(c) ? offsetof(dl_chunk, list) : DL_CHUNK_OVERHEAD))
+
+struct cpl_dl_allocator
+{
+    /* struct cpl_allocator */
+    CPL_ALLOCATOR_INTERFACE
+    
+    /* The Heap */
+    void*       start_addr;
+    void*       end_addr;
+    void*       max_addr;
+    /* The topmost free chunk borders end_addr and is never kept in bins */
+    dl_chunk*   top;
+    size_t      topsize;
+    /* Bins of free chunks with bitmaps of non-empty ones */
+    uint32_t    smallmap;
+    uint32_t    treemap;
+    cpl_dlist_t smallbins[DL_NSMALLBINS];
+    dl_tchunk*  treebins[DL_NTREEBINS];
+    /* CPL_ALLOCATOR_MAP_* flags the heap was mapped with */
+    unsigned    map_flags;
+    /* Directly mapped chunks */
+    size_t      mmap_threshold;
+    cpl_dlist_t mmapped;
+    /* Large chunks freed since pages of free chunks were last released */
+    size_t      release_pending;
+    /* Statistics, the top chunk is not counted in nfreechunks */
+    size_t      nfreechunks;
+    struct cpl_allocator_counters counters;
+};
+
+static inline unsigned dl_tree_index(size_t sz)
 {
-    dl_chunk* tmp = 0;
-    struct cpl_dlist* iter;
-    cpl_dlist_foreach(iter, &(dl_allocator->head))
+    size_t x = sz >> DL_TREEBIN_SHIFT;
+    if(x == 0)
     {
-        tmp = cpl_dlist_entry(iter, dl_chunk, list);
-        if(dl_size(tmp) >= sz)
-        {
-            break;
-        }
+        return 0;
     }
-    
-    if(iter == &(dl_allocator->head))
+    if(x > 0xFFFF)
     {
-        tmp = 0;
+        return DL_NTREEBINS - 1;
     }
     
-    return tmp;
+    unsigned k = 31 - __builtin_clz((unsigned)x);
+    return (k << 1) + (unsigned)((sz >> (k + (DL_TREEBIN_SHIFT - 1))) & 1);
 }
 
-static void dl_insert_chunk(struct cpl_dl_allocator* dl_allocator, dl_chunk* chunk)
+static void dl_insert_small_chunk(struct cpl_dl_allocator* dl_allocator, dl_chunk* chunk, size_t sz)
 {
-    struct cpl_dlist* iter = &(dl_allocator->head);
-    if(!cpl_dlist_empty(iter))
-    {
-        size_t size = dl_size(chunk);
-        cpl_dlist_foreach(iter, &(dl_allocator->head))
-        {
-            dl_chunk* tmp = cpl_dlist_entry(iter, dl_chunk, list);
-            if(dl_size(tmp) >= size)
-            {
-                break;
-            }
-        }
-    }
-    cpl_dlist_add_tail(&(chunk->list), iter);
+    unsigned idx = dl_small_index(sz);
+    cpl_dlist_add_tail(&(chunk->list), &(dl_allocator->smallbins[idx]));
+    dl_allocator->smallmap |= dl_idx2bit(idx);
 }
 
-static void dl_remove_chunk(dl_chunk* chunk)
+static void dl_remove_small_chunk(struct cpl_dl_allocator* dl_allocator, dl_chunk* chunk, size_t sz)
 {
+    unsigned idx = dl_small_index(sz);
     cpl_dlist_del(&(chunk->list));
-}
-
-static int cpl_dl_expand(struct cpl_dl_allocator* dl_allocator, size_t new_size)
-{
-    assert(new_size > (size_t)dl_allocator->end_addr - (size_t)dl_allocator->start_addr);
-    size_t off = (size_t)dl_allocator->start_addr - (size_t)dl_allocator;
-    new_size = ((new_size + off + 0xfff) & ~(0xfff)) - off;
-    void* new_end_addr = (char *)dl_allocator->start_addr + new_size;
-    if(new_end_addr > dl_allocator->max_addr)
+    if(cpl_dlist_empty(&(dl_allocator->smallbins[idx])))
     {
-        return 0;
+        dl_allocator->smallmap &= ~dl_idx2bit(idx);
     }
-    
-    dl_allocator->end_addr = new_end_addr;
-    
-    return 1;
 }
 
-static void* cpl_dl_malloc(struct cpl_allocator* allocator, size_t sz)
+static void dl_insert_large_chunk(struct cpl_dl_allocator* dl_allocator, dl_tchunk* chunk, size_t sz)
 {
-    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+    unsigned idx = dl_tree_index(sz);
+    dl_tchunk** root = &(dl_allocator->treebins[idx]);
     
-    size_t chunksize = request2size(sz);
-    dl_chunk *hole = dl_find_smallest_chunk(dl_allocator, chunksize);
-    if(!hole)
+    chunk->index = idx;
+    chunk->child[0] = chunk->child[1] = 0;
+    chunk->fd = chunk->bk = chunk;
+    
+    if(!(dl_allocator->treemap & dl_idx2bit(idx)))
     {
-        /* if we didn't find suitable hole, expand the heap */
-        size_t old_size = (size_t)dl_allocator->end_addr - (size_t)dl_allocator->start_addr;
-        void* old_end_addr = dl_allocator->end_addr;
-        int success = cpl_dl_expand(dl_allocator, old_size + chunksize);
-        if(!success)
-        {
-            return 0;
-        }
-        
-        size_t new_size = (size_t)dl_allocator->end_addr - (size_t)dl_allocator->start_addr;
-        
-        /* Find endmost header */
-        struct cpl_dlist* tmp = 0;
-        if(!cpl_dlist_empty(&(dl_allocator->head)))
+        /* the root's parent points to its bin, it never gets dereferenced */
+        dl_allocator->treemap |= dl_idx2bit(idx);
+        *root = chunk;
+        chunk->parent = (dl_tchunk *)root;
+        return ;
+    }
+    
+    dl_tchunk* t = *root;
+    size_t k = sz << dl_leftshift_for_tree_index(idx);
+    for(;;)
+    {
+        if(dl_size(t) != sz)
         {
-            struct cpl_dlist* iter;
-            cpl_dlist_foreach(iter, &(dl_allocator->head))
+            dl_tchunk** c = &(t->child[(k >> (DL_SIZE_T_BITSIZE - 1)) & 1]);
+            k <<= 1;
+            if(*c)
             {
-                if(iter > tmp)
-                {
-                    tmp = iter;
-                }
+                t = *c;
+            }
+            else
+            {
+                *c = chunk;
+                chunk->parent = t;
+                break;
             }
-        }
-        
-        dl_chunk* topchunk = cpl_dlist_entry(tmp, dl_chunk, list);
-        if(tmp && dl_chunk_plus_offset(topchunk, dl_size(topchunk)) == old_end_addr)
-        {
-            dl_remove_chunk(topchunk);
-            topchunk->head += new_size - old_size;
         }
         else
         {
-            topchunk = (dl_chunk *)old_end_addr;
-            topchunk->head = DL_PINUSE_BIT | (new_size - old_size);
+            /* same size: link into the ring of the existing node */
+            dl_tchunk* f = t->fd;
+            t->fd = f->bk = chunk;
+            chunk->fd = f;
+            chunk->bk = t;
+            chunk->parent = 0;
+            break;
         }
-        
-        dl_insert_chunk(dl_allocator, topchunk);
-        return cpl_dl_malloc(allocator, sz);
     }
-    assert( dl_size(hole) >= chunksize );
-    
-    dl_remove_chunk(hole);
+}
+
+static void dl_remove_large_chunk(struct cpl_dl_allocator* dl_allocator, dl_tchunk* chunk)
+{
+    dl_tchunk* xp = chunk->parent;
+    dl_tchunk* r;
     
-    size_t new_size = dl_size(hole) - chunksize;
-    if(new_size < DL_CHUNK_SIZE)
+    if(chunk->bk != chunk)
     {
-        chunksize = dl_size(hole);
-        dl_chunk* next_chunk = dl_chunk_plus_offset(hole, chunksize);
-        if(next_chunk != dl_allocator->end_addr)
-        {
-            next_chunk->head |= DL_PINUSE_BIT;
-        }
+        dl_tchunk* f = chunk->fd;
+        r = chunk->bk;
+        f->bk = r;
+        r->fd = f;
     }
     else
     {
-        dl_chunk* next_chunk = dl_chunk_plus_offset(hole, chunksize);
-        if(next_chunk != dl_allocator->end_addr)
+        /* replace the node with its rightmost leaf */
+        dl_tchunk** rp;
+        if(((r = *(rp = &(chunk->child[1]))) != 0) ||
+           ((r = *(rp = &(chunk->child[0]))) != 0))
         {
-            next_chunk->head = new_size | DL_PINUSE_BIT;
-            dl_insert_chunk(dl_allocator, next_chunk);
+            dl_tchunk** cp;
+            while((*(cp = &(r->child[1])) != 0) ||
+                  (*(cp = &(r->child[0])) != 0))
+            {
+                r = *(rp = cp);
+            }
+            *rp = 0;
         }
     }
     
-    hole->head = (hole->head & DL_PINUSE_BIT) | DL_CINUSE_BIT | chunksize;
-    
-    return chunk2ptr(hole);
-}
-
-static void cpl_dl_free(struct cpl_allocator* allocator, void* ptr)
-{
-    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
-    if(ptr)
+    if(xp)
     {
-        if(!ok_address(ptr, dl_allocator))
+        dl_tchunk** root = &(dl_allocator->treebins[chunk->index]);
+        if(chunk == *root)
         {
-            goto Lassert;
+            if((*root = r) == 0)
+            {
+                dl_allocator->treemap &= ~dl_idx2bit(chunk->index);
+            }
         }
-        
-        // Find corresponding chunk
-        dl_chunk *chunk = ptr2chunk(ptr);
-        
-        if((chunk->head & DL_INUSE_BITS) == DL_PINUSE_BIT)
+        else if(xp->child[0] == chunk)
         {
-            goto Lassert;
+            xp->child[0] = r;
         }
-        
-        size_t chunk_size = dl_size(chunk);
-        
-        // Check previous chunk. If inuse bit is not set,
-        // then we will unify both free chunks
-        if(!dl_pinuse(chunk))
+        else
         {
-            size_t left_size = chunk->prev_foot;
-            dl_chunk *left_chunk = dl_chunk_minus_offset(chunk, left_size);
-            
-            if(!ok_address(left_chunk, dl_allocator))
-            {
-                goto Lassert;
-            }
-            
-            chunk_size += left_size;
-            chunk = left_chunk;
-            
-            // Remove chunk from ordered list
-            dl_remove_chunk(chunk);
+            xp->child[1] = r;
         }
         
-        // Find addres of the next chunk
-        dl_chunk *right_chunk = dl_chunk_plus_offset(chunk, chunk_size);
-        if(ok_address(right_chunk, dl_allocator))
+        if(r)
         {
-            if(!dl_pinuse(right_chunk))
-            {
-                goto Lassert;
-            }
-            
-            // check whether right chunk is inuse
-            if(dl_cinuse(right_chunk))
+            dl_tchunk* c;
+            r->parent = xp;
+            if((c = chunk->child[0]) != 0)
             {
-                // Clear PINUSE
-                clear_pinuse(right_chunk);
+                r->child[0] = c;
+                c->parent = r;
             }
-            else
+            if((c = chunk->child[1]) != 0)
             {
-                size_t right_size = dl_size(right_chunk);
-                
-                assert((size_t)dl_chunk_plus_offset(right_chunk, right_size) <= (size_t)dl_allocator->end_addr);
-                
-                dl_remove_chunk(right_chunk);
-                chunk_size += right_size;
+                r->child[1] = c;
+                c->parent = r;
             }
         }
-        
-        if((right_chunk = dl_chunk_plus_offset(chunk, chunk_size)) != dl_allocator->end_addr)
-        {
-            right_chunk->prev_foot = chunk_size;
-        }
-        chunk->head = chunk_size | DL_PINUSE_BIT;
-        
-        dl_insert_chunk(dl_allocator, chunk);
     }
-    
-    return ;
-    
-Lassert:
-    assert(0);
 }
 
-static inline void* cpl_dl_dummy_realloc(struct cpl_allocator* allocator, void* ptr, size_t old_sz, size_t new_sz)
+static void dl_insert_chunk(struct cpl_dl_allocator* dl_allocator, dl_chunk* chunk, size_t sz)
 {
-    void* mem = cpl_dl_malloc(allocator, new_sz);
-    if(mem)
+    ++dl_allocator->nfreechunks;
+    if(dl_is_small(sz))
     {
-        memcpy(mem, ptr, old_sz);
+        dl_insert_small_chunk(dl_allocator, chunk, sz);
+    }
+    else
+    {
+        dl_insert_large_chunk(dl_allocator, (dl_tchunk *)chunk, sz);
     }
-    cpl_dl_free(allocator, ptr);
-    return mem;
 }
 
-static void* cpl_dl_realloc(struct cpl_allocator* allocator, void* ptr, size_t sz)
+static void dl_remove_chunk(struct cpl_dl_allocator* dl_allocator, dl_chunk* chunk, size_t sz)
 {
-    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
-    if(!ptr)
-    {
-        return cpl_dl_malloc(allocator, sz);
-    }
-    
-    if(!ok_address(ptr, dl_allocator))
+    --dl_allocator->nfreechunks;
+    if(dl_is_small(sz))
     {
-        goto Lassert;
+        dl_remove_small_chunk(dl_allocator, chunk, sz);
     }
-    
-    // Find corresponding chunk
-    dl_chunk *chunk = ptr2chunk(ptr);
-    
-    if((chunk->head & DL_INUSE_BITS) == DL_PINUSE_BIT)
+    else
     {
-        goto Lassert;
+        dl_remove_large_chunk(dl_allocator, (dl_tchunk *)chunk);
     }
+}
+
+/*
+ * Best fit among tree chunks of at least _sz_ bytes.
+ */
+static dl_tchunk* dl_find_tree_chunk(struct cpl_dl_allocator* dl_allocator, size_t sz)
+{
+    dl_tchunk* v = 0;
+    size_t rsize = (size_t)-1;
+    unsigned idx = dl_tree_index(sz);
+    dl_tchunk* t = dl_allocator->treebins[idx];
     
-    size_t curr_size = dl_size(chunk);
-    size_t new_size = request2size(sz);
-    
-    // Find address of next chunk
-    dl_chunk *right_chunk = dl_chunk_plus_offset(chunk, curr_size);
-    if(new_size <= curr_size) /* already big enough */
+    if(t && (dl_allocator->treemap & dl_idx2bit(idx)))
     {
-        size_t rsize = curr_size - new_size;
-        if(rsize < DL_CHUNK_SIZE)
+        /* traverse the tree for this bin looking for the node of size _sz_ */
+        size_t sizebits = sz << dl_leftshift_for_tree_index(idx);
+        dl_tchunk* rst = 0;  /* the deepest untaken right subtree */
+        for(;;)
         {
-            return ptr;
-        }
-        else
-        {
-            if(right_chunk != dl_allocator->end_addr)
+            size_t trem = dl_size(t) - sz;
+            if(dl_size(t) >= sz && trem < rsize)
             {
-                if(!dl_pinuse(right_chunk))
-                {
-                    goto Lassert;
-                }
-                
-                // check whether right chunk is inuse
-                if(dl_cinuse(right_chunk))
-                {
-                    // Clear PINUSE
-                    clear_pinuse(right_chunk);
-                }
-                else
+                v = t;
+                if((rsize = trem) == 0)
                 {
-                    size_t right_size = dl_size(right_chunk);
-                    dl_chunk* next_chunk = dl_chunk_plus_offset(right_chunk, right_size);
-                    
-                    assert((size_t)next_chunk <= (size_t)dl_allocator->end_addr);
-                    
-                    dl_remove_chunk(right_chunk);
-                    rsize += right_size;
-                    
-                    if(next_chunk != dl_allocator->end_addr)
-                    {
-                        next_chunk->prev_foot = rsize;
-                    }
+                    break;
                 }
             }
-            dl_chunk *top_chunk = dl_chunk_plus_offset(chunk, new_size);
-            top_chunk->head = rsize | DL_PINUSE_BIT;
-            dl_insert_chunk(dl_allocator, top_chunk);
-            
-            chunk->head = (chunk->head & DL_PINUSE_BIT) | DL_CINUSE_BIT | new_size;
-            return chunk2ptr(chunk);
-        }
-    }
-    else if(right_chunk == dl_allocator->end_addr) /* No blocks after chunk */
-    {
-        size_t rsize = new_size - curr_size;
-        size_t old_size = (size_t)dl_allocator->end_addr - (size_t)dl_allocator->start_addr;
-        int success = cpl_dl_expand(dl_allocator, old_size + rsize);
-        if(!success)
-        {
-            return 0;
+            dl_tchunk* rt = t->child[1];
+            t = t->child[(sizebits >> (DL_SIZE_T_BITSIZE - 1)) & 1];
+            if(rt && rt != t)
+            {
+                rst = rt;
+            }
+            if(!t)
+            {
+                t = rst;
+                break;
+            }
+            sizebits <<= 1;
         }
-        
-        size_t top_size = (size_t)dl_allocator->end_addr - (size_t)dl_allocator->start_addr - old_size - rsize;
-        
-        dl_chunk* top_chunk = dl_chunk_plus_offset(chunk, new_size);
-        top_chunk->head = top_size | DL_PINUSE_BIT;
-        dl_insert_chunk(dl_allocator, top_chunk);
-        
-        chunk->head = (chunk->head & DL_PINUSE_BIT) | DL_CINUSE_BIT | new_size;
-        return chunk2ptr(chunk);
     }
-    else if(dl_cinuse(right_chunk))
+    else
     {
-        return cpl_dl_dummy_realloc(allocator, ptr, curr_size - DL_CHUNK_OVERHEAD, sz);
+        t = 0;
     }
-    else
+    
+    if(!t && !v)
     {
-        assert(!dl_cinuse(right_chunk));
-        
-        if(!dl_pinuse(right_chunk))
+        /* use the smallest tree of the next non-empty bin */
+        uint32_t leftbits = dl_left_bits(dl_idx2bit(idx)) & dl_allocator->treemap;
+        if(leftbits)
         {
-            goto Lassert;
+            t = dl_allocator->treebins[dl_bit2idx(dl_least_bit(leftbits))];
         }
-        
-        size_t right_size = dl_size(right_chunk);
-        size_t rsize = new_size - curr_size;
-        dl_chunk* top_chunk = dl_chunk_plus_offset(right_chunk, right_size);
-        if(right_size < rsize)
+    }
+    
+    /* find the smallest of the tree or subtree */
+    while(t)
+    {
+        size_t trem = dl_size(t) - sz;
+        if(dl_size(t) >= sz && trem < rsize)
         {
-            if(top_chunk != dl_allocator->end_addr)
-            {
-                assert(dl_cinuse(top_chunk));
-                return cpl_dl_dummy_realloc(allocator, ptr, curr_size - DL_CHUNK_OVERHEAD, sz);
-            }
-            else
-            {
-                dl_remove_chunk(right_chunk);
-                chunk->head += right_size;
-                return cpl_dl_realloc(allocator, ptr, sz);
-            }
+            rsize = trem;
+            v = t;
         }
-        else if(right_size > rsize + DL_CHUNK_SIZE)
+        t = dl_leftmost_child(t);
+    }
+    
+    return v;
+}
+
+/*
+ * Finds the best fitting free chunk of at least _sz_ bytes and unlinks it.
+ */
+static dl_chunk* dl_take_chunk(struct cpl_dl_allocator* dl_allocator, size_t sz)
+{
+    if(dl_is_small(sz))
+    {
+        unsigned idx = dl_small_index(sz);
+        uint32_t smallbits = dl_allocator->smallmap >> idx;
+        if(smallbits)
         {
-            dl_chunk* next_chunk = dl_chunk_plus_offset(right_chunk, rsize);
-            dl_remove_chunk(right_chunk);
-            next_chunk->head = (right_size - rsize) | DL_PINUSE_BIT;
-            dl_insert_chunk(dl_allocator, next_chunk);
-            
-            if(top_chunk != dl_allocator->end_addr)
-            {
-                top_chunk->prev_foot = (right_size - rsize);
-            }
-            
-            chunk->head = (chunk->head & DL_PINUSE_BIT) | DL_CINUSE_BIT | new_size;
-            return chunk2ptr(chunk);
+            idx += dl_bit2idx(dl_least_bit(smallbits));
+            dl_chunk* chunk = cpl_dlist_entry(dl_allocator->smallbins[idx].next, dl_chunk, list);
+            dl_remove_chunk(dl_allocator, chunk, dl_size(chunk));
+            return chunk;
         }
-        else
+    }
+    
+    if(dl_allocator->treemap)
+    {
+        dl_tchunk* chunk = dl_find_tree_chunk(dl_allocator, sz);
+        if(chunk)
         {
-            dl_remove_chunk(right_chunk);
-            
-            if(top_chunk != dl_allocator->end_addr)
-            {
-                top_chunk->head |= DL_PINUSE_BIT;
-            }
-            
-            chunk->head = (chunk->head & DL_PINUSE_BIT) | DL_CINUSE_BIT | new_size;
-            return chunk2ptr(chunk);
+            dl_remove_chunk(dl_allocator, (dl_chunk *)chunk, dl_size(chunk));
+            return (dl_chunk *)chunk;
         }
     }
     
-Lassert:
-    assert(0);
     return 0;
 }
 
-static void cpl_dl_allocator_init(struct cpl_dl_allocator* dl_allocator, char* addr, size_t max_size)
+/*
+ * Grows the heap until the top chunk can serve _sz_ bytes and still keep
+ * a header of its own.
+ */
+static int cpl_dl_expand(struct cpl_dl_allocator* dl_allocator, size_t sz)
 {
-    /* assign corresponding routines */
-    dl_allocator->xAllocate = cpl_dl_malloc;
-    dl_allocator->xFree = cpl_dl_free;
-    dl_allocator->xRealloc = cpl_dl_realloc;
-    
-    /* calculate initial size of the heap */
-    size_t init_size = (max_size >= 0x10000)?0x10000:max_size;
-    
-    /* setup allocator */
-    size_t off = (sizeof(struct cpl_dl_allocator) - sizeof(size_t) + DL_FLAGS_MASK) & ~(DL_FLAGS_MASK);
-    dl_allocator->start_addr = addr + off;
-    dl_allocator->end_addr = addr + init_size;
-    dl_allocator->max_addr = addr + max_size;
-    
-    /* setup initial chunk */
-    init_size -= off;
-    dl_chunk* chunk = (dl_chunk*)dl_allocator->start_addr;
-    chunk->head = init_size | DL_PINUSE_BIT;
+    if(dl_allocator->topsize >= sz + DL_CHUNK_SIZE)
+    {
+        return 1;
+    }
     
-    /* setup linked list of chunks */
-    dl_allocator->head.prev = dl_allocator->head.next = (struct cpl_dlist *)&(chunk->list);
-    chunk->list.prev = chunk->list.next = &(dl_allocator->head);
-}
-
-/********************* Public DL Allocator routines  **************************/
-cpl_allocator_ref cpl_allocator_create_dl(size_t max_size)
-{
-    /* align to page size */
-    if(max_size & 0xFFF)
+    size_t new_end = (size_t)dl_allocator->top + sz + DL_CHUNK_SIZE;
+    if(new_end < sz)
     {
-        max_size &= 0x1000;
-        max_size += 0x1000;
+        return 0;
     }
     
-    /* reserve pages */
-    char* addr = mmap(0, max_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if(addr == MAP_FAILED)
+    new_end = dl_page_align(new_end);
+    if(new_end > (size_t)dl_allocator->max_addr)
     {
-        /* failed to map */
         return 0;
     }
     
-    /* place allocator struct right after the heap and setup fields */
-    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)addr;
-    cpl_dl_allocator_init(dl_allocator, addr, max_size);
+    dl_allocator->end_addr = (void *)new_end;
+    dl_allocator->topsize = new_end - (size_t)dl_allocator->top;
+    dl_allocator->top->head = dl_allocator->topsize | dl_pinuse(dl_allocator->top);
     
-    return (cpl_allocator_ref)dl_allocator;
+    return 1;
 }
 
-void cpl_allocator_destroy_dl(cpl_allocator_ref allocator)
+/*
+ * Carves _sz_ bytes from the top chunk. The top must be big enough already.
+ */
+static dl_chunk* dl_take_top(struct cpl_dl_allocator* dl_allocator, size_t sz)
+{
+    assert(dl_allocator->topsize >= sz + DL_CHUNK_SIZE);
+    
+    dl_chunk* chunk = dl_allocator->top;
+    set_inuse(chunk, sz);
+    
+    dl_allocator->top = dl_chunk_plus_offset(chunk, sz);
+    dl_allocator->topsize -= sz;
+    dl_allocator->top->head = dl_allocator->topsize | DL_PINUSE_BIT;
+    
+    return chunk;
+}
+
+/*
+ * Gives pages in the body of a free chunk back to the OS. Its header and the
+ * footer, which belongs to the next chunk, stay in place. Returns bytes released.
+ */
+static size_t dl_release_pages(dl_chunk* chunk, size_t sz)
+{
+    size_t start = dl_page_align((size_t)chunk + sizeof(dl_tchunk));
+    size_t end = dl_page_floor((size_t)chunk + sz);
+    if(start >= end)
+    {
+        return 0;
+    }
+    
+    int rc = madvise((void *)start, end - start, DL_MADV_RELEASE);
+    assert(rc == 0);
+    return end - start;
+}
+
+/*
+ * Moves the end of the heap down, so that the top chunk keeps _pad_ bytes.
+ * Returns bytes released.
+ */
+static size_t dl_trim_top(struct cpl_dl_allocator* dl_allocator, size_t pad)
+{
+    size_t end = (size_t)dl_allocator->end_addr;
+    size_t keep = (dl_allocator->topsize - DL_CHUNK_SIZE > pad)?pad:dl_allocator->topsize - DL_CHUNK_SIZE;
+    size_t new_end = dl_page_align((size_t)dl_allocator->top + DL_CHUNK_SIZE + keep);
+    if(new_end >= end)
+    {
+        return 0;
+    }
+    
+    int rc = madvise((void *)new_end, end - new_end, DL_MADV_RELEASE);
+    assert(rc == 0);
+    
+    dl_allocator->end_addr = (void *)new_end;
+    dl_allocator->topsize = new_end - (size_t)dl_allocator->top;
+    dl_allocator->top->head = dl_allocator->topsize | dl_pinuse(dl_allocator->top);
+    return end - new_end;
+}
+
+static size_t dl_release_tree(dl_tchunk* t)
+{
+    size_t released = 0;
+    if(t)
+    {
+        dl_tchunk* c = t;
+        do
+        {
+            released += dl_release_pages((dl_chunk *)c, dl_size(c));
+            c = c->fd;
+        } while(c != t);
+        
+        released += dl_release_tree(t->child[0]);
+        released += dl_release_tree(t->child[1]);
+    }
+    return released;
+}
+
+/*
+ * Releases pages of all free chunks. Small chunks never span a page, only
+ * tree chunks are visited.
+ */
+static size_t dl_release_free(struct cpl_dl_allocator* dl_allocator)
+{
+    size_t released = 0;
+    for(unsigned i = 0; i < DL_NTREEBINS; ++i)
+    {
+        if(dl_allocator->treemap & dl_idx2bit(i))
+        {
+            released += dl_release_tree(dl_allocator->treebins[i]);
+        }
+    }
+    dl_allocator->release_pending = 0;
+    return released;
+}
+
+/*
+ * Trims the top chunk down to _pad_ bytes and releases pages of all free
+ * chunks.
+ */
+static size_t dl_trim(struct cpl_dl_allocator* dl_allocator, size_t pad)
+{
+    if(dl_keeps_pages(dl_allocator))
+    {
+        return 0;
+    }
+    return dl_trim_top(dl_allocator, pad) + dl_release_free(dl_allocator);
+}
+
+/*
+ * Returns an in-use chunk into the heap, coalescing it with free neighbours.
+ * A large top chunk is trimmed. Pages of free chunks are released once large
+ * chunks of DL_RELEASE_BUDGET bytes in total have been freed, so that a chunk
+ * reused right away does not fault its pages in again every time.
+ */
+static void dl_release_chunk(struct cpl_dl_allocator* dl_allocator, dl_chunk* chunk)
+{
+    size_t chunk_size = dl_size(chunk);
+    
+    // Check previous chunk. If inuse bit is not set,
+    // then we will unify both free chunks
+    if(!dl_pinuse(chunk))
+    {
+        size_t left_size = chunk->prev_foot;
+        dl_chunk *left_chunk = dl_chunk_minus_offset(chunk, left_size);
+        assert(ok_address(left_chunk, dl_allocator));
+        
+        dl_remove_chunk(dl_allocator, left_chunk, left_size);
+        chunk_size += left_size;
+        chunk = left_chunk;
+    }
+    
+    dl_chunk *right_chunk = dl_chunk_plus_offset(chunk, chunk_size);
+    assert(dl_pinuse(right_chunk) && ok_address(right_chunk, dl_allocator));
+    
+    if(right_chunk == dl_allocator->top)
+    {
+        // Merge into the top chunk
+        dl_allocator->top = chunk;
+        dl_allocator->topsize += chunk_size;
+        chunk->head = dl_allocator->topsize | DL_PINUSE_BIT;
+        if(dl_allocator->topsize > DL_TRIM_THRESHOLD && !dl_keeps_pages(dl_allocator))
+        {
+            dl_trim_top(dl_allocator, DL_TOP_PAD);
+        }
+        return ;
+    }
+    
+    if(dl_cinuse(right_chunk))
+    {
+        clear_pinuse(right_chunk);
+    }
+    else
+    {
+        size_t right_size = dl_size(right_chunk);
+        dl_remove_chunk(dl_allocator, right_chunk, right_size);
+        chunk_size += right_size;
+        right_chunk = dl_chunk_plus_offset(chunk, chunk_size);
+    }
+    
+    right_chunk->prev_foot = chunk_size;
+    chunk->head = chunk_size | DL_PINUSE_BIT;
+    
+    dl_insert_chunk(dl_allocator, chunk, chunk_size);
+    if(chunk_size >= DL_RELEASE_THRESHOLD && !dl_keeps_pages(dl_allocator))
+    {
+        dl_allocator->release_pending += chunk_size;
+        if(dl_allocator->release_pending >= DL_RELEASE_BUDGET)
+        {
+            dl_release_free(dl_allocator);
+        }
+    }
+}
+
+/*
+ * Trims an in-use chunk down to _sz_ bytes, releasing the tail if it is big
+ * enough to become a chunk of its own.
+ */
+static void dl_shrink_chunk(struct cpl_dl_allocator* dl_allocator, dl_chunk* chunk, size_t sz)
+{
+    size_t rsize = dl_size(chunk) - sz;
+    if(rsize >= DL_CHUNK_SIZE)
+    {
+        set_inuse(chunk, sz);
+        dl_chunk* rem = dl_chunk_plus_offset(chunk, sz);
+        rem->head = rsize | DL_INUSE_BITS;
+        dl_release_chunk(dl_allocator, rem);
+    }
+}
+
+/*
+ * Maps a chunk of its own for a request of _sz_ bytes aligned to _align_.
+ */
+static dl_chunk* dl_mmap_chunk(struct cpl_dl_allocator* dl_allocator, size_t sz, size_t align)
+{
+    size_t max_lead = (align > DL_MMAP_ALIGNMENT)?align - DL_MMAP_ALIGNMENT:0;
+    size_t map_size = dl_page_align(sz + DL_MMAP_OVERHEAD + max_lead);
+    if(map_size < sz)
+    {
+        return 0;
+    }
+    
+    /* huge pages from the reserved pool cannot be remapped */
+    char* base = cpl_allocator_map(&map_size, dl_allocator->map_flags & ~CPL_ALLOCATOR_MAP_HUGETLB);
+    if(base == MAP_FAILED)
+    {
+        return 0;
+    }
+    
+    size_t lead = (align > DL_MMAP_ALIGNMENT)?(-((size_t)base + DL_MMAP_OVERHEAD) & (align - 1)):0;
+    struct dl_mmap_header* header = (struct dl_mmap_header *)(base + lead);
+    header->owner = dl_allocator;
+    header->size = map_size;
+    header->lead = lead;
+    cpl_dlist_add_tail(&header->link, &dl_allocator->mmapped);
+    
+    dl_chunk* chunk = (dl_chunk *)((char *)header + DL_MMAP_OFFSET);
+    chunk->prev_foot = 0;
+    chunk->head = (map_size - lead - DL_MMAP_OFFSET) | DL_MMAPPED_BIT | DL_INUSE_BITS;
+    dl_allocator->counters.mapped += map_size;
+    return chunk;
+}
+
+static void dl_munmap_chunk(struct cpl_dl_allocator* dl_allocator, dl_chunk* chunk)
+{
+    struct dl_mmap_header* header = dl_mmap_header(chunk);
+    cpl_dlist_del(&header->link);
+    dl_allocator->counters.mapped -= header->size;
+    
+    int rc = munmap(dl_mmap_base(header), header->size);
+    assert(rc == 0);
+}
+
+/*
+ * Resizes the mapping of a chunk to fit _sz_ bytes. Linux moves the pages
+ * with mremap(); elsewhere the mapping is extended in place when the address
+ * space after it is free and copied otherwise. Either way the chunk keeps its
+ * offset in a page, but not a greater alignment. Unless _may_move_ is set the
+ * mapping only grows in place.
+ */
+static dl_chunk* dl_remap_chunk(struct cpl_dl_allocator* dl_allocator, dl_chunk* chunk, size_t sz, int may_move)
+{
+    struct dl_mmap_header* header = dl_mmap_header(chunk);
+    char* base = dl_mmap_base(header);
+    size_t lead = header->lead;
+    size_t old_size = header->size;
+    size_t new_size = dl_page_align(sz + DL_MMAP_OVERHEAD + lead);
+    if(new_size < sz)
+    {
+        return 0;
+    }
+    if(new_size == old_size)
+    {
+        return chunk;
+    }
+    
+    /* the list is relinked, since the header may move */
+    cpl_dlist_del(&header->link);
+#if defined(MREMAP_MAYMOVE)
+    char* moved = mremap(base, old_size, new_size, may_move ? MREMAP_MAYMOVE : 0);
+    if(moved == MAP_FAILED)
+    {
+        cpl_dlist_add_tail(&header->link, &dl_allocator->mmapped);
+        return 0;
+    }
+    base = moved;
+#else
+    if(new_size < old_size)
+    {
+        int rc = munmap(base + new_size, old_size - new_size);
+        assert(rc == 0);
+    }
+    else
+    {
+        char* tail = base + old_size;
+        char* addr = mmap(tail, new_size - old_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(addr != tail)
+        {
+            if(addr != MAP_FAILED)
+            {
+                munmap(addr, new_size - old_size);
+            }
+            if(!may_move)
+            {
+                cpl_dlist_add_tail(&header->link, &dl_allocator->mmapped);
+                return 0;
+            }
+            
+            char* moved = mmap(0, new_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(moved == MAP_FAILED)
+            {
+                cpl_dlist_add_tail(&header->link, &dl_allocator->mmapped);
+                return 0;
+            }
+            memcpy(moved, base, old_size);
+            munmap(base, old_size);
+            base = moved;
+        }
+    }
+#endif
+    
+    header = (struct dl_mmap_header *)(base + lead);
+    header->size = new_size;
+    cpl_dlist_add_tail(&header->link, &dl_allocator->mmapped);
+    dl_allocator->counters.mapped += new_size - old_size;
+    
+    chunk = (dl_chunk *)((char *)header + DL_MMAP_OFFSET);
+    chunk->head = (new_size - lead - DL_MMAP_OFFSET) | DL_MMAPPED_BIT | DL_INUSE_BITS;
+    return chunk;
+}
+
+static void dl_munmap_all(struct cpl_dl_allocator* dl_allocator)
+{
+    while(!cpl_dlist_empty(&dl_allocator->mmapped))
+    {
+        struct dl_mmap_header* header = cpl_dlist_entry(dl_allocator->mmapped.next, struct dl_mmap_header, link);
+        dl_munmap_chunk(dl_allocator, (dl_chunk *)((char *)header + DL_MMAP_OFFSET));
+    }
+}
+
+/*
+ * Cuts a chunk of _chunksize_ bytes from the bins or the top of the heap.
+ */
+static dl_chunk* dl_heap_malloc(struct cpl_dl_allocator* dl_allocator, size_t chunksize)
+{
+    dl_chunk *hole = dl_take_chunk(dl_allocator, chunksize);
+    if(!hole)
+    {
+        /* if we didn't find suitable hole, cut it from the top */
+        if(!cpl_dl_expand(dl_allocator, chunksize))
+        {
+            return 0;
+        }
+        
+        return dl_take_top(dl_allocator, chunksize);
+    }
+    assert( dl_size(hole) >= chunksize );
+    
+    size_t hole_size = dl_size(hole);
+    hole->head = hole_size | DL_PINUSE_BIT | DL_CINUSE_BIT;
+    set_pinuse(dl_chunk_plus_offset(hole, hole_size));
+    dl_shrink_chunk(dl_allocator, hole, chunksize);
+    return hole;
+}
+
+/*
+ * Resizes an in-use heap chunk to _new_size_ bytes where it is, taking space
+ * from the top or a free right neighbour. Returns 0 if the chunk cannot grow.
+ */
+static int dl_resize_chunk(struct cpl_dl_allocator* dl_allocator, dl_chunk* chunk, size_t new_size)
+{
+    size_t curr_size = dl_size(chunk);
+    if(new_size <= curr_size) /* already big enough */
+    {
+        dl_shrink_chunk(dl_allocator, chunk, new_size);
+        cpl_counters_resize(&dl_allocator->counters, curr_size, dl_size(chunk));
+        return 1;
+    }
+    
+    // Find address of next chunk
+    dl_chunk *right_chunk = dl_chunk_plus_offset(chunk, curr_size);
+    if(right_chunk == dl_allocator->top) /* No blocks after chunk */
+    {
+        if(!cpl_dl_expand(dl_allocator, new_size - curr_size))
+        {
+            return 0;
+        }
+        
+        dl_take_top(dl_allocator, new_size - curr_size);
+        set_inuse(chunk, new_size);
+    }
+    else if(!dl_cinuse(right_chunk) && curr_size + dl_size(right_chunk) >= new_size)
+    {
+        size_t right_size = dl_size(right_chunk);
+        dl_remove_chunk(dl_allocator, right_chunk, right_size);
+        
+        set_inuse(chunk, curr_size + right_size);
+        set_pinuse(dl_chunk_plus_offset(chunk, curr_size + right_size));
+        dl_shrink_chunk(dl_allocator, chunk, new_size);
+    }
+    else
+    {
+        return 0;
+    }
+    
+    cpl_counters_resize(&dl_allocator->counters, curr_size, dl_size(chunk));
+    return 1;
+}
+
+static void* cpl_dl_malloc(struct cpl_allocator* allocator, size_t sz)
+{
+    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+    
+    size_t chunksize = request2size(sz);
+    if(chunksize < sz)
+    {
+        return 0;
+    }
+    
+    dl_chunk* chunk = 0;
+    if(chunksize >= dl_allocator->mmap_threshold)
+    {
+        /* falls back to the heap when mapping fails */
+        chunk = dl_mmap_chunk(dl_allocator, sz, DL_MIN_ALIGNMENT);
+    }
+    if(!chunk && !(chunk = dl_heap_malloc(dl_allocator, chunksize)))
+    {
+        return 0;
+    }
+    
+    cpl_counters_alloc(&dl_allocator->counters, sz, dl_size(chunk));
+    return chunk2ptr(chunk);
+}
+
+/*
+ * Cuts a chunk with room for an _align_ boundary plus a minimal chunk before
+ * it, and gives the space around the aligned part back to the heap.
+ */
+static void* cpl_dl_malloc_aligned(struct cpl_allocator* allocator, size_t sz, size_t align)
+{
+    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+    if(align <= DL_MIN_ALIGNMENT)
+    {
+        return cpl_dl_malloc(allocator, sz);
+    }
+    
+    size_t chunksize = request2size(sz);
+    if(chunksize < sz)
+    {
+        return 0;
+    }
+    
+    dl_chunk* chunk = 0;
+    if(chunksize >= dl_allocator->mmap_threshold)
+    {
+        chunk = dl_mmap_chunk(dl_allocator, sz, align);
+    }
+    if(!chunk)
+    {
+        align = (align < DL_CHUNK_SIZE)?DL_CHUNK_SIZE:align;
+        size_t padded = chunksize + align + DL_CHUNK_SIZE;
+        if(padded < chunksize || !(chunk = dl_heap_malloc(dl_allocator, padded)))
+        {
+            return 0;
+        }
+        
+        char* mem = chunk2ptr(chunk);
+        if(!dl_is_aligned(mem, align))
+        {
+            /* the leading gap becomes a free chunk, so it is one at least */
+            char* br = (char *)ptr2chunk(((size_t)mem + align - 1) & ~(align - 1));
+            char* pos = ((size_t)(br - (char *)chunk) >= DL_CHUNK_SIZE)?br:br + align;
+            size_t lead = pos - (char *)chunk;
+            
+            dl_chunk* aligned = (dl_chunk *)pos;
+            aligned->head = (dl_size(chunk) - lead) | DL_INUSE_BITS;
+            chunk->head = lead | dl_pinuse(chunk) | DL_CINUSE_BIT;
+            dl_release_chunk(dl_allocator, chunk);
+            chunk = aligned;
+        }
+        dl_shrink_chunk(dl_allocator, chunk, chunksize);
+    }
+    
+    cpl_counters_alloc(&dl_allocator->counters, sz, dl_size(chunk));
+    return chunk2ptr(chunk);
+}
+
+static void cpl_dl_free(struct cpl_allocator* allocator, void* ptr)
+{
+    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+    if(ptr)
+    {
+        // Find corresponding chunk
+        dl_chunk *chunk = ptr2chunk(ptr);
+        
+        if(!ok_address(ptr, dl_allocator))
+        {
+            if(!dl_is_mmapped(chunk) || dl_mmap_header(chunk)->owner != dl_allocator)
+            {
+                goto Lassert;
+            }
+            
+            cpl_counters_free(&dl_allocator->counters, dl_size(chunk));
+            dl_munmap_chunk(dl_allocator, chunk);
+            return ;
+        }
+        
+        if(!dl_cinuse(chunk))
+        {
+            goto Lassert;
+        }
+        
+        cpl_counters_free(&dl_allocator->counters, dl_size(chunk));
+        dl_release_chunk(dl_allocator, chunk);
+    }
+    
+    return ;
+    
+Lassert:
+    assert(0);
+}
+
+/*
+ * Cuts one hole for all chunks and carves it up, the last chunk takes what
+ * the hole has over. Chunks that do not fit in a single hole are allocated
+ * one by one.
+ */
+static size_t cpl_dl_malloc_batch(struct cpl_allocator* allocator, size_t sz, size_t n, void** ptrs)
+{
+    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+    
+    size_t chunksize = request2size(sz);
+    dl_chunk* hole = 0;
+    if(n > 1 && chunksize >= sz && chunksize < dl_allocator->mmap_threshold && n <= (size_t)-1 / chunksize)
+    {
+        hole = dl_heap_malloc(dl_allocator, chunksize * n);
+    }
+    
+    size_t count = 0;
+    if(!hole)
+    {
+        while(count < n && (ptrs[count] = cpl_dl_malloc(allocator, sz)))
+        {
+            ++count;
+        }
+        return count;
+    }
+    
+    size_t hole_size = dl_size(hole);
+    size_t pinuse = dl_pinuse(hole);
+    for(dl_chunk* chunk = hole; count < n; ++count)
+    {
+        size_t size = (count + 1 < n)?chunksize:hole_size - chunksize * count;
+        chunk->head = size | pinuse | DL_CINUSE_BIT;
+        pinuse = DL_PINUSE_BIT;
+        ptrs[count] = chunk2ptr(chunk);
+        chunk = dl_chunk_plus_offset(chunk, size);
+    }
+    
+    cpl_counters_alloc_n(&dl_allocator->counters, sz, hole_size, n);
+    return n;
+}
+
+/*
+ * Chunks adjacent in both the heap and _ptrs_, as a batch allocation leaves
+ * them, are merged and go back to the bins as one.
+ */
+static void cpl_dl_free_batch(struct cpl_allocator* allocator, void** ptrs, size_t n)
+{
+    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+    
+    dl_chunk* run = 0;
+    size_t run_size = 0, freed = 0, count = 0;
+    for(size_t i = 0; i <= n; ++i)
+    {
+        dl_chunk* chunk = (i < n && ptrs[i]) ? ptr2chunk(ptrs[i]) : 0;
+        if(chunk && run && chunk == dl_chunk_plus_offset(run, run_size))
+        {
+            assert(dl_cinuse(chunk));
+            run_size += dl_size(chunk);
+            ++count;
+            continue;
+        }
+        
+        if(run)
+        {
+            run->head = run_size | dl_pinuse(run) | DL_CINUSE_BIT;
+            dl_release_chunk(dl_allocator, run);
+            freed += run_size;
+            run = 0;
+        }
+        
+        if(!chunk)
+        {
+            continue;
+        }
+        if(!ok_address(ptrs[i], dl_allocator))
+        {
+            cpl_dl_free(allocator, ptrs[i]);
+            continue;
+        }
+        
+        assert(dl_cinuse(chunk));
+        run = chunk;
+        run_size = dl_size(chunk);
+        ++count;
+    }
+    
+    cpl_counters_free_n(&dl_allocator->counters, freed, count);
+}
+
+static inline void* cpl_dl_dummy_realloc(struct cpl_allocator* allocator, void* ptr, size_t old_sz, size_t new_sz)
+{
+    void* mem = cpl_dl_malloc(allocator, new_sz);
+    if(mem)
+    {
+        memcpy(mem, ptr, old_sz);
+        cpl_dl_free(allocator, ptr);
+    }
+    return mem;
+}
+
+static void* cpl_dl_realloc(struct cpl_allocator* allocator, void* ptr, size_t sz)
+{
+    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+    if(!ptr)
+    {
+        return cpl_dl_malloc(allocator, sz);
+    }
+    
+    // Find corresponding chunk
+    dl_chunk *chunk = ptr2chunk(ptr);
+    
+    size_t curr_size = dl_size(chunk);
+    size_t new_size = request2size(sz);
+    if(new_size < sz)
+    {
+        return 0;
+    }
+    
+    if(!ok_address(ptr, dl_allocator))
+    {
+        if(!dl_is_mmapped(chunk) || dl_mmap_header(chunk)->owner != dl_allocator)
+        {
+            goto Lassert;
+        }
+        
+        if(new_size >= dl_allocator->mmap_threshold)
+        {
+            chunk = dl_remap_chunk(dl_allocator, chunk, sz, 1);
+            if(!chunk)
+            {
+                return 0;
+            }
+            cpl_counters_resize(&dl_allocator->counters, curr_size, dl_size(chunk));
+            return chunk2ptr(chunk);
+        }
+        /* shrunk below the threshold, move it into the heap */
+    }
+    else if(!dl_cinuse(chunk))
+    {
+        goto Lassert;
+    }
+    else if(new_size < dl_allocator->mmap_threshold && dl_resize_chunk(dl_allocator, chunk, new_size))
+    {
+        return ptr;
+    }
+    
+    /* a heap chunk growing past the threshold moves into a mapping of its own
+     * once, later growth is remapped */
+    size_t old_sz = dl_usable_size(chunk);
+    return cpl_dl_dummy_realloc(allocator, ptr, (old_sz < sz)?old_sz:sz, sz);
+    
+Lassert:
+    assert(0);
+    return 0;
+}
+
+static void* cpl_dl_realloc_aligned(struct cpl_allocator* allocator, void* ptr, size_t sz, size_t align)
+{
+    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+    if(align <= DL_MIN_ALIGNMENT)
+    {
+        return cpl_dl_realloc(allocator, ptr, sz);
+    }
+    if(!ptr)
+    {
+        return cpl_dl_malloc_aligned(allocator, sz, align);
+    }
+    
+    dl_chunk *chunk = ptr2chunk(ptr);
+    size_t new_size = request2size(sz);
+    if(new_size < sz)
+    {
+        return 0;
+    }
+    
+    if(dl_is_aligned(ptr, align))
+    {
+        if(ok_address(ptr, dl_allocator))
+        {
+            assert(dl_cinuse(chunk));
+            if(new_size < dl_allocator->mmap_threshold && dl_resize_chunk(dl_allocator, chunk, new_size))
+            {
+                return ptr;
+            }
+        }
+        else if(new_size >= dl_allocator->mmap_threshold && align <= DL_PAGE_SIZE)
+        {
+            /* remapping keeps the offset in a page */
+            return cpl_dl_realloc(allocator, ptr, sz);
+        }
+    }
+    
+    void* mem = cpl_dl_malloc_aligned(allocator, sz, align);
+    if(mem)
+    {
+        size_t old_sz = dl_usable_size(chunk);
+        memcpy(mem, ptr, (old_sz < sz)?old_sz:sz);
+        cpl_dl_free(allocator, ptr);
+    }
+    return mem;
+}
+
+static size_t cpl_dl_usable_size(struct cpl_allocator* allocator, void* ptr)
+{
+    return dl_usable_size(ptr2chunk(ptr));
+}
+
+static int cpl_dl_try_expand(struct cpl_allocator* allocator, void* ptr, size_t sz)
+{
+    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+    dl_chunk *chunk = ptr2chunk(ptr);
+    
+    size_t curr_size = dl_size(chunk);
+    size_t new_size = request2size(sz);
+    if(sz <= dl_usable_size(chunk))
+    {
+        return _CPL_OK;
+    }
+    if(new_size < sz)
+    {
+        return _CPL_NOMEM;
+    }
+    
+    if(ok_address(ptr, dl_allocator))
+    {
+        assert(dl_cinuse(chunk));
+        return dl_resize_chunk(dl_allocator, chunk, new_size)?_CPL_OK:_CPL_NOMEM;
+    }
+    
+    assert(dl_is_mmapped(chunk) && dl_mmap_header(chunk)->owner == dl_allocator);
+    if(!dl_remap_chunk(dl_allocator, chunk, sz, 0))
+    {
+        return _CPL_NOMEM;
+    }
+    cpl_counters_resize(&dl_allocator->counters, curr_size, dl_size(chunk));
+    return _CPL_OK;
+}
+
+/*
+ * Size of the biggest free chunk: the rightmost node of the highest tree,
+ * the highest small bin or the top chunk.
+ */
+static size_t dl_largest_free(struct cpl_dl_allocator* dl_allocator)
+{
+    size_t largest = dl_allocator->topsize;
+    size_t sz = 0;
+    
+    if(dl_allocator->treemap)
+    {
+        unsigned idx = 31 - __builtin_clz(dl_allocator->treemap);
+        for(dl_tchunk* t = dl_allocator->treebins[idx]; t; )
+        {
+            if(dl_size(t) > sz)
+            {
+                sz = dl_size(t);
+            }
+            t = t->child[1]?t->child[1]:t->child[0];
+        }
+    }
+    else if(dl_allocator->smallmap)
+    {
+        unsigned idx = 31 - __builtin_clz(dl_allocator->smallmap);
+        sz = (size_t)idx << DL_SMALLBIN_SHIFT;
+    }
+    
+    return (sz > largest)?sz:largest;
+}
+
+static size_t cpl_dl_trim(struct cpl_allocator* allocator, size_t pad)
+{
+    return dl_trim((struct cpl_dl_allocator *)allocator, pad);
+}
+
+static void cpl_dl_stats(struct cpl_allocator* allocator, cpl_allocator_stats_t* stats)
+{
+    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+    cpl_counters_collect(&dl_allocator->counters, stats);
+    stats->mapped_bytes += (size_t)dl_allocator->end_addr - (size_t)dl_allocator;
+    stats->free_chunks += dl_allocator->nfreechunks + 1;
+    
+    size_t largest = dl_largest_free(dl_allocator);
+    if(largest > stats->largest_free)
+    {
+        stats->largest_free = largest;
+    }
+}
+
+static void cpl_dl_assign_routines(struct cpl_dl_allocator* dl_allocator)
+{
+    dl_allocator->xAllocate = cpl_dl_malloc;
+    dl_allocator->xFree = cpl_dl_free;
+    dl_allocator->xRealloc = cpl_dl_realloc;
+    dl_allocator->xStats = cpl_dl_stats;
+    dl_allocator->xTrim = cpl_dl_trim;
+    dl_allocator->xAllocateAligned = cpl_dl_malloc_aligned;
+    dl_allocator->xReallocAligned = cpl_dl_realloc_aligned;
+    dl_allocator->xUsableSize = cpl_dl_usable_size;
+    dl_allocator->xTryExpand = cpl_dl_try_expand;
+    dl_allocator->xAllocateBatch = cpl_dl_malloc_batch;
+    dl_allocator->xFreeBatch = cpl_dl_free_batch;
+}
+
+/*
+ * Sets up an empty heap of _max_size_ bytes at _addr_. The first _header_size_
+ * bytes hold the allocator struct, or a larger struct starting with it.
+ */
+static void cpl_dl_allocator_init(struct cpl_dl_allocator* dl_allocator, char* addr, size_t header_size, size_t max_size)
+{
+    /* assign corresponding routines */
+    cpl_dl_assign_routines(dl_allocator);
+    
+    /* calculate initial size of the heap */
+    size_t init_size = (max_size >= 0x10000)?0x10000:max_size;
+    
+    /* setup allocator */
+    size_t off = (header_size - sizeof(size_t) + DL_FLAGS_MASK) & ~(DL_FLAGS_MASK);
+    dl_allocator->start_addr = addr + off;
+    dl_allocator->end_addr = addr + init_size;
+    dl_allocator->max_addr = addr + max_size;
+    
+    /* setup empty bins */
+    dl_allocator->smallmap = 0;
+    dl_allocator->treemap = 0;
+    for(unsigned i = 0; i < DL_NSMALLBINS; ++i)
+    {
+        cpl_dlist_t* bin = &(dl_allocator->smallbins[i]);
+        bin->next = bin->prev = bin;
+    }
+    memset(dl_allocator->treebins, 0, sizeof(dl_allocator->treebins));
+    dl_allocator->map_flags = 0;
+    dl_allocator->mmap_threshold = DL_MMAP_THRESHOLD;
+    dl_allocator->mmapped.next = dl_allocator->mmapped.prev = &dl_allocator->mmapped;
+    dl_allocator->release_pending = 0;
+    dl_allocator->nfreechunks = 0;
+    memset(&dl_allocator->counters, 0, sizeof(dl_allocator->counters));
+    
+    /* the whole initial heap is the top chunk */
+    dl_allocator->top = (dl_chunk*)dl_allocator->start_addr;
+    dl_allocator->topsize = init_size - off;
+    dl_allocator->top->head = dl_allocator->topsize | DL_PINUSE_BIT;
+}
+
+/****************** Multi-arena Doug Lea's Allocator routines  ****************/
+
+/*
+ * Every arena is a separate DL heap with its own lock. Arenas are laid out
+ * back to back in one mapping, so the owner of a chunk is found by address.
+ */
+struct dl_arena
+{
+    pthread_mutex_t             lock;
+    struct cpl_dl_allocator*    heap;
+} __attribute__((aligned(64)));
+
+struct cpl_dl_arenas_allocator
+{
+    /* struct cpl_allocator */
+    CPL_ALLOCATOR_INTERFACE
+    
+    char*       base;
+    size_t      arena_size;
+    int         nArenas;
+    volatile int32_t next_arena;
+    pthread_key_t key;              /* index of the thread's arena plus one */
+    struct dl_arena arenas[];
+};
+
+static inline int dl_arena_index(struct cpl_dl_arenas_allocator* mt_allocator, void* ptr)
+{
+    assert((char *)ptr >= mt_allocator->base);
+    size_t idx = (size_t)((char *)ptr - mt_allocator->base) / mt_allocator->arena_size;
+    assert(idx < (size_t)mt_allocator->nArenas);
+    return (int)idx;
+}
+
+static int dl_thread_arena(struct cpl_dl_arenas_allocator* mt_allocator)
+{
+    size_t idx = (size_t)pthread_getspecific(mt_allocator->key);
+    if(!idx)
+    {
+        /* assign threads to arenas round-robin on their first allocation */
+        int32_t n = cpl_atomic_increment(&mt_allocator->next_arena);
+        idx = (size_t)((uint32_t)n % (uint32_t)mt_allocator->nArenas) + 1;
+        pthread_setspecific(mt_allocator->key, (void *)idx);
+    }
+    return (int)idx - 1;
+}
+
+/*
+ * Directly mapped chunks lie outside of all arenas, they are owned by the arena
+ * of their header's heap.
+ */
+static struct dl_arena* dl_chunk_arena(struct cpl_dl_arenas_allocator* mt_allocator, void* ptr)
+{
+    dl_chunk* chunk = ptr2chunk(ptr);
+    if(dl_is_mmapped(chunk))
+    {
+        ptr = dl_mmap_header(chunk)->owner;
+    }
+    return &mt_allocator->arenas[dl_arena_index(mt_allocator, ptr)];
+}
+
+static void* dl_arena_malloc(struct dl_arena* arena, size_t sz, size_t align)
+{
+    pthread_mutex_lock(&arena->lock);
+    void* mem = cpl_dl_malloc_aligned((struct cpl_allocator *)arena->heap, sz, align);
+    pthread_mutex_unlock(&arena->lock);
+    return mem;
+}
+
+static void* dl_arenas_malloc(struct cpl_dl_arenas_allocator* mt_allocator, size_t sz, size_t align)
+{
+    int idx = dl_thread_arena(mt_allocator);
+    void* mem = dl_arena_malloc(&mt_allocator->arenas[idx], sz, align);
+    
+    /* the arena is exhausted, fall back to the others */
+    for(int i = 1; !mem && i < mt_allocator->nArenas; ++i)
+    {
+        mem = dl_arena_malloc(&mt_allocator->arenas[(idx + i) % mt_allocator->nArenas], sz, align);
+    }
+    
+    return mem;
+}
+
+static void* cpl_dl_arenas_malloc(struct cpl_allocator* allocator, size_t sz)
+{
+    return dl_arenas_malloc((struct cpl_dl_arenas_allocator *)allocator, sz, DL_MIN_ALIGNMENT);
+}
+
+static void* cpl_dl_arenas_malloc_aligned(struct cpl_allocator* allocator, size_t sz, size_t align)
+{
+    return dl_arenas_malloc((struct cpl_dl_arenas_allocator *)allocator, sz, align);
+}
+
+static void cpl_dl_arenas_free(struct cpl_allocator* allocator, void* ptr)
+{
+    struct cpl_dl_arenas_allocator* mt_allocator = (struct cpl_dl_arenas_allocator *)allocator;
+    if(ptr)
+    {
+        struct dl_arena* arena = dl_chunk_arena(mt_allocator, ptr);
+        pthread_mutex_lock(&arena->lock);
+        cpl_dl_free((struct cpl_allocator *)arena->heap, ptr);
+        pthread_mutex_unlock(&arena->lock);
+    }
+}
+
+static size_t cpl_dl_arenas_malloc_batch(struct cpl_allocator* allocator, size_t sz, size_t n, void** ptrs)
+{
+    struct cpl_dl_arenas_allocator* mt_allocator = (struct cpl_dl_arenas_allocator *)allocator;
+    int idx = dl_thread_arena(mt_allocator);
+    size_t count = 0;
+    
+    /* what the thread's arena cannot hold comes from the others */
+    for(int i = 0; count < n && i < mt_allocator->nArenas; ++i)
+    {
+        struct dl_arena* arena = &mt_allocator->arenas[(idx + i) % mt_allocator->nArenas];
+        pthread_mutex_lock(&arena->lock);
+        count += cpl_dl_malloc_batch((struct cpl_allocator *)arena->heap, sz, n - count, ptrs + count);
+        pthread_mutex_unlock(&arena->lock);
+    }
+    
+    return count;
+}
+
+static void cpl_dl_arenas_free_batch(struct cpl_allocator* allocator, void** ptrs, size_t n)
+{
+    struct cpl_dl_arenas_allocator* mt_allocator = (struct cpl_dl_arenas_allocator *)allocator;
+    
+    /* runs of chunks from the same arena are freed under one lock */
+    size_t i = 0;
+    while(i < n)
+    {
+        if(!ptrs[i])
+        {
+            ++i;
+            continue;
+        }
+        
+        struct dl_arena* arena = dl_chunk_arena(mt_allocator, ptrs[i]);
+        size_t j = i + 1;
+        while(j < n && (!ptrs[j] || dl_chunk_arena(mt_allocator, ptrs[j]) == arena))
+        {
+            ++j;
+        }
+        
+        pthread_mutex_lock(&arena->lock);
+        cpl_dl_free_batch((struct cpl_allocator *)arena->heap, ptrs + i, j - i);
+        pthread_mutex_unlock(&arena->lock);
+        i = j;
+    }
+}
+
+static void* dl_arenas_realloc(struct cpl_dl_arenas_allocator* mt_allocator, void* ptr, size_t sz, size_t align)
+{
+    if(!ptr)
+    {
+        return dl_arenas_malloc(mt_allocator, sz, align);
+    }
+    
+    struct dl_arena* arena = dl_chunk_arena(mt_allocator, ptr);
+    pthread_mutex_lock(&arena->lock);
+    size_t old_sz = dl_usable_size(ptr2chunk(ptr));
+    void* mem = cpl_dl_realloc_aligned((struct cpl_allocator *)arena->heap, ptr, sz, align);
+    pthread_mutex_unlock(&arena->lock);
+    
+    if(!mem)
+    {
+        /* the owning arena is exhausted, move the chunk to another one */
+        mem = dl_arenas_malloc(mt_allocator, sz, align);
+        if(mem)
+        {
+            memcpy(mem, ptr, (old_sz < sz)?old_sz:sz);
+            cpl_dl_arenas_free((struct cpl_allocator *)mt_allocator, ptr);
+        }
+    }
+    
+    return mem;
+}
+
+static void* cpl_dl_arenas_realloc(struct cpl_allocator* allocator, void* ptr, size_t sz)
+{
+    return dl_arenas_realloc((struct cpl_dl_arenas_allocator *)allocator, ptr, sz, DL_MIN_ALIGNMENT);
+}
+
+static void* cpl_dl_arenas_realloc_aligned(struct cpl_allocator* allocator, void* ptr, size_t sz, size_t align)
+{
+    return dl_arenas_realloc((struct cpl_dl_arenas_allocator *)allocator, ptr, sz, align);
+}
+
+static size_t cpl_dl_arenas_usable_size(struct cpl_allocator* allocator, void* ptr)
+{
+    struct dl_arena* arena = dl_chunk_arena((struct cpl_dl_arenas_allocator *)allocator, ptr);
+    pthread_mutex_lock(&arena->lock);
+    size_t usable = dl_usable_size(ptr2chunk(ptr));
+    pthread_mutex_unlock(&arena->lock);
+    return usable;
+}
+
+static int cpl_dl_arenas_try_expand(struct cpl_allocator* allocator, void* ptr, size_t sz)
+{
+    struct dl_arena* arena = dl_chunk_arena((struct cpl_dl_arenas_allocator *)allocator, ptr);
+    pthread_mutex_lock(&arena->lock);
+    int rc = cpl_dl_try_expand((struct cpl_allocator *)arena->heap, ptr, sz);
+    pthread_mutex_unlock(&arena->lock);
+    return rc;
+}
+
+static void cpl_dl_arenas_stats(struct cpl_allocator* allocator, cpl_allocator_stats_t* stats)
+{
+    struct cpl_dl_arenas_allocator* mt_allocator = (struct cpl_dl_arenas_allocator *)allocator;
+    for(int i = 0; i < mt_allocator->nArenas; ++i)
+    {
+        struct dl_arena* arena = &mt_allocator->arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        cpl_dl_stats((struct cpl_allocator *)arena->heap, stats);
+        pthread_mutex_unlock(&arena->lock);
+    }
+}
+
+static size_t cpl_dl_arenas_trim(struct cpl_allocator* allocator, size_t pad)
+{
+    struct cpl_dl_arenas_allocator* mt_allocator = (struct cpl_dl_arenas_allocator *)allocator;
+    size_t released = 0;
+    for(int i = 0; i < mt_allocator->nArenas; ++i)
+    {
+        struct dl_arena* arena = &mt_allocator->arenas[i];
+        pthread_mutex_lock(&arena->lock);
+        released += dl_trim(arena->heap, pad);
+        pthread_mutex_unlock(&arena->lock);
+    }
+    return released;
+}
+
+/***************** Persistent Doug Lea's Allocator routines  ******************/
+
+/*
+ * A file or shared memory heap starts with this header and is always mapped
+ * at _base_, so pointers kept in the heap stay valid in every mapping. _clean_
+ * is cleared while a file heap is attached; a heap found dirty is walked
+ * before use. _lock_ and _broken_ are used by shared heaps only.
+ */
+#define DL_FILE_MAGIC           ((uint64_t)0x43504C444C484541ULL)   /* "CPLDLHEA" */
+#define DL_SHARED_MAGIC         ((uint64_t)0x43504C444C53484DULL)   /* "CPLDLSHM" */
+#define DL_FILE_VERSION         (1U)
+
+struct dl_file_header
+{
+    struct cpl_dl_allocator heap;
+    uint64_t    magic;
+    uint32_t    version;
+    uint32_t    header_size;            /* layout check */
+    void*       base;
+    size_t      size;                   /* of the file */
+    void*       root;
+    pthread_mutex_t lock;
+    volatile uint32_t broken;
+    uint32_t    clean;
+};
+
+/*
+ * Puts all free chunks below the top back into empty bins and recounts the
+ * bytes in use. The chunk headers must have passed dl_check_heap.
+ */
+static void dl_rebuild_bins(struct cpl_dl_allocator* dl_allocator)
+{
+    dl_allocator->smallmap = 0;
+    dl_allocator->treemap = 0;
+    for(unsigned i = 0; i < DL_NSMALLBINS; ++i)
+    {
+        cpl_dlist_t* bin = &(dl_allocator->smallbins[i]);
+        bin->next = bin->prev = bin;
+    }
+    memset(dl_allocator->treebins, 0, sizeof(dl_allocator->treebins));
+    dl_allocator->release_pending = 0;
+    dl_allocator->nfreechunks = 0;
+    
+    size_t live = 0;
+    dl_chunk* chunk = (dl_chunk *)dl_allocator->start_addr;
+    while(chunk != dl_allocator->top)
+    {
+        size_t sz = dl_size(chunk);
+        if(dl_cinuse(chunk))
+        {
+            live += sz;
+        }
+        else
+        {
+            dl_insert_chunk(dl_allocator, chunk, sz);
+        }
+        chunk = dl_chunk_plus_offset(chunk, sz);
+    }
+    
+    dl_allocator->counters.live = live;
+    if(dl_allocator->counters.peak < live)
+    {
+        dl_allocator->counters.peak = live;
+    }
+}
+
+/*
+ * Walks all chunks of a heap that was not detached properly. Returns 0 if
+ * a chunk header, a footer of a free chunk or the top chunk does not add up.
+ * Otherwise the bins, which may have been left halfway through an update,
+ * are rebuilt from the chunks.
+ */
+static int dl_check_heap(struct cpl_dl_allocator* dl_allocator)
+{
+    char* start = (char *)dl_allocator->start_addr;
+    char* top = (char *)dl_allocator->top;
+    if(top < start || (char *)dl_allocator->end_addr > (char *)dl_allocator->max_addr ||
+       top + dl_allocator->topsize != (char *)dl_allocator->end_addr ||
+       dl_size(dl_allocator->top) != dl_allocator->topsize)
+    {
+        return 0;
+    }
+    
+    size_t pinuse = DL_PINUSE_BIT;
+    dl_chunk* chunk = (dl_chunk *)start;
+    while((char *)chunk < top)
+    {
+        size_t sz = dl_size(chunk);
+        if(sz < DL_CHUNK_SIZE || sz > (size_t)(top - (char *)chunk) ||
+           dl_is_mmapped(chunk) || dl_pinuse(chunk) != pinuse)
+        {
+            return 0;
+        }
+        
+        dl_chunk* next = dl_chunk_plus_offset(chunk, sz);
+        if(!dl_cinuse(chunk))
+        {
+            /* free chunks are always coalesced and carry a footer */
+            if(!pinuse || next->prev_foot != sz)
+            {
+                return 0;
+            }
+        }
+        pinuse = dl_cinuse(chunk)?DL_PINUSE_BIT:0;
+        chunk = next;
+    }
+    
+    if((char *)chunk != top || !pinuse || !dl_pinuse(dl_allocator->top))
+    {
+        return 0;
+    }
+    
+    dl_rebuild_bins(dl_allocator);
+    return 1;
+}
+
+/*
+ * Maps _size_ bytes of _fd_ shared at exactly _base_, or anywhere if _base_
+ * is 0. Fails rather than replacing an existing mapping.
+ */
+static void* dl_map_file(int fd, size_t size, void* base)
+{
+    int flags = MAP_SHARED;
+#if defined(MAP_FIXED_NOREPLACE)
+    if(base)
+    {
+        flags |= MAP_FIXED_NOREPLACE;
+    }
+#endif
+    
+    /* without MAP_FIXED_NOREPLACE the base is a hint only */
+    void* addr = mmap(base, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if(addr != MAP_FAILED && base && addr != base)
+    {
+        munmap(addr, size);
+        return MAP_FAILED;
+    }
+    return addr;
+}
+
+/******************* Shared Doug Lea's Allocator routines  ********************/
+
+/*
+ * Every process attached to a shared heap has a handle of its own, since
+ * routine addresses differ between processes. The heap itself is guarded by
+ * a process-shared lock in its header.
+ */
+struct cpl_dl_shared_allocator
+{
+    /* struct cpl_allocator */
+    CPL_ALLOCATOR_INTERFACE
+    
+    struct dl_file_header* shared;
+    int         fd;
+    char*       name;               /* to unlink on destroy, creator only */
+};
+
+/*
+ * Takes the lock of a shared heap. Returns 0 with the lock released if the
+ * heap is unusable: a process died holding the lock and left it inconsistent.
+ */
+static int dl_shared_lock(struct dl_file_header* shared)
+{
+    int rc = pthread_mutex_lock(&shared->lock);
+#if defined(__linux__)
+    if(rc == EOWNERDEAD)
+    {
+        if(!dl_check_heap(&shared->heap))
+        {
+            shared->broken = 1;
+        }
+        pthread_mutex_consistent(&shared->lock);
+        rc = 0;
+    }
+#endif
+    if(rc)
+    {
+        return 0;
+    }
+    if(shared->broken)
+    {
+        pthread_mutex_unlock(&shared->lock);
+        return 0;
+    }
+    return 1;
+}
+
+static void* cpl_dl_shared_malloc_aligned(struct cpl_allocator* allocator, size_t sz, size_t align)
+{
+    struct dl_file_header* shared = ((struct cpl_dl_shared_allocator *)allocator)->shared;
+    void* mem = 0;
+    if(dl_shared_lock(shared))
+    {
+        mem = cpl_dl_malloc_aligned((struct cpl_allocator *)&shared->heap, sz, align);
+        pthread_mutex_unlock(&shared->lock);
+    }
+    return mem;
+}
+
+static void* cpl_dl_shared_malloc(struct cpl_allocator* allocator, size_t sz)
+{
+    return cpl_dl_shared_malloc_aligned(allocator, sz, DL_MIN_ALIGNMENT);
+}
+
+static void* cpl_dl_shared_realloc_aligned(struct cpl_allocator* allocator, void* ptr, size_t sz, size_t align)
+{
+    struct dl_file_header* shared = ((struct cpl_dl_shared_allocator *)allocator)->shared;
+    void* mem = 0;
+    if(dl_shared_lock(shared))
+    {
+        mem = cpl_dl_realloc_aligned((struct cpl_allocator *)&shared->heap, ptr, sz, align);
+        pthread_mutex_unlock(&shared->lock);
+    }
+    return mem;
+}
+
+static void* cpl_dl_shared_realloc(struct cpl_allocator* allocator, void* ptr, size_t sz)
+{
+    return cpl_dl_shared_realloc_aligned(allocator, ptr, sz, DL_MIN_ALIGNMENT);
+}
+
+static void cpl_dl_shared_free(struct cpl_allocator* allocator, void* ptr)
+{
+    struct dl_file_header* shared = ((struct cpl_dl_shared_allocator *)allocator)->shared;
+    if(ptr && dl_shared_lock(shared))
+    {
+        cpl_dl_free((struct cpl_allocator *)&shared->heap, ptr);
+        pthread_mutex_unlock(&shared->lock);
+    }
+}
+
+static size_t cpl_dl_shared_malloc_batch(struct cpl_allocator* allocator, size_t sz, size_t n, void** ptrs)
+{
+    struct dl_file_header* shared = ((struct cpl_dl_shared_allocator *)allocator)->shared;
+    size_t count = 0;
+    if(dl_shared_lock(shared))
+    {
+        count = cpl_dl_malloc_batch((struct cpl_allocator *)&shared->heap, sz, n, ptrs);
+        pthread_mutex_unlock(&shared->lock);
+    }
+    return count;
+}
+
+static void cpl_dl_shared_free_batch(struct cpl_allocator* allocator, void** ptrs, size_t n)
+{
+    struct dl_file_header* shared = ((struct cpl_dl_shared_allocator *)allocator)->shared;
+    if(dl_shared_lock(shared))
+    {
+        cpl_dl_free_batch((struct cpl_allocator *)&shared->heap, ptrs, n);
+        pthread_mutex_unlock(&shared->lock);
+    }
+}
+
+static size_t cpl_dl_shared_usable_size(struct cpl_allocator* allocator, void* ptr)
+{
+    /* the size of an in-use chunk only changes by its owner */
+    (void)allocator;
+    return dl_usable_size(ptr2chunk(ptr));
+}
+
+static int cpl_dl_shared_try_expand(struct cpl_allocator* allocator, void* ptr, size_t sz)
+{
+    struct dl_file_header* shared = ((struct cpl_dl_shared_allocator *)allocator)->shared;
+    int rc = _CPL_NOMEM;
+    if(dl_shared_lock(shared))
+    {
+        rc = cpl_dl_try_expand((struct cpl_allocator *)&shared->heap, ptr, sz);
+        pthread_mutex_unlock(&shared->lock);
+    }
+    return rc;
+}
+
+static void cpl_dl_shared_stats(struct cpl_allocator* allocator, cpl_allocator_stats_t* stats)
+{
+    struct dl_file_header* shared = ((struct cpl_dl_shared_allocator *)allocator)->shared;
+    if(dl_shared_lock(shared))
+    {
+        cpl_dl_stats((struct cpl_allocator *)&shared->heap, stats);
+        pthread_mutex_unlock(&shared->lock);
+    }
+}
+
+/*
+ * Creates a shared memory object without a name, it is passed to other
+ * processes as a descriptor.
+ */
+static int dl_shared_anonymous(void)
+{
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    return memfd_create("cpl_dl_shared", MFD_CLOEXEC);
+#else
+    static volatile int32_t counter = 0;
+    char name[64];
+    snprintf(name, sizeof(name), "/cpl_dl.%d.%d", (int)getpid(), (int)cpl_atomic_increment(&counter));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd >= 0)
+    {
+        shm_unlink(name);
+    }
+    return fd;
+#endif
+}
+
+static struct cpl_dl_shared_allocator* dl_shared_handle(struct dl_file_header* shared, int fd)
+{
+    struct cpl_dl_shared_allocator* handle = malloc(sizeof(struct cpl_dl_shared_allocator));
+    if(!handle)
+    {
+        return 0;
+    }
+    
+    handle->xAllocate = cpl_dl_shared_malloc;
+    handle->xRealloc = cpl_dl_shared_realloc;
+    handle->xFree = cpl_dl_shared_free;
+    handle->xStats = cpl_dl_shared_stats;
+    handle->xTrim = 0;
+    handle->xAllocateAligned = cpl_dl_shared_malloc_aligned;
+    handle->xReallocAligned = cpl_dl_shared_realloc_aligned;
+    handle->xUsableSize = cpl_dl_shared_usable_size;
+    handle->xTryExpand = cpl_dl_shared_try_expand;
+    handle->xAllocateBatch = cpl_dl_shared_malloc_batch;
+    handle->xFreeBatch = cpl_dl_shared_free_batch;
+    handle->shared = shared;
+    handle->fd = fd;
+    handle->name = 0;
+    return handle;
+}
+
+/*
+ * Maps a shared heap of _fd_ at the address it was created at, the heap links
+ * its chunks by plain pointers. Takes over _fd_ on success.
+ */
+static struct cpl_dl_shared_allocator* dl_shared_attach(int fd)
+{
+    /* the header tells where and how large the heap is */
+    struct dl_file_header* header = mmap(0, sizeof(struct dl_file_header), PROT_READ, MAP_SHARED, fd, 0);
+    if(header == MAP_FAILED)
+    {
+        return 0;
+    }
+    
+    int ok = header->magic == DL_SHARED_MAGIC && header->version == DL_FILE_VERSION &&
+             header->header_size == sizeof(struct dl_file_header);
+    void* base = header->base;
+    size_t size = header->size;
+    munmap(header, sizeof(struct dl_file_header));
+    if(!ok)
+    {
+        return 0;
+    }
+    
+    header = dl_map_file(fd, size, base);
+    if(header == MAP_FAILED)
+    {
+        return 0;
+    }
+    
+    struct cpl_dl_shared_allocator* handle = dl_shared_handle(header, fd);
+    if(!handle)
+    {
+        munmap(header, size);
+    }
+    return handle;
+}
+
+/*
+ * Returns the header of a file or shared heap.
+ */
+static struct dl_file_header* dl_header(cpl_allocator_ref allocator)
+{
+    if(allocator->xAllocate == cpl_dl_shared_malloc)
+    {
+        return ((struct cpl_dl_shared_allocator *)allocator)->shared;
+    }
+    
+    assert(allocator->xAllocate == cpl_dl_malloc);
+    struct dl_file_header* header = (struct dl_file_header *)allocator;
+    assert(header->heap.map_flags & DL_MAP_FILE);
+    return header;
+}
+
+/********************* Public DL Allocator routines  **************************/
+void cpl_allocator_dl_set_mmap_threshold(cpl_allocator_ref allocator, size_t threshold)
+{
+    assert(allocator != cpl_allocator_get_default());
+    if(allocator->xAllocate == cpl_dl_arenas_malloc)
+    {
+        struct cpl_dl_arenas_allocator* mt_allocator = (struct cpl_dl_arenas_allocator *)allocator;
+        for(int i = 0; i < mt_allocator->nArenas; ++i)
+        {
+            struct dl_arena* arena = &mt_allocator->arenas[i];
+            pthread_mutex_lock(&arena->lock);
+            arena->heap->mmap_threshold = threshold;
+            pthread_mutex_unlock(&arena->lock);
+        }
+    }
+    else
+    {
+        assert(allocator->xAllocate == cpl_dl_malloc);
+        struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+        if(!(dl_allocator->map_flags & DL_MAP_FILE))
+        {
+            /* chunks of a file heap never leave the file */
+            dl_allocator->mmap_threshold = threshold;
+        }
+    }
+}
+
+cpl_allocator_ref cpl_allocator_create_dl(size_t max_size)
+{
+    return cpl_allocator_create_dl_ex(max_size, 0);
+}
+
+cpl_allocator_ref cpl_allocator_create_dl_ex(size_t max_size, unsigned flags)
+{
+    /* align to page size */
+    max_size = dl_page_align(max_size);
+    
+    /* reserve pages */
+    char* addr = cpl_allocator_map(&max_size, flags);
+    if(addr == MAP_FAILED)
+    {
+        /* failed to map */
+        return 0;
+    }
+    
+    /* place allocator struct right after the heap and setup fields */
+    struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)addr;
+    cpl_dl_allocator_init(dl_allocator, addr, sizeof(struct cpl_dl_allocator), max_size);
+    dl_allocator->map_flags = flags;
+    
+    return (cpl_allocator_ref)dl_allocator;
+}
+
+void cpl_allocator_destroy_dl(cpl_allocator_ref allocator)
 {
     assert(allocator != cpl_allocator_get_default());
     struct cpl_dl_allocator* dl_allocator = (struct cpl_dl_allocator *)allocator;
+    dl_munmap_all(dl_allocator);
+    
     size_t max_size = (size_t)dl_allocator->max_addr - (size_t)dl_allocator;
     int rc = munmap(dl_allocator, max_size);
     assert(rc == 0);
 }
+
+cpl_allocator_ref cpl_allocator_create_dl_arenas(size_t arena_size, int nArenas)
+{
+    assert(nArenas > 0);
+    arena_size = dl_page_align(arena_size);
+    
+    struct cpl_dl_arenas_allocator* mt_allocator = 0;
+    if(posix_memalign((void **)&mt_allocator, 64,
+                      sizeof(struct cpl_dl_arenas_allocator) + nArenas * sizeof(struct dl_arena)))
+    {
+        return 0;
+    }
+    
+    /* reserve pages for all arenas at once */
+    char* addr = mmap(0, arena_size * nArenas, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED)
+    {
+        free(mt_allocator);
+        return 0;
+    }
+    
+    if(pthread_key_create(&mt_allocator->key, 0))
+    {
+        munmap(addr, arena_size * nArenas);
+        free(mt_allocator);
+        return 0;
+    }
+    
+    mt_allocator->xAllocate = cpl_dl_arenas_malloc;
+    mt_allocator->xRealloc = cpl_dl_arenas_realloc;
+    mt_allocator->xFree = cpl_dl_arenas_free;
+    mt_allocator->xStats = cpl_dl_arenas_stats;
+    mt_allocator->xTrim = cpl_dl_arenas_trim;
+    mt_allocator->xAllocateAligned = cpl_dl_arenas_malloc_aligned;
+    mt_allocator->xReallocAligned = cpl_dl_arenas_realloc_aligned;
+    mt_allocator->xUsableSize = cpl_dl_arenas_usable_size;
+    mt_allocator->xTryExpand = cpl_dl_arenas_try_expand;
+    mt_allocator->xAllocateBatch = cpl_dl_arenas_malloc_batch;
+    mt_allocator->xFreeBatch = cpl_dl_arenas_free_batch;
+    mt_allocator->base = addr;
+    mt_allocator->arena_size = arena_size;
+    mt_allocator->nArenas = nArenas;
+    mt_allocator->next_arena = 0;
+    
+    for(int i = 0; i < nArenas; ++i)
+    {
+        struct dl_arena* arena = &mt_allocator->arenas[i];
+        pthread_mutex_init(&arena->lock, 0);
+        arena->heap = (struct cpl_dl_allocator *)(addr + i * arena_size);
+        cpl_dl_allocator_init(arena->heap, (char *)arena->heap, sizeof(struct cpl_dl_allocator), arena_size);
+    }
+    
+    return (cpl_allocator_ref)mt_allocator;
+}
+
+void cpl_allocator_destroy_dl_arenas(cpl_allocator_ref allocator)
+{
+    assert(allocator != cpl_allocator_get_default());
+    struct cpl_dl_arenas_allocator* mt_allocator = (struct cpl_dl_arenas_allocator *)allocator;
+    
+    for(int i = 0; i < mt_allocator->nArenas; ++i)
+    {
+        dl_munmap_all(mt_allocator->arenas[i].heap);
+        pthread_mutex_destroy(&mt_allocator->arenas[i].lock);
+    }
+    pthread_key_delete(mt_allocator->key);
+    
+    int rc = munmap(mt_allocator->base, mt_allocator->arena_size * mt_allocator->nArenas);
+    assert(rc == 0);
+    free(mt_allocator);
+}
+
+cpl_allocator_ref cpl_allocator_create_dl_file(const char* path, size_t max_size, void* base)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if(fd < 0)
+    {
+        return 0;
+    }
+    
+    struct dl_file_header* header = 0;
+    struct dl_file_header saved;
+    struct stat st;
+    if(fstat(fd, &st))
+    {
+        goto Lclose;
+    }
+    
+    /* a file without magic is left of a create that did not finish */
+    if(st.st_size == 0 ||
+       (pread(fd, &saved, sizeof(saved), 0) == (ssize_t)sizeof(saved) && saved.magic == 0))
+    {
+        /* new heap, size the file and lay out an empty heap */
+        max_size = dl_page_align(max_size);
+        if(max_size < sizeof(struct dl_file_header) + DL_PAGE_SIZE ||
+           ftruncate(fd, 0) || ftruncate(fd, (off_t)max_size))
+        {
+            goto Ltruncate;
+        }
+        
+        header = dl_map_file(fd, max_size, base);
+        if(header == MAP_FAILED)
+        {
+            header = 0;
+            goto Ltruncate;
+        }
+        
+        cpl_dl_allocator_init(&header->heap, (char *)header, sizeof(struct dl_file_header), max_size);
+        header->heap.map_flags = DL_MAP_FILE;
+        header->heap.mmap_threshold = (size_t)-1;
+        header->version = DL_FILE_VERSION;
+        header->header_size = sizeof(struct dl_file_header);
+        header->base = header;
+        header->size = max_size;
+        header->root = 0;
+        header->clean = 0;
+        
+        /* the heap is valid once the magic is on disk */
+        if(msync(header, DL_PAGE_SIZE, MS_SYNC))
+        {
+            munmap(header, max_size);
+            header = 0;
+            goto Ltruncate;
+        }
+        header->magic = DL_FILE_MAGIC;
+    }
+    else
+    {
+        /* existing heap, learn where it was mapped and check the layout */
+        if(pread(fd, &saved, sizeof(saved), 0) != (ssize_t)sizeof(saved) ||
+           saved.magic != DL_FILE_MAGIC || saved.version != DL_FILE_VERSION ||
+           saved.header_size != sizeof(struct dl_file_header) ||
+           saved.size != (size_t)st.st_size || (base && saved.base != base))
+        {
+            goto Lclose;
+        }
+        
+        header = dl_map_file(fd, saved.size, saved.base);
+        if(header == MAP_FAILED)
+        {
+            header = 0;
+            goto Lclose;
+        }
+        
+        if(!header->clean && !dl_check_heap(&header->heap))
+        {
+            munmap(header, saved.size);
+            header = 0;
+            goto Lclose;
+        }
+        
+        /* code addresses differ between runs */
+        cpl_dl_assign_routines(&header->heap);
+    }
+    
+    header->clean = 0;
+    
+Lclose:
+    close(fd);
+    return (cpl_allocator_ref)header;
+    
+Ltruncate:
+    /* do not leave a heap without magic behind */
+    ftruncate(fd, 0);
+    close(fd);
+    return 0;
+}
+
+void cpl_allocator_destroy_dl_file(cpl_allocator_ref allocator)
+{
+    assert(allocator->xAllocate == cpl_dl_malloc);
+    struct dl_file_header* header = (struct dl_file_header *)allocator;
+    assert(header->heap.map_flags & DL_MAP_FILE);
+    
+    /* the heap is consistent between calls, mark it so once it is on disk */
+    size_t size = header->size;
+    msync(header, size, MS_SYNC);
+    header->clean = 1;
+    msync(header, DL_PAGE_SIZE, MS_SYNC);
+    
+    int rc = munmap(header, size);
+    assert(rc == 0);
+}
+
+int cpl_allocator_dl_sync(cpl_allocator_ref allocator)
+{
+    struct dl_file_header* header = dl_header(allocator);
+    size_t used = (size_t)header->heap.end_addr - (size_t)header;
+    return msync(header, used, MS_SYNC)?_CPL_IO_ERROR:_CPL_OK;
+}
+
+void* cpl_allocator_dl_get_root(cpl_allocator_ref allocator)
+{
+    return dl_header(allocator)->root;
+}
+
+void cpl_allocator_dl_set_root(cpl_allocator_ref allocator, void* root)
+{
+    dl_header(allocator)->root = root;
+}
+
+cpl_allocator_ref cpl_allocator_create_dl_shared(const char* name, size_t max_size, void* base)
+{
+    max_size = dl_page_align(max_size);
+    if(max_size < sizeof(struct dl_file_header) + DL_PAGE_SIZE)
+    {
+        return 0;
+    }
+    
+    int fd = name?shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600):dl_shared_anonymous();
+    if(fd < 0)
+    {
+        return 0;
+    }
+    
+    struct dl_file_header* header = MAP_FAILED;
+    struct cpl_dl_shared_allocator* handle = 0;
+    if(ftruncate(fd, (off_t)max_size))
+    {
+        goto Lfail;
+    }
+    
+    header = dl_map_file(fd, max_size, base);
+    if(header == MAP_FAILED)
+    {
+        goto Lfail;
+    }
+    
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#if defined(__linux__)
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+    int rc = pthread_mutex_init(&header->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if(rc)
+    {
+        goto Lfail;
+    }
+    
+    cpl_dl_allocator_init(&header->heap, (char *)header, sizeof(struct dl_file_header), max_size);
+    header->heap.map_flags = DL_MAP_FILE;
+    header->heap.mmap_threshold = (size_t)-1;
+    header->version = DL_FILE_VERSION;
+    header->header_size = sizeof(struct dl_file_header);
+    header->base = header;
+    header->size = max_size;
+    header->root = 0;
+    header->broken = 0;
+    header->clean = 0;
+    
+    handle = dl_shared_handle(header, fd);
+    if(!handle || (name && !(handle->name = strdup(name))))
+    {
+        goto Lfail;
+    }
+    
+    /* the heap is ready to attach to */
+    __sync_synchronize();
+    header->magic = DL_SHARED_MAGIC;
+    return (cpl_allocator_ref)handle;
+    
+Lfail:
+    free(handle);
+    if(header != MAP_FAILED)
+    {
+        munmap(header, max_size);
+    }
+    if(name)
+    {
+        shm_unlink(name);
+    }
+    close(fd);
+    return 0;
+}
+
+cpl_allocator_ref cpl_allocator_attach_dl_shared(const char* name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0)
+    {
+        return 0;
+    }
+    
+    struct cpl_dl_shared_allocator* handle = dl_shared_attach(fd);
+    if(!handle)
+    {
+        close(fd);
+    }
+    return (cpl_allocator_ref)handle;
+}
+
+cpl_allocator_ref cpl_allocator_attach_dl_shared_fd(int fd)
+{
+    fd = dup(fd);
+    if(fd < 0)
+    {
+        return 0;
+    }
+    
+    struct cpl_dl_shared_allocator* handle = dl_shared_attach(fd);
+    if(!handle)
+    {
+        close(fd);
+    }
+    return (cpl_allocator_ref)handle;
+}
+
+void cpl_allocator_destroy_dl_shared(cpl_allocator_ref allocator)
+{
+    assert(allocator->xAllocate == cpl_dl_shared_malloc);
+    struct cpl_dl_shared_allocator* handle = (struct cpl_dl_shared_allocator *)allocator;
+    
+    /* the segment goes away with its last mapping */
+    int rc = munmap(handle->shared, handle->shared->size);
+    assert(rc == 0);
+    close(handle->fd);
+    if(handle->name)
+    {
+        shm_unlink(handle->name);
+        free(handle->name);
+    }
+    free(handle);
+}
+
+int cpl_allocator_dl_shared_fd(cpl_allocator_ref allocator)
+{
+    assert(allocator->xAllocate == cpl_dl_shared_malloc);
+    return ((struct cpl_dl_shared_allocator *)allocator)->fd;
+}
+
+size_t cpl_allocator_dl_shared_offset(cpl_allocator_ref allocator, const void* ptr)
+{
+    assert(allocator->xAllocate == cpl_dl_shared_malloc);
+    struct dl_file_header* shared = ((struct cpl_dl_shared_allocator *)allocator)->shared;
+    if(!ptr)
+    {
+        return 0;
+    }
+    assert((const char *)ptr > (const char *)shared && (const char *)ptr < (const char *)shared + shared->size);
+    return (size_t)((const char *)ptr - (const char *)shared);
+}
+
+void* cpl_allocator_dl_shared_pointer(cpl_allocator_ref allocator, size_t offset)
+{
+    assert(allocator->xAllocate == cpl_dl_shared_malloc);
+    struct dl_file_header* shared = ((struct cpl_dl_shared_allocator *)allocator)->shared;
+    assert(offset < shared->size);
+    return offset?(char *)shared + offset:0;
+}
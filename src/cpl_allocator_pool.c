@@ -21,14 +21,17 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#include "cpl_allocator.h"
+#include "cpl_allocator_private.h"
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/mman.h>
 
+#include "cpl_atomic.h"
 #include "cpl_list.h"
+#include "cpl_pool.h"
 
 #ifndef MAP_ANONYMOUS
 #   ifdef MAP_ANON
@@ -36,34 +39,134 @@
 #   endif
 #endif
 
+/*
+ * Chunks are as aligned as their size allows, up to the alignment of the
+ * memory they are cut from. Pools serve no greater alignment.
+ */
+#define POOL_PAGE_SIZE          ((size_t)0x1000)
+
+static inline size_t pool_alignment(size_t chunkSize, size_t baseAlignment)
+{
+    size_t alignment = chunkSize & -chunkSize;
+    return (alignment < baseAlignment)?alignment:baseAlignment;
+}
+
+/* detaches up to _n_ chunks from the head of a free list in one step */
+static size_t pool_detach_run(cpl_slist_ref list, size_t n, void** ptrs)
+{
+    cpl_slist_ref node = list->next;
+    size_t count = 0;
+    while(count < n && node)
+    {
+        ptrs[count++] = node;
+        node = node->next;
+    }
+    list->next = node;
+    return count;
+}
+
+/* links the non-null chunks of _ptrs_ into a run and returns its head */
+static cpl_slist_ref pool_link_run(void** ptrs, size_t n, cpl_slist_ref tail, size_t* count)
+{
+    cpl_slist_ref head = tail;
+    *count = 0;
+    for(size_t i = n; i-- > 0; )
+    {
+        if(ptrs[i])
+        {
+            ((cpl_slist_ref)ptrs[i])->next = head;
+            head = (cpl_slist_ref)ptrs[i];
+            ++*count;
+        }
+    }
+    return head;
+}
+
 /*********************** Pool Allocator Implementation ************************/
 struct cpl_pool_allocator
 {
     /* struct cpl_allocator */
-    void* (*xAllocate)(struct cpl_allocator*, size_t);
-    void* (*xRealloc)(struct cpl_allocator*, void* ptr, size_t);
-    void  (*xFree)(struct cpl_allocator*, void* ptr);
+    CPL_ALLOCATOR_INTERFACE
     
     /* pool-specific data */
     void*   pool;
     size_t  poolSize;
+    size_t  mapSize;        /* of the pool and this struct, rounded up to huge pages */
     size_t  chunkSize;
+    size_t  alignment;
     int     nChunks;
-    cpl_slist_t list;
+    
+    /* single-threaded free list and counters, also used inline by cpl_pool.h */
+    struct cpl_pool freelist;
+    
+    /* lock-free free list: index of the first chunk plus one in the low word
+     * and a modification tag in the high word to defeat ABA */
+    volatile int64_t head;
+    
+    /* per-thread statistics of the lock-free mode */
+    struct cpl_stats_shards shards;
 };
 
+/* Links of the lock-free list are chunk indices plus one, zero ends the list */
+#define pool_index2chunk(p, i)  ((uint32_t *)((char *)(p)->pool + (size_t)((i) - 1) * (p)->chunkSize))
+#define pool_chunk2index(p, c)  ((uint32_t)(((char *)(c) - (char *)(p)->pool) / (p)->chunkSize) + 1)
+#define pool_make_head(t, i)    ((int64_t)(((uint64_t)(t) << 32) | (uint32_t)(i)))
+#define pool_head_index(h)      ((uint32_t)(h))
+#define pool_head_tag(h)        ((uint32_t)((uint64_t)(h) >> 32))
+
 static void* cpl_pool_malloc(struct cpl_allocator* pAllocator, size_t sz)
 {
     struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
     assert(sz == pPoolAllocator->chunkSize);
-    void* ptr = cpl_slist_pop(&pPoolAllocator->list);
-    return ptr;
+    return cpl_pool_alloc_inline(&pPoolAllocator->freelist);
 }
 
 static void cpl_pool_free(struct cpl_allocator* pAllocator, void* ptr)
 {
     struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
-    cpl_slist_add(&pPoolAllocator->list, ptr);
+    cpl_pool_free_inline(&pPoolAllocator->freelist, ptr);
+}
+
+static size_t cpl_pool_malloc_batch(struct cpl_allocator* pAllocator, size_t sz, size_t n, void** ptrs)
+{
+    struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
+    assert(sz == pPoolAllocator->chunkSize);
+    struct cpl_pool* freelist = &pPoolAllocator->freelist;
+    size_t count = pool_detach_run(&freelist->list, n, ptrs);
+    freelist->nallocs += count;
+    freelist->nInUse += count;
+    if(freelist->nInUse > freelist->nPeakInUse)
+    {
+        freelist->nPeakInUse = freelist->nInUse;
+    }
+    return count;
+}
+
+static void cpl_pool_free_batch(struct cpl_allocator* pAllocator, void** ptrs, size_t n)
+{
+    struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
+    struct cpl_pool* freelist = &pPoolAllocator->freelist;
+    size_t count;
+    freelist->list.next = pool_link_run(ptrs, n, freelist->list.next, &count);
+    freelist->nfrees += count;
+    freelist->nInUse -= count;
+}
+
+static void cpl_pool_stats(struct cpl_allocator* pAllocator, cpl_allocator_stats_t* stats)
+{
+    struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
+    struct cpl_pool* freelist = &pPoolAllocator->freelist;
+    
+    /* the inline routines only count chunks, every one of chunkSize bytes */
+    struct cpl_allocator_counters counters;
+    memset(&counters, 0, sizeof(counters));
+    counters.live = freelist->nInUse * pPoolAllocator->chunkSize;
+    counters.peak = freelist->nPeakInUse * pPoolAllocator->chunkSize;
+    counters.mapped = pPoolAllocator->poolSize;
+    counters.nallocs = freelist->nallocs;
+    counters.nfrees = freelist->nfrees;
+    counters.histogram[cpl_stats_bucket(pPoolAllocator->chunkSize)] = freelist->nallocs;
+    cpl_counters_collect(&counters, stats);
 }
 
 static void* cpl_pool_realloc(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
@@ -79,14 +182,413 @@ static void* cpl_pool_realloc(struct cpl_allocator* pAllocator, void* ptr, size_
     return ptr;
 }
 
+/* serve both the single-threaded and the lock-free mode */
+static void* cpl_pool_malloc_aligned(struct cpl_allocator* pAllocator, size_t sz, size_t align)
+{
+    struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
+    return (align <= pPoolAllocator->alignment)?pAllocator->xAllocate(pAllocator, sz):0;
+}
+
+static void* cpl_pool_realloc_aligned(struct cpl_allocator* pAllocator, void* ptr, size_t sz, size_t align)
+{
+    struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
+    return (align <= pPoolAllocator->alignment)?pAllocator->xRealloc(pAllocator, ptr, sz):0;
+}
+
+static size_t cpl_pool_usable_size(struct cpl_allocator* pAllocator, void* ptr)
+{
+    return ((struct cpl_pool_allocator *)pAllocator)->chunkSize;
+}
+
+static void* cpl_pool_lockfree_malloc(struct cpl_allocator* pAllocator, size_t sz)
+{
+    struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
+    assert(sz == pPoolAllocator->chunkSize);
+    
+    int64_t old_head, new_head;
+    uint32_t* chunk;
+    do
+    {
+        old_head = pPoolAllocator->head;
+        uint32_t idx = pool_head_index(old_head);
+        if(!idx)
+        {
+            return 0;
+        }
+        
+        /* the chunk may be taken concurrently, then the tag check fails */
+        chunk = pool_index2chunk(pPoolAllocator, idx);
+        new_head = pool_make_head(pool_head_tag(old_head) + 1, *(volatile uint32_t *)chunk);
+    } while(!cpl_atomic_compare_and_swap64(&pPoolAllocator->head, old_head, new_head));
+    
+    cpl_counters_alloc(cpl_stats_shards_local(&pPoolAllocator->shards), sz, pPoolAllocator->chunkSize);
+    return chunk;
+}
+
+static void cpl_pool_lockfree_free(struct cpl_allocator* pAllocator, void* ptr)
+{
+    struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
+    if(!ptr)
+    {
+        return ;
+    }
+    
+    uint32_t idx = pool_chunk2index(pPoolAllocator, ptr);
+    int64_t old_head, new_head;
+    do
+    {
+        old_head = pPoolAllocator->head;
+        *(volatile uint32_t *)ptr = pool_head_index(old_head);
+        new_head = pool_make_head(pool_head_tag(old_head) + 1, idx);
+    } while(!cpl_atomic_compare_and_swap64(&pPoolAllocator->head, old_head, new_head));
+    
+    cpl_counters_free(cpl_stats_shards_local(&pPoolAllocator->shards), pPoolAllocator->chunkSize);
+}
+
+static size_t cpl_pool_lockfree_malloc_batch(struct cpl_allocator* pAllocator, size_t sz, size_t n, void** ptrs)
+{
+    struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
+    assert(sz == pPoolAllocator->chunkSize);
+    
+    int64_t old_head, new_head;
+    size_t count;
+    do
+    {
+        old_head = pPoolAllocator->head;
+        uint32_t idx = pool_head_index(old_head);
+        
+        /* links of chunks taken concurrently may be garbage, the walk stops
+         * at them and the tag check fails */
+        for(count = 0; count < n && idx && idx <= (uint32_t)pPoolAllocator->nChunks; ++count)
+        {
+            uint32_t* chunk = pool_index2chunk(pPoolAllocator, idx);
+            ptrs[count] = chunk;
+            idx = *(volatile uint32_t *)chunk;
+        }
+        if(!count)
+        {
+            return 0;
+        }
+        new_head = pool_make_head(pool_head_tag(old_head) + 1, (idx <= (uint32_t)pPoolAllocator->nChunks)?idx:0);
+    } while(!cpl_atomic_compare_and_swap64(&pPoolAllocator->head, old_head, new_head));
+    
+    cpl_counters_alloc_n(cpl_stats_shards_local(&pPoolAllocator->shards), sz, count * pPoolAllocator->chunkSize, count);
+    return count;
+}
+
+static void cpl_pool_lockfree_free_batch(struct cpl_allocator* pAllocator, void** ptrs, size_t n)
+{
+    struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
+    
+    /* chain the chunks privately, then push the chain at once */
+    uint32_t first = 0;
+    uint32_t* last = 0;
+    size_t count = 0;
+    for(size_t i = n; i-- > 0; )
+    {
+        if(ptrs[i])
+        {
+            *(uint32_t *)ptrs[i] = first;
+            first = pool_chunk2index(pPoolAllocator, ptrs[i]);
+            last = last ? last : (uint32_t *)ptrs[i];
+            ++count;
+        }
+    }
+    if(!count)
+    {
+        return ;
+    }
+    
+    int64_t old_head, new_head;
+    do
+    {
+        old_head = pPoolAllocator->head;
+        *(volatile uint32_t *)last = pool_head_index(old_head);
+        new_head = pool_make_head(pool_head_tag(old_head) + 1, first);
+    } while(!cpl_atomic_compare_and_swap64(&pPoolAllocator->head, old_head, new_head));
+    
+    cpl_counters_free_n(cpl_stats_shards_local(&pPoolAllocator->shards), count * pPoolAllocator->chunkSize, count);
+}
+
+static void* cpl_pool_lockfree_realloc(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
+{
+    struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
+    assert(sz == pPoolAllocator->chunkSize);
+    
+    /* all chunks are of the same size */
+    return ptr?ptr:cpl_pool_lockfree_malloc(pAllocator, sz);
+}
+
+static void cpl_pool_lockfree_stats(struct cpl_allocator* pAllocator, cpl_allocator_stats_t* stats)
+{
+    struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)pAllocator;
+    cpl_stats_shards_collect(&pPoolAllocator->shards, stats);
+    stats->mapped_bytes += pPoolAllocator->poolSize;
+}
+
+/****************** Growable Pool Allocator Implementation ********************/
+
+/*
+ * Slabs are mapped on demand and aligned to their power of two size, so the
+ * slab of a chunk is found by masking its address.
+ */
+struct pool_slab
+{
+    cpl_dlist_t link;
+    cpl_slist_t list;       /* free chunks */
+    int         nInUse;
+    int         nFree;
+};
+
+/* chunks start at a cache line */
+#define POOL_SLAB_HEADER        ((sizeof(struct pool_slab) + 63) & ~(size_t)63)
+#define pool_ptr2slab(p, ptr)   ((struct pool_slab *)((size_t)(ptr) & ~((p)->slabSize - 1)))
+
+struct cpl_growable_pool_allocator
+{
+    /* struct cpl_allocator */
+    CPL_ALLOCATOR_INTERFACE
+    
+    /* pool-specific data */
+    size_t  chunkSize;
+    size_t  slabSize;
+    int     nChunksPerSlab;
+    int     nMaxEmptySlabs;     /* empty slabs kept mapped before unmapping */
+    int     nEmptySlabs;
+    struct cpl_allocator_counters counters;
+    cpl_dlist_t partial;        /* slabs with both free and used chunks */
+    cpl_dlist_t empty;          /* slabs without used chunks */
+    cpl_dlist_t full;           /* slabs without free chunks */
+};
+
+static struct pool_slab* pool_map_slab(struct cpl_growable_pool_allocator* pPoolAllocator)
+{
+    size_t slabSize = pPoolAllocator->slabSize;
+    
+    /* over-map and cut the unaligned ends off */
+    char* addr = mmap(0, 2 * slabSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED)
+    {
+        return 0;
+    }
+    
+    char* aligned = (char *)(((size_t)addr + slabSize - 1) & ~(slabSize - 1));
+    if(aligned != addr)
+    {
+        munmap(addr, aligned - addr);
+    }
+    munmap(aligned + slabSize, addr + slabSize - aligned);
+    
+    struct pool_slab* slab = (struct pool_slab *)aligned;
+    CPL_SLIST_INIT(slab->list);
+    slab->nInUse = 0;
+    slab->nFree = pPoolAllocator->nChunksPerSlab;
+    
+    char* chunks = aligned + POOL_SLAB_HEADER;
+    for (int i = pPoolAllocator->nChunksPerSlab-1; i >= 0; --i)
+    {
+        cpl_slist_add(&slab->list, (cpl_slist_ref)(chunks + i*pPoolAllocator->chunkSize));
+    }
+    
+    return slab;
+}
+
+/*
+ * Returns the slab to allocate from. It stays at the head of the partial list
+ * until it fills up, partial slabs are filled first so that the empty ones
+ * may go away.
+ */
+static struct pool_slab* pool_current_slab(struct cpl_growable_pool_allocator* pPoolAllocator)
+{
+    struct pool_slab* slab;
+    if(!cpl_dlist_empty(&pPoolAllocator->partial))
+    {
+        return cpl_dlist_entry(pPoolAllocator->partial.next, struct pool_slab, link);
+    }
+    
+    if(!cpl_dlist_empty(&pPoolAllocator->empty))
+    {
+        slab = cpl_dlist_entry(pPoolAllocator->empty.next, struct pool_slab, link);
+        cpl_dlist_del(&slab->link);
+        --pPoolAllocator->nEmptySlabs;
+    }
+    else if(!(slab = pool_map_slab(pPoolAllocator)))
+    {
+        return 0;
+    }
+    else
+    {
+        pPoolAllocator->counters.mapped += pPoolAllocator->slabSize;
+    }
+    cpl_dlist_add(&slab->link, &pPoolAllocator->partial);
+    return slab;
+}
+
+static void* cpl_growable_pool_malloc(struct cpl_allocator* pAllocator, size_t sz)
+{
+    struct cpl_growable_pool_allocator* pPoolAllocator = (struct cpl_growable_pool_allocator *)pAllocator;
+    assert(sz == pPoolAllocator->chunkSize);
+    
+    struct pool_slab* slab = pool_current_slab(pPoolAllocator);
+    if(!slab)
+    {
+        return 0;
+    }
+    
+    void* ptr = cpl_slist_pop(&slab->list);
+    ++slab->nInUse;
+    --slab->nFree;
+    cpl_counters_alloc(&pPoolAllocator->counters, sz, pPoolAllocator->chunkSize);
+    
+    if(!slab->nFree)
+    {
+        cpl_dlist_del(&slab->link);
+        cpl_dlist_add_tail(&slab->link, &pPoolAllocator->full);
+    }
+    return ptr;
+}
+
+static size_t cpl_growable_pool_malloc_batch(struct cpl_allocator* pAllocator, size_t sz, size_t n, void** ptrs)
+{
+    struct cpl_growable_pool_allocator* pPoolAllocator = (struct cpl_growable_pool_allocator *)pAllocator;
+    assert(sz == pPoolAllocator->chunkSize);
+    
+    size_t count = 0;
+    struct pool_slab* slab;
+    while(count < n && (slab = pool_current_slab(pPoolAllocator)))
+    {
+        size_t taken = pool_detach_run(&slab->list, n - count, ptrs + count);
+        slab->nInUse += (int)taken;
+        slab->nFree -= (int)taken;
+        count += taken;
+        if(!slab->nFree)
+        {
+            cpl_dlist_del(&slab->link);
+            cpl_dlist_add_tail(&slab->link, &pPoolAllocator->full);
+        }
+    }
+    
+    cpl_counters_alloc_n(&pPoolAllocator->counters, sz, count * pPoolAllocator->chunkSize, count);
+    return count;
+}
+
+static void cpl_growable_pool_free(struct cpl_allocator* pAllocator, void* ptr)
+{
+    struct cpl_growable_pool_allocator* pPoolAllocator = (struct cpl_growable_pool_allocator *)pAllocator;
+    if(!ptr)
+    {
+        return ;
+    }
+    
+    struct pool_slab* slab = pool_ptr2slab(pPoolAllocator, ptr);
+    assert(slab->nInUse > 0);
+    
+    cpl_slist_add(&slab->list, ptr);
+    --slab->nInUse;
+    ++slab->nFree;
+    cpl_counters_free(&pPoolAllocator->counters, pPoolAllocator->chunkSize);
+    
+    if(slab->nInUse == 0)
+    {
+        cpl_dlist_del(&slab->link);
+        if(pPoolAllocator->nEmptySlabs >= pPoolAllocator->nMaxEmptySlabs)
+        {
+            /* past the threshold, give the slab back to the OS */
+            int rc = munmap(slab, pPoolAllocator->slabSize);
+            assert(rc == 0);
+            pPoolAllocator->counters.mapped -= pPoolAllocator->slabSize;
+        }
+        else
+        {
+            cpl_dlist_add_tail(&slab->link, &pPoolAllocator->empty);
+            ++pPoolAllocator->nEmptySlabs;
+        }
+    }
+    else if(slab->nFree == 1)
+    {
+        /* was full */
+        cpl_dlist_del(&slab->link);
+        cpl_dlist_add_tail(&slab->link, &pPoolAllocator->partial);
+    }
+}
+
+static void cpl_growable_pool_free_batch(struct cpl_allocator* pAllocator, void** ptrs, size_t n)
+{
+    /* chunks go back to the slabs they were cut from */
+    for(size_t i = 0; i < n; ++i)
+    {
+        cpl_growable_pool_free(pAllocator, ptrs[i]);
+    }
+}
+
+static void* cpl_growable_pool_realloc(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
+{
+    struct cpl_growable_pool_allocator* pPoolAllocator = (struct cpl_growable_pool_allocator *)pAllocator;
+    assert(sz == pPoolAllocator->chunkSize);
+    
+    /* all chunks are of the same size */
+    return ptr?ptr:cpl_growable_pool_malloc(pAllocator, sz);
+}
+
+static void* cpl_growable_pool_malloc_aligned(struct cpl_allocator* pAllocator, size_t sz, size_t align)
+{
+    struct cpl_growable_pool_allocator* pPoolAllocator = (struct cpl_growable_pool_allocator *)pAllocator;
+    return (align <= pool_alignment(pPoolAllocator->chunkSize, POOL_SLAB_HEADER))?cpl_growable_pool_malloc(pAllocator, sz):0;
+}
+
+static void* cpl_growable_pool_realloc_aligned(struct cpl_allocator* pAllocator, void* ptr, size_t sz, size_t align)
+{
+    struct cpl_growable_pool_allocator* pPoolAllocator = (struct cpl_growable_pool_allocator *)pAllocator;
+    return (align <= pool_alignment(pPoolAllocator->chunkSize, POOL_SLAB_HEADER))?cpl_growable_pool_realloc(pAllocator, ptr, sz):0;
+}
+
+static size_t cpl_growable_pool_usable_size(struct cpl_allocator* pAllocator, void* ptr)
+{
+    return ((struct cpl_growable_pool_allocator *)pAllocator)->chunkSize;
+}
+
+static void cpl_growable_pool_stats(struct cpl_allocator* pAllocator, cpl_allocator_stats_t* stats)
+{
+    struct cpl_growable_pool_allocator* pPoolAllocator = (struct cpl_growable_pool_allocator *)pAllocator;
+    cpl_counters_collect(&pPoolAllocator->counters, stats);
+}
+
+static void pool_unmap_slabs(struct cpl_growable_pool_allocator* pPoolAllocator, cpl_dlist_t* head)
+{
+    while(!cpl_dlist_empty(head))
+    {
+        struct pool_slab* slab = cpl_dlist_entry(head->next, struct pool_slab, link);
+        cpl_dlist_del(&slab->link);
+        int rc = munmap(slab, pPoolAllocator->slabSize);
+        assert(rc == 0);
+    }
+}
+
+static size_t cpl_growable_pool_trim(struct cpl_allocator* pAllocator, size_t pad)
+{
+    struct cpl_growable_pool_allocator* pPoolAllocator = (struct cpl_growable_pool_allocator *)pAllocator;
+    size_t released = (size_t)pPoolAllocator->nEmptySlabs * pPoolAllocator->slabSize;
+    
+    pool_unmap_slabs(pPoolAllocator, &pPoolAllocator->empty);
+    pPoolAllocator->nEmptySlabs = 0;
+    pPoolAllocator->counters.mapped -= released;
+    return released;
+}
+
 /******************** Public Pool Allocator routines  *************************/
 cpl_allocator_ref cpl_allocator_create_pool(size_t chunkSize, int nChunks)
+{
+    return cpl_allocator_create_pool_ex(chunkSize, nChunks, 0);
+}
+
+cpl_allocator_ref cpl_allocator_create_pool_ex(size_t chunkSize, int nChunks, unsigned flags)
 {
     assert(chunkSize < 8192 && chunkSize > 16);
     
-    size_t poolSize = chunkSize * nChunks;
-    void* poolBuffer = mmap(0, poolSize + sizeof(struct cpl_pool_allocator), PROT_READ|PROT_WRITE,
-                            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    /* keep the allocator struct that follows the chunks aligned */
+    size_t poolSize = (chunkSize * nChunks + sizeof(int64_t) - 1) & ~(sizeof(int64_t) - 1);
+    size_t mapSize = poolSize + sizeof(struct cpl_pool_allocator);
+    void* poolBuffer = cpl_allocator_map(&mapSize, flags);
     
     if(poolBuffer == MAP_FAILED)
     {
@@ -98,24 +600,132 @@ cpl_allocator_ref cpl_allocator_create_pool(size_t chunkSize, int nChunks)
     poolAllocator->xAllocate = cpl_pool_malloc;
     poolAllocator->xRealloc = cpl_pool_realloc;
     poolAllocator->xFree = cpl_pool_free;
+    poolAllocator->xStats = cpl_pool_stats;
+    poolAllocator->xTrim = 0;
+    poolAllocator->xAllocateAligned = cpl_pool_malloc_aligned;
+    poolAllocator->xReallocAligned = cpl_pool_realloc_aligned;
+    poolAllocator->xUsableSize = cpl_pool_usable_size;
+    poolAllocator->xTryExpand = 0;
+    poolAllocator->xAllocateBatch = cpl_pool_malloc_batch;
+    poolAllocator->xFreeBatch = cpl_pool_free_batch;
     poolAllocator->pool = poolBuffer;
     poolAllocator->poolSize = poolSize;
+    poolAllocator->mapSize = mapSize;
     poolAllocator->chunkSize = chunkSize;
+    poolAllocator->alignment = pool_alignment(chunkSize, POOL_PAGE_SIZE);
     poolAllocator->nChunks = nChunks;
-    CPL_SLIST_INIT(poolAllocator->list);
+    poolAllocator->head = 0;
+    memset(&poolAllocator->freelist, 0, sizeof(poolAllocator->freelist));
     
     for (int i = nChunks-1; i >= 0; --i)
     {
-        cpl_slist_add(&poolAllocator->list, (cpl_slist_ref)((char*)poolBuffer + i*chunkSize));
+        cpl_slist_add(&poolAllocator->freelist.list, (cpl_slist_ref)((char*)poolBuffer + i*chunkSize));
     }
     
     return (cpl_allocator_ref)poolAllocator;
 }
 
+cpl_allocator_ref cpl_allocator_create_pool_lockfree(size_t chunkSize, int nChunks)
+{
+    assert(chunkSize < 8192 && chunkSize > 16);
+    
+    struct cpl_pool_allocator* poolAllocator =
+        (struct cpl_pool_allocator *)cpl_allocator_create_pool(chunkSize, nChunks);
+    if(!poolAllocator)
+    {
+        return 0;
+    }
+    
+    poolAllocator->xAllocate = cpl_pool_lockfree_malloc;
+    poolAllocator->xRealloc = cpl_pool_lockfree_realloc;
+    poolAllocator->xFree = cpl_pool_lockfree_free;
+    poolAllocator->xAllocateBatch = cpl_pool_lockfree_malloc_batch;
+    poolAllocator->xFreeBatch = cpl_pool_lockfree_free_batch;
+    if(!cpl_stats_shards_init(&poolAllocator->shards))
+    {
+        cpl_allocator_destroy_pool((cpl_allocator_ref)poolAllocator);
+        return 0;
+    }
+    poolAllocator->xStats = cpl_pool_lockfree_stats;
+    
+    /* thread the chunks by index instead of the single-threaded list */
+    CPL_SLIST_INIT(poolAllocator->freelist.list);
+    for (int i = 0; i < nChunks; ++i)
+    {
+        *pool_index2chunk(poolAllocator, i + 1) = (i + 1 < nChunks)?(uint32_t)(i + 2):0;
+    }
+    poolAllocator->head = pool_make_head(0, nChunks > 0 ? 1 : 0);
+    
+    return (cpl_allocator_ref)poolAllocator;
+}
+
+cpl_pool_ref cpl_allocator_get_pool(cpl_allocator_ref allocator)
+{
+    /* the lock-free pool keeps its chunks in another list */
+    return (allocator->xAllocate == cpl_pool_malloc)?&((struct cpl_pool_allocator *)allocator)->freelist:0;
+}
+
 void cpl_allocator_destroy_pool(cpl_allocator_ref allocator)
 {
     assert(allocator != cpl_allocator_get_default());
     struct cpl_pool_allocator* pPoolAllocator = (struct cpl_pool_allocator *)allocator;
-    int rc = munmap(pPoolAllocator->pool, pPoolAllocator->poolSize + sizeof(struct cpl_pool_allocator));
+    if(pPoolAllocator->xStats == cpl_pool_lockfree_stats)
+    {
+        cpl_stats_shards_destroy(&pPoolAllocator->shards);
+    }
+    int rc = munmap(pPoolAllocator->pool, pPoolAllocator->mapSize);
     assert(rc == 0);
 }
+
+cpl_allocator_ref cpl_allocator_create_pool_growable(size_t chunkSize, int nChunksPerSlab, int nMaxEmptySlabs)
+{
+    assert(chunkSize < 8192 && chunkSize > 16);
+    assert(nChunksPerSlab > 0 && nMaxEmptySlabs >= 0);
+    
+    struct cpl_growable_pool_allocator* poolAllocator = malloc(sizeof(struct cpl_growable_pool_allocator));
+    if(!poolAllocator)
+    {
+        return 0;
+    }
+    
+    /* round slabs up to a power of two number of pages */
+    size_t slabSize = 0x1000;
+    while(slabSize < POOL_SLAB_HEADER + chunkSize * nChunksPerSlab)
+    {
+        slabSize <<= 1;
+    }
+    
+    poolAllocator->xAllocate = cpl_growable_pool_malloc;
+    poolAllocator->xRealloc = cpl_growable_pool_realloc;
+    poolAllocator->xFree = cpl_growable_pool_free;
+    poolAllocator->xStats = cpl_growable_pool_stats;
+    poolAllocator->xTrim = cpl_growable_pool_trim;
+    poolAllocator->xAllocateAligned = cpl_growable_pool_malloc_aligned;
+    poolAllocator->xReallocAligned = cpl_growable_pool_realloc_aligned;
+    poolAllocator->xUsableSize = cpl_growable_pool_usable_size;
+    poolAllocator->xTryExpand = 0;
+    poolAllocator->xAllocateBatch = cpl_growable_pool_malloc_batch;
+    poolAllocator->xFreeBatch = cpl_growable_pool_free_batch;
+    poolAllocator->chunkSize = chunkSize;
+    poolAllocator->slabSize = slabSize;
+    poolAllocator->nChunksPerSlab = (int)((slabSize - POOL_SLAB_HEADER) / chunkSize);
+    poolAllocator->nMaxEmptySlabs = nMaxEmptySlabs;
+    poolAllocator->nEmptySlabs = 0;
+    memset(&poolAllocator->counters, 0, sizeof(poolAllocator->counters));
+    poolAllocator->partial.next = poolAllocator->partial.prev = &poolAllocator->partial;
+    poolAllocator->empty.next = poolAllocator->empty.prev = &poolAllocator->empty;
+    poolAllocator->full.next = poolAllocator->full.prev = &poolAllocator->full;
+    
+    return (cpl_allocator_ref)poolAllocator;
+}
+
+void cpl_allocator_destroy_pool_growable(cpl_allocator_ref allocator)
+{
+    assert(allocator != cpl_allocator_get_default());
+    struct cpl_growable_pool_allocator* pPoolAllocator = (struct cpl_growable_pool_allocator *)allocator;
+    
+    pool_unmap_slabs(pPoolAllocator, &pPoolAllocator->partial);
+    pool_unmap_slabs(pPoolAllocator, &pPoolAllocator->empty);
+    pool_unmap_slabs(pPoolAllocator, &pPoolAllocator->full);
+    free(pPoolAllocator);
+}
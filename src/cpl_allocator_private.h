@@ -0,0 +1,166 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * C Primitives Library. Allocator internals shared by implementations.
+ */
+
+#ifndef _CPL_ALLOCATOR_PRIVATE_H_
+#define _CPL_ALLOCATOR_PRIVATE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "cpl_allocator.h"
+#include "cpl_list.h"
+
+/**
+ * Routines of an allocator. Every allocator struct starts with these members,
+ * so that it can be used through cpl_allocator_ref. Optional routines may be
+ * left null.
+ */
+#define CPL_ALLOCATOR_INTERFACE                                                 \
+    void* (*xAllocate)(struct cpl_allocator*, size_t);                          \
+    void* (*xRealloc)(struct cpl_allocator*, void* ptr, size_t);                \
+    void  (*xFree)(struct cpl_allocator*, void* ptr);                           \
+    /* optional */                                                              \
+    void  (*xStats)(struct cpl_allocator*, cpl_allocator_stats_t*);             \
+    size_t (*xTrim)(struct cpl_allocator*, size_t pad);                         \
+    void* (*xAllocateAligned)(struct cpl_allocator*, size_t, size_t align);     \
+    void* (*xReallocAligned)(struct cpl_allocator*, void* ptr, size_t, size_t align); \
+    size_t (*xUsableSize)(struct cpl_allocator*, void* ptr);                    \
+    int   (*xTryExpand)(struct cpl_allocator*, void* ptr, size_t);                \
+    size_t (*xAllocateBatch)(struct cpl_allocator*, size_t, size_t n, void** ptrs); \
+    void  (*xFreeBatch)(struct cpl_allocator*, void** ptrs, size_t n);
+
+struct cpl_allocator
+{
+    CPL_ALLOCATOR_INTERFACE
+};
+
+/**
+ * Maps _*size_ bytes of anonymous memory as CPL_ALLOCATOR_MAP_* _flags_ ask.
+ * The size is rounded up when huge pages are mapped. Returns MAP_FAILED if
+ * mapping or locking the pages fails. Unmapped with munmap().
+ */
+void* cpl_allocator_map(size_t* size, unsigned flags);
+
+/**
+ * Counters behind cpl_allocator_stats_t. Sizes are those of chunks handed out,
+ * not of requests.
+ */
+struct cpl_allocator_counters
+{
+    size_t      live;
+    size_t      peak;
+    size_t      mapped;
+    uint64_t    nallocs;
+    uint64_t    nfrees;
+    uint64_t    histogram[CPL_ALLOCATOR_STATS_NBUCKETS];
+};
+
+static inline unsigned cpl_stats_bucket(size_t sz)
+{
+    if(sz <= 16)
+    {
+        return 0;
+    }
+    
+    unsigned bucket = (unsigned)(sizeof(long) * 8 - __builtin_clzl((unsigned long)(sz - 1))) - 4;
+    return (bucket < CPL_ALLOCATOR_STATS_NBUCKETS)?bucket:CPL_ALLOCATOR_STATS_NBUCKETS - 1;
+}
+
+static inline void cpl_counters_alloc(struct cpl_allocator_counters* c, size_t sz, size_t chunk)
+{
+    ++c->nallocs;
+    ++c->histogram[cpl_stats_bucket(sz)];
+    c->live += chunk;
+    if(c->live > c->peak)
+    {
+        c->peak = c->live;
+    }
+}
+
+static inline void cpl_counters_free(struct cpl_allocator_counters* c, size_t chunk)
+{
+    ++c->nfrees;
+    c->live -= chunk;
+}
+
+/* _n_ chunks of _chunks_ bytes in total at once */
+static inline void cpl_counters_alloc_n(struct cpl_allocator_counters* c, size_t sz, size_t chunks, size_t n)
+{
+    c->nallocs += n;
+    c->histogram[cpl_stats_bucket(sz)] += n;
+    c->live += chunks;
+    if(c->live > c->peak)
+    {
+        c->peak = c->live;
+    }
+}
+
+static inline void cpl_counters_free_n(struct cpl_allocator_counters* c, size_t chunks, size_t n)
+{
+    c->nfrees += n;
+    c->live -= chunks;
+}
+
+static inline void cpl_counters_resize(struct cpl_allocator_counters* c, size_t old_chunk, size_t new_chunk)
+{
+    c->live += new_chunk - old_chunk;
+    if(c->live > c->peak)
+    {
+        c->peak = c->live;
+    }
+}
+
+/**
+ * Adds counters to a snapshot.
+ */
+void cpl_counters_collect(const struct cpl_allocator_counters* c, cpl_allocator_stats_t* stats);
+
+/**
+ * Per-thread counters of thread-safe allocators. Every thread updates its own
+ * shard without synchronization; a snapshot sums all shards. Chunks may be
+ * freed by another thread than the one allocated them, so a single shard may
+ * wrap below zero, the sum is still right. The peak is sampled at snapshots.
+ */
+struct cpl_stats_shards
+{
+    pthread_key_t   key;
+    pthread_mutex_t lock;
+    cpl_dlist_t     shards;
+    struct cpl_allocator_counters retired;  /* of exited threads */
+    size_t          peak;
+};
+
+int cpl_stats_shards_init(struct cpl_stats_shards* shards);
+void cpl_stats_shards_destroy(struct cpl_stats_shards* shards);
+void cpl_stats_shards_collect(struct cpl_stats_shards* shards, cpl_allocator_stats_t* stats);
+
+/**
+ * Returns counters of the calling thread, or a dummy when out of memory.
+ */
+struct cpl_allocator_counters* cpl_stats_shards_local(struct cpl_stats_shards* shards);
+
+#endif // _CPL_ALLOCATOR_PRIVATE_H_
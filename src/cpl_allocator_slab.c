@@ -0,0 +1,852 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#if defined(__linux__)
+#   define _GNU_SOURCE          /* mremap */
+#endif
+
+#include "cpl_allocator_private.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "cpl_list.h"
+
+#ifndef MAP_ANONYMOUS
+#   ifdef MAP_ANON
+#       define MAP_ANONYMOUS MAP_ANON
+#   endif
+#endif
+
+/********************** Slab Allocator Implementation *************************/
+
+/*
+ * Objects of every size class live in slabs, like chunks of the growable pool.
+ * Slabs are aligned to SLAB_SIZE, so the slab (and class) of an object is
+ * found by masking its address. Allocations above SLAB_MAX_SIZE get their own
+ * aligned mapping with the same header. Such mappings grow by remapping their
+ * pages where mremap() is available, and a few freed ones are kept for reuse.
+ *
+ * Objects are cached in magazines (Bonwick & Adams, 2001). Every thread owns
+ * a loaded and a previous magazine for each class and exchanges full and empty
+ * magazines with the per-class depot. Only the depot and the slab layer are
+ * locked. User space cannot tell which CPU it runs on, so the magazines that
+ * the paper keeps per CPU are kept per thread here.
+ */
+#define SLAB_SIZE               ((size_t)0x10000)
+#define SLAB_MAX_SIZE           ((size_t)8192)
+#define SLAB_NCLASSES           (32U)
+#define SLAB_LARGE_CLASS        (SLAB_NCLASSES)
+#define SLAB_MAGAZINE_SIZE      (32U)
+#define SLAB_MAX_EMPTY_SLABS    (1)
+#define SLAB_LARGE_CACHE        (4U)                /* freed large mappings kept */
+#define SLAB_LARGE_CACHE_MAX    ((size_t)0x400000)  /* largest mapping to keep */
+
+struct slab
+{
+    cpl_dlist_t link;
+    cpl_slist_t list;       /* free objects */
+    int         nInUse;
+    int         nFree;
+    unsigned    cls;
+    size_t      size;       /* size of the mapping */
+};
+
+#define SLAB_HEADER             ((sizeof(struct slab) + 15) & ~(size_t)15)
+#define slab_ptr2slab(ptr)      ((struct slab *)((size_t)(ptr) & ~(SLAB_SIZE - 1)))
+
+struct slab_magazine
+{
+    struct slab_magazine* next;
+    unsigned    nRounds;
+    void*       rounds[SLAB_MAGAZINE_SIZE];
+};
+
+struct slab_class
+{
+    pthread_mutex_t lock;
+    size_t      size;
+    unsigned    nMagRounds;         /* magazine capacity for this class */
+    int         nObjects;           /* objects per slab */
+    /* slab layer */
+    int         nSlabs;
+    int         nEmptySlabs;
+    cpl_dlist_t partial;
+    cpl_dlist_t empty;
+    cpl_dlist_t full;
+    /* depot */
+    struct slab_magazine* fullMags;
+    struct slab_magazine* emptyMags;
+} __attribute__((aligned(64)));
+
+struct slab_cpu_cache
+{
+    struct
+    {
+        struct slab_magazine* loaded;
+        struct slab_magazine* previous;
+    } mags[SLAB_NCLASSES];
+    struct cpl_slab_allocator* owner;
+    cpl_dlist_t link;
+};
+
+struct cpl_slab_allocator
+{
+    /* struct cpl_allocator */
+    CPL_ALLOCATOR_INTERFACE
+    
+    /* slab-specific data */
+    pthread_key_t   key;
+    pthread_mutex_t lock;           /* guards caches */
+    cpl_dlist_t     caches;
+    struct cpl_stats_shards shards; /* mapped counts large objects only */
+    pthread_mutex_t largeLock;      /* guards large */
+    struct slab*    large[SLAB_LARGE_CACHE];
+    unsigned        nLarge;
+    uint8_t         size2class[SLAB_MAX_SIZE >> 4];
+    struct slab_class classes[SLAB_NCLASSES];
+};
+
+static inline void slab_init_list(cpl_dlist_t* head)
+{
+    head->next = head->prev = head;
+}
+
+static void* slab_map_aligned(size_t sz)
+{
+    /* over-map and cut the unaligned ends off */
+    char* addr = mmap(0, sz + SLAB_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED)
+    {
+        return 0;
+    }
+    
+    char* aligned = (char *)(((size_t)addr + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1));
+    if(aligned != addr)
+    {
+        munmap(addr, aligned - addr);
+    }
+    munmap(aligned + sz, addr + SLAB_SIZE - aligned);
+    
+    return aligned;
+}
+
+/******************************* Slab layer ***********************************/
+
+static struct slab* slab_create(struct slab_class* cls, unsigned idx)
+{
+    struct slab* slab = slab_map_aligned(SLAB_SIZE);
+    if(!slab)
+    {
+        return 0;
+    }
+    
+    CPL_SLIST_INIT(slab->list);
+    slab->nInUse = 0;
+    slab->nFree = cls->nObjects;
+    slab->cls = idx;
+    slab->size = SLAB_SIZE;
+    
+    char* objects = (char *)slab + SLAB_HEADER;
+    for (int i = cls->nObjects-1; i >= 0; --i)
+    {
+        cpl_slist_add(&slab->list, (cpl_slist_ref)(objects + i*cls->size));
+    }
+    
+    return slab;
+}
+
+/*
+ * Takes an object from the slab layer. The slab allocated from stays at the
+ * head of the partial list until it fills up. Must be called with the class
+ * lock held.
+ */
+static void* slab_alloc_object(struct slab_class* cls, unsigned idx)
+{
+    struct slab* slab;
+    if(!cpl_dlist_empty(&cls->partial))
+    {
+        slab = cpl_dlist_entry(cls->partial.next, struct slab, link);
+    }
+    else
+    {
+        if(!cpl_dlist_empty(&cls->empty))
+        {
+            slab = cpl_dlist_entry(cls->empty.next, struct slab, link);
+            cpl_dlist_del(&slab->link);
+            --cls->nEmptySlabs;
+        }
+        else if(!(slab = slab_create(cls, idx)))
+        {
+            return 0;
+        }
+        else
+        {
+            ++cls->nSlabs;
+        }
+        cpl_dlist_add(&slab->link, &cls->partial);
+    }
+    
+    void* ptr = cpl_slist_pop(&slab->list);
+    ++slab->nInUse;
+    --slab->nFree;
+    
+    if(!slab->nFree)
+    {
+        cpl_dlist_del(&slab->link);
+        cpl_dlist_add_tail(&slab->link, &cls->full);
+    }
+    return ptr;
+}
+
+/*
+ * Returns an object to its slab. Must be called with the class lock held.
+ */
+static void slab_free_object(struct slab_class* cls, void* ptr)
+{
+    struct slab* slab = slab_ptr2slab(ptr);
+    assert(slab->nInUse > 0);
+    
+    cpl_slist_add(&slab->list, ptr);
+    --slab->nInUse;
+    ++slab->nFree;
+    
+    if(slab->nInUse == 0)
+    {
+        cpl_dlist_del(&slab->link);
+        if(cls->nEmptySlabs >= SLAB_MAX_EMPTY_SLABS)
+        {
+            int rc = munmap(slab, SLAB_SIZE);
+            assert(rc == 0);
+            --cls->nSlabs;
+        }
+        else
+        {
+            cpl_dlist_add_tail(&slab->link, &cls->empty);
+            ++cls->nEmptySlabs;
+        }
+    }
+    else if(slab->nFree == 1)
+    {
+        /* was full */
+        cpl_dlist_del(&slab->link);
+        cpl_dlist_add_tail(&slab->link, &cls->partial);
+    }
+}
+
+static void slab_unmap_list(cpl_dlist_t* head)
+{
+    while(!cpl_dlist_empty(head))
+    {
+        struct slab* slab = cpl_dlist_entry(head->next, struct slab, link);
+        cpl_dlist_del(&slab->link);
+        int rc = munmap(slab, SLAB_SIZE);
+        assert(rc == 0);
+    }
+}
+
+/**************************** Magazine layer **********************************/
+
+/*
+ * Empties a magazine into the slab layer. Must be called with the class lock held.
+ */
+static void slab_magazine_drain(struct slab_class* cls, struct slab_magazine* mag)
+{
+    while(mag->nRounds)
+    {
+        slab_free_object(cls, mag->rounds[--mag->nRounds]);
+    }
+}
+
+static void slab_free_magazines(struct slab_magazine* mag)
+{
+    while(mag)
+    {
+        struct slab_magazine* next = mag->next;
+        free(mag);
+        mag = next;
+    }
+}
+
+static void slab_release_cache(struct cpl_slab_allocator* pSlabAllocator, struct slab_cpu_cache* cache)
+{
+    for(unsigned i = 0; i < SLAB_NCLASSES; ++i)
+    {
+        struct slab_class* cls = &pSlabAllocator->classes[i];
+        struct slab_magazine* loaded = cache->mags[i].loaded;
+        struct slab_magazine* previous = cache->mags[i].previous;
+        
+        pthread_mutex_lock(&cls->lock);
+        if(loaded)
+        {
+            slab_magazine_drain(cls, loaded);
+        }
+        if(previous)
+        {
+            slab_magazine_drain(cls, previous);
+        }
+        pthread_mutex_unlock(&cls->lock);
+        
+        free(loaded);
+        free(previous);
+    }
+    cpl_dlist_del(&cache->link);
+    free(cache);
+}
+
+static void slab_thread_exit(void* arg)
+{
+    struct slab_cpu_cache* cache = (struct slab_cpu_cache *)arg;
+    struct cpl_slab_allocator* pSlabAllocator = cache->owner;
+    
+    pthread_mutex_lock(&pSlabAllocator->lock);
+    slab_release_cache(pSlabAllocator, cache);
+    pthread_mutex_unlock(&pSlabAllocator->lock);
+}
+
+static struct slab_cpu_cache* slab_get_cache(struct cpl_slab_allocator* pSlabAllocator)
+{
+    struct slab_cpu_cache* cache = pthread_getspecific(pSlabAllocator->key);
+    if(cache)
+    {
+        return cache;
+    }
+    
+    cache = calloc(1, sizeof(struct slab_cpu_cache));
+    if(!cache)
+    {
+        return 0;
+    }
+    cache->owner = pSlabAllocator;
+    
+    pthread_mutex_lock(&pSlabAllocator->lock);
+    cpl_dlist_add_tail(&cache->link, &pSlabAllocator->caches);
+    pthread_mutex_unlock(&pSlabAllocator->lock);
+    
+    pthread_setspecific(pSlabAllocator->key, cache);
+    return cache;
+}
+
+static void* slab_cache_alloc(struct cpl_slab_allocator* pSlabAllocator, unsigned idx)
+{
+    struct slab_class* cls = &pSlabAllocator->classes[idx];
+    struct slab_cpu_cache* cache = slab_get_cache(pSlabAllocator);
+    if(!cache)
+    {
+        pthread_mutex_lock(&cls->lock);
+        void* ptr = slab_alloc_object(cls, idx);
+        pthread_mutex_unlock(&cls->lock);
+        return ptr;
+    }
+    
+    struct slab_magazine** loaded = &cache->mags[idx].loaded;
+    struct slab_magazine** previous = &cache->mags[idx].previous;
+    
+    if(*loaded && (*loaded)->nRounds)
+    {
+        return (*loaded)->rounds[--(*loaded)->nRounds];
+    }
+    
+    if(*previous && (*previous)->nRounds)
+    {
+        struct slab_magazine* tmp = *loaded;
+        *loaded = *previous;
+        *previous = tmp;
+        return (*loaded)->rounds[--(*loaded)->nRounds];
+    }
+    
+    pthread_mutex_lock(&cls->lock);
+    if(cls->fullMags)
+    {
+        /* exchange an empty magazine for a full one from the depot */
+        struct slab_magazine* mag = cls->fullMags;
+        cls->fullMags = mag->next;
+        if(*previous)
+        {
+            (*previous)->next = cls->emptyMags;
+            cls->emptyMags = *previous;
+        }
+        *previous = *loaded;
+        *loaded = mag;
+        pthread_mutex_unlock(&cls->lock);
+        return mag->rounds[--mag->nRounds];
+    }
+    
+    void* ptr = slab_alloc_object(cls, idx);
+    pthread_mutex_unlock(&cls->lock);
+    return ptr;
+}
+
+static void slab_cache_free(struct cpl_slab_allocator* pSlabAllocator, unsigned idx, void* ptr)
+{
+    struct slab_class* cls = &pSlabAllocator->classes[idx];
+    struct slab_cpu_cache* cache = slab_get_cache(pSlabAllocator);
+    if(!cache)
+    {
+        goto Lslab;
+    }
+    
+    struct slab_magazine** loaded = &cache->mags[idx].loaded;
+    struct slab_magazine** previous = &cache->mags[idx].previous;
+    
+    if(*loaded && (*loaded)->nRounds < cls->nMagRounds)
+    {
+        (*loaded)->rounds[(*loaded)->nRounds++] = ptr;
+        return ;
+    }
+    
+    if(*previous && (*previous)->nRounds == 0)
+    {
+        struct slab_magazine* tmp = *loaded;
+        *loaded = *previous;
+        *previous = tmp;
+        (*loaded)->rounds[(*loaded)->nRounds++] = ptr;
+        return ;
+    }
+    
+    pthread_mutex_lock(&cls->lock);
+    struct slab_magazine* mag = cls->emptyMags;
+    if(mag)
+    {
+        cls->emptyMags = mag->next;
+    }
+    pthread_mutex_unlock(&cls->lock);
+    
+    if(!mag && (mag = malloc(sizeof(struct slab_magazine))) != 0)
+    {
+        mag->nRounds = 0;
+    }
+    
+    if(mag)
+    {
+        /* exchange a full magazine for an empty one */
+        pthread_mutex_lock(&cls->lock);
+        if(*previous)
+        {
+            (*previous)->next = cls->fullMags;
+            cls->fullMags = *previous;
+        }
+        pthread_mutex_unlock(&cls->lock);
+        
+        *previous = *loaded;
+        *loaded = mag;
+        mag->rounds[mag->nRounds++] = ptr;
+        return ;
+    }
+    
+Lslab:
+    pthread_mutex_lock(&cls->lock);
+    slab_free_object(cls, ptr);
+    pthread_mutex_unlock(&cls->lock);
+}
+
+/***************************** Allocator routines *****************************/
+
+/*
+ * Takes the smallest cached mapping of at least _size_ bytes, or returns 0.
+ */
+static struct slab* slab_large_take(struct cpl_slab_allocator* pSlabAllocator, size_t size)
+{
+    struct slab* slab = 0;
+    unsigned idx = 0;
+    
+    pthread_mutex_lock(&pSlabAllocator->largeLock);
+    for(unsigned i = 0; i < pSlabAllocator->nLarge; ++i)
+    {
+        struct slab* cached = pSlabAllocator->large[i];
+        if(cached->size >= size && (!slab || cached->size < slab->size))
+        {
+            slab = cached;
+            idx = i;
+        }
+    }
+    if(slab)
+    {
+        pSlabAllocator->large[idx] = pSlabAllocator->large[--pSlabAllocator->nLarge];
+    }
+    pthread_mutex_unlock(&pSlabAllocator->largeLock);
+    return slab;
+}
+
+/*
+ * Keeps a freed mapping for reuse. Returns 0 if it is too big or the cache is full.
+ */
+static int slab_large_put(struct cpl_slab_allocator* pSlabAllocator, struct slab* slab)
+{
+    int kept = 0;
+    if(slab->size <= SLAB_LARGE_CACHE_MAX)
+    {
+        pthread_mutex_lock(&pSlabAllocator->largeLock);
+        if(pSlabAllocator->nLarge < SLAB_LARGE_CACHE)
+        {
+            pSlabAllocator->large[pSlabAllocator->nLarge++] = slab;
+            kept = 1;
+        }
+        pthread_mutex_unlock(&pSlabAllocator->largeLock);
+    }
+    return kept;
+}
+
+static void* slab_large_alloc(struct cpl_slab_allocator* pSlabAllocator, size_t sz)
+{
+    if(sz > (size_t)-1 - SLAB_HEADER - 0xfff)
+    {
+        return 0;
+    }
+    
+    size_t size = (SLAB_HEADER + sz + 0xfff) & ~(size_t)0xfff;
+    struct cpl_allocator_counters* counters = cpl_stats_shards_local(&pSlabAllocator->shards);
+    struct slab* slab = slab_large_take(pSlabAllocator, size);
+    if(!slab)
+    {
+        slab = slab_map_aligned(size);
+        if(!slab)
+        {
+            return 0;
+        }
+        slab->cls = SLAB_LARGE_CLASS;
+        slab->size = size;
+        counters->mapped += size;
+    }
+    
+    cpl_counters_alloc(counters, sz, slab->size - SLAB_HEADER);
+    return (char *)slab + SLAB_HEADER;
+}
+
+/*
+ * Grows the mapping of a large object without copying: in place if the address
+ * space past it is free, otherwise its pages move to a new aligned range.
+ * Returns the object at its new place or 0.
+ */
+static void* slab_large_grow(struct cpl_slab_allocator* pSlabAllocator, struct slab* slab, size_t sz)
+{
+#if defined(MREMAP_MAYMOVE)
+    if(sz > (size_t)-1 - SLAB_HEADER - 0xfff)
+    {
+        return 0;
+    }
+    
+    size_t size = (SLAB_HEADER + sz + 0xfff) & ~(size_t)0xfff;
+    size_t old_size = slab->size;
+    void* addr = mremap(slab, old_size, size, 0);
+    if(addr == MAP_FAILED)
+    {
+        void* range = slab_map_aligned(size);
+        if(!range)
+        {
+            return 0;
+        }
+        addr = mremap(slab, old_size, size, MREMAP_MAYMOVE | MREMAP_FIXED, range);
+        if(addr == MAP_FAILED)
+        {
+            munmap(range, size);
+            return 0;
+        }
+    }
+    
+    slab = (struct slab *)addr;
+    slab->size = size;
+    struct cpl_allocator_counters* counters = cpl_stats_shards_local(&pSlabAllocator->shards);
+    cpl_counters_resize(counters, old_size - SLAB_HEADER, size - SLAB_HEADER);
+    counters->mapped += size - old_size;
+    return (char *)slab + SLAB_HEADER;
+#else
+    (void)pSlabAllocator; (void)slab; (void)sz;
+    return 0;
+#endif
+}
+
+/*
+ * Unmaps the cached large mappings. Returns bytes released.
+ */
+static size_t slab_large_release(struct cpl_slab_allocator* pSlabAllocator)
+{
+    size_t released = 0;
+    pthread_mutex_lock(&pSlabAllocator->largeLock);
+    while(pSlabAllocator->nLarge)
+    {
+        struct slab* slab = pSlabAllocator->large[--pSlabAllocator->nLarge];
+        released += slab->size;
+        int rc = munmap(slab, slab->size);
+        assert(rc == 0);
+    }
+    pthread_mutex_unlock(&pSlabAllocator->largeLock);
+    return released;
+}
+
+static void* cpl_slab_malloc(struct cpl_allocator* pAllocator, size_t sz)
+{
+    struct cpl_slab_allocator* pSlabAllocator = (struct cpl_slab_allocator *)pAllocator;
+    if(sz > SLAB_MAX_SIZE)
+    {
+        return slab_large_alloc(pSlabAllocator, sz);
+    }
+    
+    unsigned idx = pSlabAllocator->size2class[sz ? (sz - 1) >> 4 : 0];
+    void* ptr = slab_cache_alloc(pSlabAllocator, idx);
+    if(ptr)
+    {
+        cpl_counters_alloc(cpl_stats_shards_local(&pSlabAllocator->shards), sz, pSlabAllocator->classes[idx].size);
+    }
+    return ptr;
+}
+
+static void cpl_slab_free(struct cpl_allocator* pAllocator, void* ptr)
+{
+    struct cpl_slab_allocator* pSlabAllocator = (struct cpl_slab_allocator *)pAllocator;
+    if(!ptr)
+    {
+        return ;
+    }
+    
+    struct slab* slab = slab_ptr2slab(ptr);
+    struct cpl_allocator_counters* counters = cpl_stats_shards_local(&pSlabAllocator->shards);
+    if(slab->cls == SLAB_LARGE_CLASS)
+    {
+        cpl_counters_free(counters, slab->size - SLAB_HEADER);
+        if(!slab_large_put(pSlabAllocator, slab))
+        {
+            counters->mapped -= slab->size;
+            int rc = munmap(slab, slab->size);
+            assert(rc == 0);
+        }
+        return ;
+    }
+    
+    assert(slab->cls < SLAB_NCLASSES);
+    cpl_counters_free(counters, pSlabAllocator->classes[slab->cls].size);
+    slab_cache_free(pSlabAllocator, slab->cls, ptr);
+}
+
+static void* cpl_slab_realloc(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
+{
+    struct cpl_slab_allocator* pSlabAllocator = (struct cpl_slab_allocator *)pAllocator;
+    if(!ptr)
+    {
+        return cpl_slab_malloc(pAllocator, sz);
+    }
+    
+    struct slab* slab = slab_ptr2slab(ptr);
+    size_t old_sz;
+    if(slab->cls == SLAB_LARGE_CLASS)
+    {
+        old_sz = slab->size - SLAB_HEADER;
+        if(sz <= old_sz && sz > SLAB_MAX_SIZE)
+        {
+            return ptr;
+        }
+        void* new_ptr = (sz > old_sz)?slab_large_grow(pSlabAllocator, slab, sz):0;
+        if(new_ptr)
+        {
+            return new_ptr;
+        }
+    }
+    else
+    {
+        old_sz = pSlabAllocator->classes[slab->cls].size;
+        if(sz <= old_sz && sz && pSlabAllocator->size2class[(sz - 1) >> 4] == slab->cls)
+        {
+            return ptr;
+        }
+    }
+    
+    void* new_ptr = cpl_slab_malloc(pAllocator, sz);
+    if(new_ptr)
+    {
+        memcpy(new_ptr, ptr, (sz < old_sz)?sz:old_sz);
+        cpl_slab_free(pAllocator, ptr);
+    }
+    return new_ptr;
+}
+
+static size_t cpl_slab_usable_size(struct cpl_allocator* pAllocator, void* ptr)
+{
+    struct cpl_slab_allocator* pSlabAllocator = (struct cpl_slab_allocator *)pAllocator;
+    struct slab* slab = slab_ptr2slab(ptr);
+    if(slab->cls == SLAB_LARGE_CLASS)
+    {
+        return slab->size - SLAB_HEADER;
+    }
+    
+    assert(slab->cls < SLAB_NCLASSES);
+    return pSlabAllocator->classes[slab->cls].size;
+}
+
+static size_t cpl_slab_trim(struct cpl_allocator* pAllocator, size_t pad)
+{
+    struct cpl_slab_allocator* pSlabAllocator = (struct cpl_slab_allocator *)pAllocator;
+    size_t released = slab_large_release(pSlabAllocator);
+    cpl_stats_shards_local(&pSlabAllocator->shards)->mapped -= released;
+    
+    /* the depot goes back to the slab layer, objects in the magazines of
+     * threads keep their slabs */
+    for(unsigned i = 0; i < SLAB_NCLASSES; ++i)
+    {
+        struct slab_class* cls = &pSlabAllocator->classes[i];
+        pthread_mutex_lock(&cls->lock);
+        int nSlabs = cls->nSlabs;
+        for(struct slab_magazine* mag = cls->fullMags; mag; mag = mag->next)
+        {
+            slab_magazine_drain(cls, mag);
+        }
+        struct slab_magazine* fullMags = cls->fullMags;
+        struct slab_magazine* emptyMags = cls->emptyMags;
+        cls->fullMags = cls->emptyMags = 0;
+        
+        cls->nSlabs -= cls->nEmptySlabs;
+        cls->nEmptySlabs = 0;
+        slab_unmap_list(&cls->empty);
+        released += (size_t)(nSlabs - cls->nSlabs) * SLAB_SIZE;
+        pthread_mutex_unlock(&cls->lock);
+        
+        slab_free_magazines(fullMags);
+        slab_free_magazines(emptyMags);
+    }
+    return released;
+}
+
+static void cpl_slab_stats(struct cpl_allocator* pAllocator, cpl_allocator_stats_t* stats)
+{
+    struct cpl_slab_allocator* pSlabAllocator = (struct cpl_slab_allocator *)pAllocator;
+    cpl_stats_shards_collect(&pSlabAllocator->shards, stats);
+    
+    for(unsigned i = 0; i < SLAB_NCLASSES; ++i)
+    {
+        struct slab_class* cls = &pSlabAllocator->classes[i];
+        pthread_mutex_lock(&cls->lock);
+        stats->mapped_bytes += (size_t)cls->nSlabs * SLAB_SIZE;
+        pthread_mutex_unlock(&cls->lock);
+    }
+}
+
+/********************* Public Slab Allocator routines  ************************/
+cpl_allocator_ref cpl_allocator_create_slab()
+{
+    struct cpl_slab_allocator* slabAllocator = 0;
+    if(posix_memalign((void **)&slabAllocator, 64, sizeof(struct cpl_slab_allocator)))
+    {
+        return 0;
+    }
+    
+    if(pthread_key_create(&slabAllocator->key, slab_thread_exit))
+    {
+        free(slabAllocator);
+        return 0;
+    }
+    
+    if(!cpl_stats_shards_init(&slabAllocator->shards))
+    {
+        pthread_key_delete(slabAllocator->key);
+        free(slabAllocator);
+        return 0;
+    }
+    
+    slabAllocator->xAllocate = cpl_slab_malloc;
+    slabAllocator->xRealloc = cpl_slab_realloc;
+    slabAllocator->xFree = cpl_slab_free;
+    slabAllocator->xStats = cpl_slab_stats;
+    slabAllocator->xTrim = cpl_slab_trim;
+    slabAllocator->xAllocateAligned = 0;
+    slabAllocator->xReallocAligned = 0;
+    slabAllocator->xUsableSize = cpl_slab_usable_size;
+    slabAllocator->xTryExpand = 0;
+    slabAllocator->xAllocateBatch = 0;
+    slabAllocator->xFreeBatch = 0;
+    pthread_mutex_init(&slabAllocator->lock, 0);
+    slab_init_list(&slabAllocator->caches);
+    pthread_mutex_init(&slabAllocator->largeLock, 0);
+    slabAllocator->nLarge = 0;
+    
+    /* 16 byte steps up to 128, then four classes per power of two */
+    size_t size = 16, step = 16;
+    for(unsigned i = 0; i < SLAB_NCLASSES; ++i)
+    {
+        struct slab_class* cls = &slabAllocator->classes[i];
+        pthread_mutex_init(&cls->lock, 0);
+        cls->size = size;
+        cls->nObjects = (int)((SLAB_SIZE - SLAB_HEADER) / size);
+        cls->nMagRounds = (size <= 1024)?SLAB_MAGAZINE_SIZE:SLAB_MAGAZINE_SIZE / 4;
+        cls->nSlabs = 0;
+        cls->nEmptySlabs = 0;
+        slab_init_list(&cls->partial);
+        slab_init_list(&cls->empty);
+        slab_init_list(&cls->full);
+        cls->fullMags = cls->emptyMags = 0;
+        
+        if(size >= 128 && !(size & (size - 1)))
+        {
+            step = size / 4;
+        }
+        size += step;
+    }
+    assert(slabAllocator->classes[SLAB_NCLASSES - 1].size == SLAB_MAX_SIZE);
+    
+    unsigned idx = 0;
+    for(size_t i = 0; i < (SLAB_MAX_SIZE >> 4); ++i)
+    {
+        if(((i + 1) << 4) > slabAllocator->classes[idx].size)
+        {
+            ++idx;
+        }
+        slabAllocator->size2class[i] = (uint8_t)idx;
+    }
+    
+    return (cpl_allocator_ref)slabAllocator;
+}
+
+void cpl_allocator_destroy_slab(cpl_allocator_ref allocator)
+{
+    assert(allocator != cpl_allocator_get_default());
+    struct cpl_slab_allocator* pSlabAllocator = (struct cpl_slab_allocator *)allocator;
+    
+    pthread_key_delete(pSlabAllocator->key);
+    
+    pthread_mutex_lock(&pSlabAllocator->lock);
+    while(!cpl_dlist_empty(&pSlabAllocator->caches))
+    {
+        struct slab_cpu_cache* cache = cpl_dlist_entry(pSlabAllocator->caches.next, struct slab_cpu_cache, link);
+        slab_release_cache(pSlabAllocator, cache);
+    }
+    pthread_mutex_unlock(&pSlabAllocator->lock);
+    pthread_mutex_destroy(&pSlabAllocator->lock);
+    slab_large_release(pSlabAllocator);
+    pthread_mutex_destroy(&pSlabAllocator->largeLock);
+    
+    for(unsigned i = 0; i < SLAB_NCLASSES; ++i)
+    {
+        struct slab_class* cls = &pSlabAllocator->classes[i];
+        slab_free_magazines(cls->fullMags);
+        slab_free_magazines(cls->emptyMags);
+        slab_unmap_list(&cls->partial);
+        slab_unmap_list(&cls->empty);
+        slab_unmap_list(&cls->full);
+        pthread_mutex_destroy(&cls->lock);
+    }
+    
+    cpl_stats_shards_destroy(&pSlabAllocator->shards);
+    free(pSlabAllocator);
+}
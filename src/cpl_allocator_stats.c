@@ -0,0 +1,150 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cpl_allocator_private.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/************************* Allocator Statistics *******************************/
+
+struct stats_shard
+{
+    struct cpl_allocator_counters counters;
+    struct cpl_stats_shards* owner;
+    cpl_dlist_t link;
+};
+
+static void stats_add(struct cpl_allocator_counters* to, const struct cpl_allocator_counters* from)
+{
+    to->live += from->live;
+    to->mapped += from->mapped;
+    to->nallocs += from->nallocs;
+    to->nfrees += from->nfrees;
+    for(unsigned i = 0; i < CPL_ALLOCATOR_STATS_NBUCKETS; ++i)
+    {
+        to->histogram[i] += from->histogram[i];
+    }
+}
+
+static void stats_shard_exit(void* arg)
+{
+    struct stats_shard* shard = (struct stats_shard *)arg;
+    struct cpl_stats_shards* shards = shard->owner;
+    
+    pthread_mutex_lock(&shards->lock);
+    stats_add(&shards->retired, &shard->counters);
+    cpl_dlist_del(&shard->link);
+    pthread_mutex_unlock(&shards->lock);
+    
+    free(shard);
+}
+
+void cpl_counters_collect(const struct cpl_allocator_counters* c, cpl_allocator_stats_t* stats)
+{
+    stats->live_bytes += c->live;
+    stats->peak_bytes += c->peak;
+    stats->mapped_bytes += c->mapped;
+    stats->nallocs += c->nallocs;
+    stats->nfrees += c->nfrees;
+    for(unsigned i = 0; i < CPL_ALLOCATOR_STATS_NBUCKETS; ++i)
+    {
+        stats->histogram[i] += c->histogram[i];
+    }
+}
+
+int cpl_stats_shards_init(struct cpl_stats_shards* shards)
+{
+    if(pthread_key_create(&shards->key, stats_shard_exit))
+    {
+        return 0;
+    }
+    
+    pthread_mutex_init(&shards->lock, 0);
+    shards->shards.next = shards->shards.prev = &shards->shards;
+    memset(&shards->retired, 0, sizeof(shards->retired));
+    shards->peak = 0;
+    return 1;
+}
+
+void cpl_stats_shards_destroy(struct cpl_stats_shards* shards)
+{
+    pthread_key_delete(shards->key);
+    
+    while(!cpl_dlist_empty(&shards->shards))
+    {
+        struct stats_shard* shard = cpl_dlist_entry(shards->shards.next, struct stats_shard, link);
+        cpl_dlist_del(&shard->link);
+        free(shard);
+    }
+    pthread_mutex_destroy(&shards->lock);
+}
+
+struct cpl_allocator_counters* cpl_stats_shards_local(struct cpl_stats_shards* shards)
+{
+    static struct cpl_allocator_counters dummy;
+    
+    struct stats_shard* shard = pthread_getspecific(shards->key);
+    if(shard)
+    {
+        return &shard->counters;
+    }
+    
+    shard = calloc(1, sizeof(struct stats_shard));
+    if(!shard)
+    {
+        return &dummy;
+    }
+    shard->owner = shards;
+    
+    pthread_mutex_lock(&shards->lock);
+    cpl_dlist_add_tail(&shard->link, &shards->shards);
+    pthread_mutex_unlock(&shards->lock);
+    
+    pthread_setspecific(shards->key, shard);
+    return &shard->counters;
+}
+
+void cpl_stats_shards_collect(struct cpl_stats_shards* shards, cpl_allocator_stats_t* stats)
+{
+    struct cpl_allocator_counters sum;
+    struct cpl_dlist* iter;
+    
+    pthread_mutex_lock(&shards->lock);
+    sum = shards->retired;
+    cpl_dlist_foreach(iter, &shards->shards)
+    {
+        struct stats_shard* shard = cpl_dlist_entry(iter, struct stats_shard, link);
+        stats_add(&sum, &shard->counters);
+    }
+    if(sum.live > shards->peak)
+    {
+        shards->peak = sum.live;
+    }
+    sum.peak = shards->peak;
+    pthread_mutex_unlock(&shards->lock);
+    
+    cpl_counters_collect(&sum, stats);
+}
@@ -0,0 +1,829 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cpl_allocator_private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpl_error.h"
+#include "cpl_system.h"
+
+/********************** Tracing Allocator Implementation **********************/
+
+/*
+ * A trace starts with TRACE_MAGIC followed by records of an op byte and
+ * LEB128 varints: the chunk id and, for allocations, the requested size.
+ * Chunks reuse the most recently freed id, new ids are taken only when none
+ * is free, so ids stay dense and a replay can keep chunks in a plain array.
+ * A chunk keeps its id across reallocations.
+ */
+#define TRACE_MAGIC             "CPLTRC1"
+#define TRACE_MAGIC_SIZE        8
+#define TRACE_OP_ALLOC          1
+#define TRACE_OP_REALLOC        2
+#define TRACE_OP_FREE           3
+#define TRACE_MAX_RECORD        (1 + 5 + 10)
+#define TRACE_BUFFER_SIZE       ((size_t)0x10000)
+
+#define trace_hash(p)           ((size_t)(((uint64_t)(size_t)(p) >> 4) * 0x9E3779B97F4A7C15ULL))
+
+struct trace_entry
+{
+    void*       ptr;
+    uint32_t    id;
+};
+
+struct cpl_trace_allocator
+{
+    /* struct cpl_allocator */
+    CPL_ALLOCATOR_INTERFACE
+    
+    /* trace-specific data */
+    cpl_allocator_ref   backing;
+    int                 fd;
+    int                 status;     /* the first error, recording stops */
+    pthread_mutex_t     lock;
+    /* live chunks: open addressing by address */
+    struct trace_entry* entries;
+    size_t              capacity;
+    size_t              count;
+    /* ids of freed chunks for reuse */
+    uint32_t*           freeIds;
+    size_t              nFreeIds;
+    size_t              maxFreeIds;
+    uint32_t            nextId;
+    /* records not yet written */
+    size_t              used;
+    uint8_t             buffer[TRACE_BUFFER_SIZE];
+};
+
+static int trace_write_all(int fd, const uint8_t* data, size_t sz)
+{
+    while(sz)
+    {
+        ssize_t n = write(fd, data, sz);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return _CPL_IO_ERROR;
+        }
+        data += n;
+        sz -= (size_t)n;
+    }
+    return _CPL_OK;
+}
+
+static void trace_flush(struct cpl_trace_allocator* pTrace)
+{
+    if(pTrace->used && pTrace->status == _CPL_OK)
+    {
+        pTrace->status = trace_write_all(pTrace->fd, pTrace->buffer, pTrace->used);
+    }
+    pTrace->used = 0;
+}
+
+static inline uint8_t* trace_put_varint(uint8_t* out, uint64_t v)
+{
+    while(v >= 0x80)
+    {
+        *out++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (uint8_t)v;
+    return out;
+}
+
+static void trace_record(struct cpl_trace_allocator* pTrace, int op, uint32_t id, size_t sz)
+{
+    if(TRACE_BUFFER_SIZE - pTrace->used < TRACE_MAX_RECORD)
+    {
+        trace_flush(pTrace);
+    }
+    
+    uint8_t* out = pTrace->buffer + pTrace->used;
+    *out++ = (uint8_t)op;
+    out = trace_put_varint(out, id);
+    if(op != TRACE_OP_FREE)
+    {
+        out = trace_put_varint(out, sz);
+    }
+    pTrace->used = out - pTrace->buffer;
+}
+
+/*
+ * Returns the slot of _ptr_, or the empty slot where it belongs.
+ */
+static size_t trace_lookup(struct cpl_trace_allocator* pTrace, void* ptr)
+{
+    size_t mask = pTrace->capacity - 1;
+    size_t i = trace_hash(ptr) & mask;
+    while(pTrace->entries[i].ptr && pTrace->entries[i].ptr != ptr)
+    {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static int trace_grow_entries(struct cpl_trace_allocator* pTrace)
+{
+    struct trace_entry* old = pTrace->entries;
+    size_t old_capacity = pTrace->capacity;
+    size_t capacity = old_capacity ? old_capacity * 2 : 1024;
+    
+    struct trace_entry* entries = calloc(capacity, sizeof(struct trace_entry));
+    if(!entries)
+    {
+        return 0;
+    }
+    
+    pTrace->entries = entries;
+    pTrace->capacity = capacity;
+    for(size_t i = 0; i < old_capacity; ++i)
+    {
+        if(old[i].ptr)
+        {
+            pTrace->entries[trace_lookup(pTrace, old[i].ptr)] = old[i];
+        }
+    }
+    free(old);
+    return 1;
+}
+
+static int trace_insert(struct cpl_trace_allocator* pTrace, void* ptr, uint32_t id)
+{
+    if(2 * (pTrace->count + 1) > pTrace->capacity && !trace_grow_entries(pTrace))
+    {
+        return 0;
+    }
+    
+    size_t i = trace_lookup(pTrace, ptr);
+    assert(!pTrace->entries[i].ptr);
+    pTrace->entries[i].ptr = ptr;
+    pTrace->entries[i].id = id;
+    ++pTrace->count;
+    return 1;
+}
+
+/*
+ * Removes _ptr_ and returns its id. Later entries of the probe sequence are
+ * shifted back instead of leaving tombstones.
+ */
+static uint32_t trace_remove(struct cpl_trace_allocator* pTrace, void* ptr)
+{
+    size_t mask = pTrace->capacity - 1;
+    size_t i = trace_lookup(pTrace, ptr);
+    assert(pTrace->entries[i].ptr == ptr);
+    uint32_t id = pTrace->entries[i].id;
+    
+    for(size_t j = (i + 1) & mask; pTrace->entries[j].ptr; j = (j + 1) & mask)
+    {
+        size_t home = trace_hash(pTrace->entries[j].ptr) & mask;
+        /* move the entry unless its home lies cyclically in (i, j] */
+        if((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j)))
+        {
+            pTrace->entries[i] = pTrace->entries[j];
+            i = j;
+        }
+    }
+    pTrace->entries[i].ptr = 0;
+    --pTrace->count;
+    return id;
+}
+
+static uint32_t trace_take_id(struct cpl_trace_allocator* pTrace)
+{
+    return pTrace->nFreeIds ? pTrace->freeIds[--pTrace->nFreeIds] : pTrace->nextId++;
+}
+
+static int trace_put_id(struct cpl_trace_allocator* pTrace, uint32_t id)
+{
+    if(pTrace->nFreeIds == pTrace->maxFreeIds)
+    {
+        size_t maxFreeIds = pTrace->maxFreeIds ? pTrace->maxFreeIds * 2 : 1024;
+        uint32_t* freeIds = realloc(pTrace->freeIds, maxFreeIds * sizeof(uint32_t));
+        if(!freeIds)
+        {
+            return 0;
+        }
+        pTrace->freeIds = freeIds;
+        pTrace->maxFreeIds = maxFreeIds;
+    }
+    pTrace->freeIds[pTrace->nFreeIds++] = id;
+    return 1;
+}
+
+/*
+ * Alignment is not recorded, _align_ of 0 asks for none.
+ */
+static void* trace_malloc(struct cpl_trace_allocator* pTrace, size_t sz, size_t align)
+{
+    pthread_mutex_lock(&pTrace->lock);
+    void* ptr = align ? cpl_allocator_allocate_aligned(pTrace->backing, sz, align) :
+                        cpl_allocator_allocate(pTrace->backing, sz);
+    if(ptr && pTrace->status == _CPL_OK)
+    {
+        uint32_t id = trace_take_id(pTrace);
+        if(trace_insert(pTrace, ptr, id))
+        {
+            trace_record(pTrace, TRACE_OP_ALLOC, id, sz);
+        }
+        else
+        {
+            pTrace->status = _CPL_NOMEM;
+        }
+    }
+    pthread_mutex_unlock(&pTrace->lock);
+    
+    return ptr;
+}
+
+static void* cpl_trace_malloc(struct cpl_allocator* pAllocator, size_t sz)
+{
+    return trace_malloc((struct cpl_trace_allocator *)pAllocator, sz, 0);
+}
+
+static void* cpl_trace_malloc_aligned(struct cpl_allocator* pAllocator, size_t sz, size_t align)
+{
+    return trace_malloc((struct cpl_trace_allocator *)pAllocator, sz, align);
+}
+
+static void cpl_trace_free(struct cpl_allocator* pAllocator, void* ptr)
+{
+    struct cpl_trace_allocator* pTrace = (struct cpl_trace_allocator *)pAllocator;
+    if(!ptr)
+    {
+        return ;
+    }
+    
+    pthread_mutex_lock(&pTrace->lock);
+    if(pTrace->status == _CPL_OK)
+    {
+        uint32_t id = trace_remove(pTrace, ptr);
+        trace_record(pTrace, TRACE_OP_FREE, id, 0);
+        if(!trace_put_id(pTrace, id))
+        {
+            pTrace->status = _CPL_NOMEM;
+        }
+    }
+    cpl_allocator_free(pTrace->backing, ptr);
+    pthread_mutex_unlock(&pTrace->lock);
+}
+
+static void* trace_realloc(struct cpl_trace_allocator* pTrace, void* ptr, size_t sz, size_t align)
+{
+    if(!ptr)
+    {
+        return trace_malloc(pTrace, sz, align);
+    }
+    
+    pthread_mutex_lock(&pTrace->lock);
+    void* new_ptr = align ? cpl_allocator_realloc_aligned(pTrace->backing, ptr, sz, align) :
+                            cpl_allocator_realloc(pTrace->backing, ptr, sz);
+    if(new_ptr && pTrace->status == _CPL_OK)
+    {
+        uint32_t id = trace_remove(pTrace, ptr);
+        trace_record(pTrace, TRACE_OP_REALLOC, id, sz);
+        
+        /* the entry just removed leaves room for the new one */
+        int rc = trace_insert(pTrace, new_ptr, id);
+        assert(rc);
+    }
+    else if(!new_ptr && !sz && pTrace->status == _CPL_OK)
+    {
+        /* the backing freed the chunk, as the default allocator does */
+        uint32_t id = trace_remove(pTrace, ptr);
+        trace_record(pTrace, TRACE_OP_FREE, id, 0);
+        if(!trace_put_id(pTrace, id))
+        {
+            pTrace->status = _CPL_NOMEM;
+        }
+    }
+    pthread_mutex_unlock(&pTrace->lock);
+    
+    return new_ptr;
+}
+
+static void* cpl_trace_realloc(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
+{
+    return trace_realloc((struct cpl_trace_allocator *)pAllocator, ptr, sz, 0);
+}
+
+static void* cpl_trace_realloc_aligned(struct cpl_allocator* pAllocator, void* ptr, size_t sz, size_t align)
+{
+    return trace_realloc((struct cpl_trace_allocator *)pAllocator, ptr, sz, align);
+}
+
+static size_t cpl_trace_usable_size(struct cpl_allocator* pAllocator, void* ptr)
+{
+    struct cpl_trace_allocator* pTrace = (struct cpl_trace_allocator *)pAllocator;
+    pthread_mutex_lock(&pTrace->lock);
+    size_t usable = cpl_allocator_usable_size(pTrace->backing, ptr);
+    pthread_mutex_unlock(&pTrace->lock);
+    return usable;
+}
+
+static int cpl_trace_try_expand(struct cpl_allocator* pAllocator, void* ptr, size_t sz)
+{
+    struct cpl_trace_allocator* pTrace = (struct cpl_trace_allocator *)pAllocator;
+    pthread_mutex_lock(&pTrace->lock);
+    int rc = cpl_allocator_try_expand(pTrace->backing, ptr, sz);
+    if(rc == _CPL_OK && pTrace->status == _CPL_OK)
+    {
+        /* replays as a realloc that kept the chunk */
+        uint32_t id = trace_remove(pTrace, ptr);
+        trace_record(pTrace, TRACE_OP_REALLOC, id, sz);
+        
+        int inserted = trace_insert(pTrace, ptr, id);
+        assert(inserted);
+    }
+    pthread_mutex_unlock(&pTrace->lock);
+    return rc;
+}
+
+static void cpl_trace_stats(struct cpl_allocator* pAllocator, cpl_allocator_stats_t* stats)
+{
+    struct cpl_trace_allocator* pTrace = (struct cpl_trace_allocator *)pAllocator;
+    if(pTrace->backing->xStats)
+    {
+        pthread_mutex_lock(&pTrace->lock);
+        pTrace->backing->xStats(pTrace->backing, stats);
+        pthread_mutex_unlock(&pTrace->lock);
+    }
+}
+
+static size_t cpl_trace_trim(struct cpl_allocator* pAllocator, size_t pad)
+{
+    struct cpl_trace_allocator* pTrace = (struct cpl_trace_allocator *)pAllocator;
+    pthread_mutex_lock(&pTrace->lock);
+    size_t released = cpl_allocator_trim(pTrace->backing, pad);
+    pthread_mutex_unlock(&pTrace->lock);
+    return released;
+}
+
+/************************* Trace Replay Implementation ************************/
+
+struct trace_op
+{
+    uint32_t    op;
+    uint32_t    id;
+    size_t      size;
+};
+
+struct cpl_allocator_trace
+{
+    struct trace_op*    ops;
+    size_t              nOps;
+    size_t              nIds;
+    cpl_allocator_trace_info_t info;
+};
+
+/* ops are timed in batches, the process is sampled in between */
+#define REPLAY_BATCH            (4096U)
+#define REPLAY_PAGE_SIZE        ((size_t)4096)
+
+static int trace_read_all(int fd, uint8_t** data, size_t* size)
+{
+    size_t capacity = TRACE_BUFFER_SIZE, used = 0;
+    uint8_t* buffer = malloc(capacity);
+    if(!buffer)
+    {
+        return _CPL_NOMEM;
+    }
+    
+    for(;;)
+    {
+        if(used == capacity)
+        {
+            uint8_t* bigger = realloc(buffer, capacity * 2);
+            if(!bigger)
+            {
+                free(buffer);
+                return _CPL_NOMEM;
+            }
+            buffer = bigger;
+            capacity *= 2;
+        }
+        
+        ssize_t n = read(fd, buffer + used, capacity - used);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            free(buffer);
+            return _CPL_IO_ERROR;
+        }
+        if(n == 0)
+        {
+            break;
+        }
+        used += (size_t)n;
+    }
+    
+    *data = buffer;
+    *size = used;
+    return _CPL_OK;
+}
+
+static int trace_get_varint(const uint8_t** in, const uint8_t* end, uint64_t* v)
+{
+    *v = 0;
+    for(unsigned shift = 0; *in < end && shift < 64; shift += 7)
+    {
+        uint8_t b = *(*in)++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if(!(b & 0x80))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Decodes records and checks that every id is used consistently. Sizes of
+ * live chunks are kept in _sizes_ while decoding.
+ */
+static int trace_decode(struct cpl_allocator_trace* trace, const uint8_t* in, const uint8_t* end)
+{
+    cpl_allocator_trace_info_t* info = &trace->info;
+    size_t* sizes = 0;      /* (size_t)-1 marks a free id */
+    size_t nChunks = 0, nBytes = 0, maxOps = 0;
+    int rc = _CPL_OK;
+    
+    info->min_size = (size_t)-1;
+    while(in < end)
+    {
+        uint64_t id, size = 0;
+        uint32_t op = *in++;
+        if(op < TRACE_OP_ALLOC || op > TRACE_OP_FREE || !trace_get_varint(&in, end, &id) || id > UINT32_MAX ||
+           (op != TRACE_OP_FREE && (!trace_get_varint(&in, end, &size) || size > (size_t)-1 - 1)))
+        {
+            goto Linvalid;
+        }
+        
+        if(id >= trace->nIds)
+        {
+            size_t nIds = trace->nIds ? trace->nIds : 1024;
+            while(nIds <= id)
+            {
+                nIds *= 2;
+            }
+            size_t* bigger = realloc(sizes, nIds * sizeof(size_t));
+            if(!bigger)
+            {
+                rc = _CPL_NOMEM;
+                goto Lfail;
+            }
+            sizes = bigger;
+            memset(sizes + trace->nIds, 0xff, (nIds - trace->nIds) * sizeof(size_t));
+            trace->nIds = nIds;
+        }
+        
+        if((op == TRACE_OP_ALLOC) != (sizes[id] == (size_t)-1))
+        {
+            /* allocated twice, or used while free */
+            goto Linvalid;
+        }
+        
+        switch(op)
+        {
+            case TRACE_OP_ALLOC:
+                ++nChunks;
+                nBytes += (size_t)size;
+                sizes[id] = (size_t)size;
+                break;
+            case TRACE_OP_REALLOC:
+                nBytes += (size_t)size - sizes[id];
+                sizes[id] = (size_t)size;
+                break;
+            default:
+                --nChunks;
+                nBytes -= sizes[id];
+                sizes[id] = (size_t)-1;
+                break;
+        }
+        
+        if(op != TRACE_OP_FREE)
+        {
+            info->min_size = (size < info->min_size)?(size_t)size:info->min_size;
+            info->max_size = (size > info->max_size)?(size_t)size:info->max_size;
+        }
+        info->max_chunks = (nChunks > info->max_chunks)?nChunks:info->max_chunks;
+        info->max_bytes = (nBytes > info->max_bytes)?nBytes:info->max_bytes;
+        
+        if(trace->nOps == maxOps)
+        {
+            maxOps = maxOps ? maxOps * 2 : 4096;
+            struct trace_op* ops = realloc(trace->ops, maxOps * sizeof(struct trace_op));
+            if(!ops)
+            {
+                rc = _CPL_NOMEM;
+                goto Lfail;
+            }
+            trace->ops = ops;
+        }
+        trace->ops[trace->nOps].op = op;
+        trace->ops[trace->nOps].id = (uint32_t)id;
+        trace->ops[trace->nOps].size = (size_t)size;
+        ++trace->nOps;
+    }
+    
+    info->nops = trace->nOps;
+    if(info->min_size > info->max_size)
+    {
+        info->min_size = 0;
+    }
+    free(sizes);
+    return _CPL_OK;
+    
+Linvalid:
+    rc = _CPL_INVALID_ARG;
+Lfail:
+    free(sizes);
+    return rc;
+}
+
+static inline void replay_touch(char* ptr, size_t sz)
+{
+    for(size_t off = 0; off < sz; off += REPLAY_PAGE_SIZE)
+    {
+        ((volatile char *)ptr)[off] = 1;
+    }
+}
+
+/*
+ * Samples resident size and allocator footprint between batches. Fragmentation
+ * is taken at the sample with the most live bytes.
+ */
+static void replay_sample(cpl_allocator_ref allocator, size_t base_rss, size_t live, size_t* peak_live,
+                          cpl_allocator_replay_result_t* result)
+{
+    size_t rss = cpl_system_resident_size();
+    if(rss > result->peak_rss)
+    {
+        result->peak_rss = rss;
+    }
+    
+    cpl_allocator_stats_t stats;
+    size_t footprint = 0;
+    if(cpl_allocator_get_stats(allocator, &stats) == _CPL_OK)
+    {
+        footprint = stats.mapped_bytes;
+    }
+    if(!footprint)
+    {
+        footprint = (rss > base_rss)?rss - base_rss:0;
+    }
+    
+    if(footprint > result->peak_footprint)
+    {
+        result->peak_footprint = footprint;
+    }
+    if(live >= *peak_live)
+    {
+        *peak_live = live;
+        result->fragmentation = (footprint > live)?1.0 - (double)live / footprint:0.0;
+    }
+}
+
+/******************** Public Tracing Allocator routines  **********************/
+cpl_allocator_ref cpl_allocator_create_trace(cpl_allocator_ref backing, int fd)
+{
+    assert(backing);
+    
+    struct cpl_trace_allocator* traceAllocator = calloc(1, sizeof(struct cpl_trace_allocator));
+    if(!traceAllocator)
+    {
+        return 0;
+    }
+    
+    if(trace_write_all(fd, (const uint8_t *)TRACE_MAGIC, TRACE_MAGIC_SIZE) != _CPL_OK)
+    {
+        free(traceAllocator);
+        return 0;
+    }
+    
+    traceAllocator->xAllocate = cpl_trace_malloc;
+    traceAllocator->xRealloc = cpl_trace_realloc;
+    traceAllocator->xFree = cpl_trace_free;
+    traceAllocator->xStats = cpl_trace_stats;
+    traceAllocator->xTrim = cpl_trace_trim;
+    traceAllocator->xAllocateAligned = cpl_trace_malloc_aligned;
+    traceAllocator->xReallocAligned = cpl_trace_realloc_aligned;
+    traceAllocator->xUsableSize = cpl_trace_usable_size;
+    traceAllocator->xTryExpand = cpl_trace_try_expand;
+    traceAllocator->xAllocateBatch = 0;
+    traceAllocator->xFreeBatch = 0;
+    traceAllocator->backing = backing;
+    traceAllocator->fd = fd;
+    traceAllocator->status = _CPL_OK;
+    pthread_mutex_init(&traceAllocator->lock, 0);
+    
+    return (cpl_allocator_ref)traceAllocator;
+}
+
+void cpl_allocator_destroy_trace(cpl_allocator_ref allocator)
+{
+    assert(allocator != cpl_allocator_get_default());
+    struct cpl_trace_allocator* pTrace = (struct cpl_trace_allocator *)allocator;
+    
+    trace_flush(pTrace);
+    pthread_mutex_destroy(&pTrace->lock);
+    free(pTrace->entries);
+    free(pTrace->freeIds);
+    free(pTrace);
+}
+
+int cpl_allocator_trace_flush(cpl_allocator_ref allocator)
+{
+    struct cpl_trace_allocator* pTrace = (struct cpl_trace_allocator *)allocator;
+    
+    pthread_mutex_lock(&pTrace->lock);
+    trace_flush(pTrace);
+    int rc = pTrace->status;
+    pthread_mutex_unlock(&pTrace->lock);
+    
+    return rc;
+}
+
+int cpl_allocator_trace_load(int fd, cpl_allocator_trace_t** trace)
+{
+    uint8_t* data;
+    size_t size;
+    int rc = trace_read_all(fd, &data, &size);
+    if(rc != _CPL_OK)
+    {
+        return rc;
+    }
+    
+    if(size < TRACE_MAGIC_SIZE || memcmp(data, TRACE_MAGIC, TRACE_MAGIC_SIZE))
+    {
+        free(data);
+        return _CPL_INVALID_ARG;
+    }
+    
+    struct cpl_allocator_trace* t = calloc(1, sizeof(struct cpl_allocator_trace));
+    if(!t)
+    {
+        free(data);
+        return _CPL_NOMEM;
+    }
+    
+    rc = trace_decode(t, data + TRACE_MAGIC_SIZE, data + size);
+    free(data);
+    if(rc != _CPL_OK)
+    {
+        cpl_allocator_trace_free(t);
+        return rc;
+    }
+    
+    *trace = t;
+    return _CPL_OK;
+}
+
+void cpl_allocator_trace_free(cpl_allocator_trace_t* trace)
+{
+    if(trace)
+    {
+        free(trace->ops);
+        free(trace);
+    }
+}
+
+void cpl_allocator_trace_get_info(const cpl_allocator_trace_t* trace, cpl_allocator_trace_info_t* info)
+{
+    *info = trace->info;
+}
+
+int cpl_allocator_trace_replay(cpl_allocator_ref allocator, const cpl_allocator_trace_t* trace,
+                               size_t chunkSize, cpl_allocator_replay_result_t* result)
+{
+    memset(result, 0, sizeof(cpl_allocator_replay_result_t));
+    if(chunkSize && trace->info.max_size > chunkSize)
+    {
+        return _CPL_INVALID_ARG;
+    }
+    
+    void** chunks = calloc(trace->nIds ? trace->nIds : 1, sizeof(void*));
+    size_t* sizes = calloc(trace->nIds ? trace->nIds : 1, sizeof(size_t));
+    if(!chunks || !sizes)
+    {
+        free(chunks);
+        free(sizes);
+        return _CPL_NOMEM;
+    }
+    
+    size_t base_rss = cpl_system_resident_size();
+    size_t live = 0, peak_live = 0;
+    for(size_t i = 0; i < trace->nOps; )
+    {
+        size_t end = (trace->nOps - i > REPLAY_BATCH)?i + REPLAY_BATCH:trace->nOps;
+        uint64_t start = cpl_system_monotonic_time();
+        for(; i < end; ++i)
+        {
+            const struct trace_op* op = &trace->ops[i];
+            size_t sz = chunkSize ? chunkSize : op->size;
+            void* ptr;
+            
+            switch(op->op)
+            {
+                case TRACE_OP_ALLOC:
+                    ptr = cpl_allocator_allocate(allocator, sz);
+                    if(ptr)
+                    {
+                        replay_touch(ptr, sz);
+                        live += op->size;
+                        sizes[op->id] = op->size;
+                    }
+                    else
+                    {
+                        ++result->nfailed;
+                    }
+                    chunks[op->id] = ptr;
+                    break;
+                case TRACE_OP_REALLOC:
+                    /* the allocation failed earlier, so did the chunk */
+                    if(!chunks[op->id])
+                    {
+                        break;
+                    }
+                    ptr = cpl_allocator_realloc(allocator, chunks[op->id], sz);
+                    if(ptr)
+                    {
+                        if(op->size > sizes[op->id])
+                        {
+                            replay_touch((char *)ptr + sizes[op->id], op->size - sizes[op->id]);
+                        }
+                        live += op->size - sizes[op->id];
+                        sizes[op->id] = op->size;
+                        chunks[op->id] = ptr;
+                    }
+                    else if(!sz)
+                    {
+                        /* freed by an allocator that returns 0 for no bytes */
+                        live -= sizes[op->id];
+                        chunks[op->id] = 0;
+                    }
+                    else
+                    {
+                        ++result->nfailed;
+                    }
+                    break;
+                default:
+                    if(chunks[op->id])
+                    {
+                        cpl_allocator_free(allocator, chunks[op->id]);
+                        live -= sizes[op->id];
+                        chunks[op->id] = 0;
+                    }
+                    break;
+            }
+        }
+        result->elapsed_ns += cpl_system_monotonic_time() - start;
+        replay_sample(allocator, base_rss, live, &peak_live, result);
+    }
+    
+    for(size_t id = 0; id < trace->nIds; ++id)
+    {
+        if(chunks[id])
+        {
+            cpl_allocator_free(allocator, chunks[id]);
+        }
+    }
+    free(chunks);
+    free(sizes);
+    
+    result->nops = trace->nOps;
+    result->ns_per_op = trace->nOps ? (double)result->elapsed_ns / trace->nOps : 0.0;
+    return _CPL_OK;
+}
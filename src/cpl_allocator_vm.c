@@ -0,0 +1,391 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#if defined(__linux__)
+#   define _GNU_SOURCE          /* mremap */
+#endif
+
+#include "cpl_allocator_private.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cpl_error.h"
+
+#ifndef MAP_ANONYMOUS
+#   ifdef MAP_ANON
+#       define MAP_ANONYMOUS MAP_ANON
+#   endif
+#endif
+
+#if defined(__APPLE__)
+#   define VM_MADV_RELEASE      MADV_FREE
+#else
+#   define VM_MADV_RELEASE      MADV_DONTNEED
+#endif
+
+/*********************** Virtual Memory Allocator routines ********************/
+
+/*
+ * Chunks of a page and more get a range of address space of their own, of
+ * which only the pages in use are accessible. Growth within the range only
+ * changes page protection, beyond it the range is remapped. Smaller chunks
+ * come from malloc() and have _reserved_ set to 0. The header lies right
+ * before the chunk; _committed_ counts from the start of the range.
+ */
+struct vm_header
+{
+    size_t      reserved;
+    size_t      committed;
+    size_t      offset;                 /* of the chunk in the range */
+} __attribute__((aligned(16)));
+
+#define VM_HEADER_SIZE          (sizeof(struct vm_header))
+#define vm_header(p)            ((struct vm_header *)((char *)(p) - VM_HEADER_SIZE))
+#define vm_chunk(h)             ((void *)((char *)(h) + VM_HEADER_SIZE))
+#define vm_base(h)              ((char *)(h) + VM_HEADER_SIZE - (h)->offset)
+#define vm_usable_size(h)       ((h)->committed - (h)->offset)
+
+/* all that malloc() promises, so the most a small chunk may be aligned to */
+#define VM_MALLOC_ALIGNMENT     16
+
+struct cpl_vm_allocator
+{
+    /* struct cpl_allocator */
+    CPL_ALLOCATOR_INTERFACE
+    
+    size_t      reserve;                /* of address space per chunk */
+    size_t      page_size;
+    struct cpl_stats_shards shards;
+};
+
+static inline size_t vm_page_align(struct cpl_vm_allocator* vm, size_t sz)
+{
+    return (sz + vm->page_size - 1) & ~(vm->page_size - 1);
+}
+
+/*
+ * Returns bytes to commit for a chunk of _sz_ bytes at _offset_ in its range,
+ * or 0 on overflow.
+ */
+static inline size_t vm_commit_size(struct cpl_vm_allocator* vm, size_t offset, size_t sz)
+{
+    return (sz < SIZE_MAX - offset - vm->page_size)?vm_page_align(vm, offset + sz):0;
+}
+
+/*
+ * Makes the first _committed_ bytes of the range accessible, releasing pages
+ * past them. Returns 0 if protection cannot be changed.
+ */
+static int vm_commit(struct vm_header* h, size_t committed)
+{
+    char* base = vm_base(h);
+    if(committed > h->committed)
+    {
+        if(mprotect(base + h->committed, committed - h->committed, PROT_READ | PROT_WRITE))
+        {
+            return 0;
+        }
+    }
+    else if(committed < h->committed)
+    {
+        madvise(base + committed, h->committed - committed, VM_MADV_RELEASE);
+        mprotect(base + committed, h->committed - committed, PROT_NONE);
+    }
+    h->committed = committed;
+    return 1;
+}
+
+/*
+ * Resizes the range of a chunk to _reserved_ bytes, moving it if _may_move_
+ * is set. The whole range is accessible afterwards. Returns the header at its
+ * new place or 0.
+ */
+static struct vm_header* vm_remap(struct cpl_vm_allocator* vm, struct vm_header* h, size_t reserved, int may_move)
+{
+#if defined(MREMAP_MAYMOVE)
+    /* mremap() takes a single mapping, so protection must be the same all over */
+    char* base = vm_base(h);
+    size_t offset = h->offset;
+    size_t old_reserved = h->reserved;
+    if(h->committed < old_reserved &&
+       mprotect(base + h->committed, old_reserved - h->committed, PROT_READ | PROT_WRITE))
+    {
+        return 0;
+    }
+    
+    char* addr = mremap(base, old_reserved, reserved, may_move?MREMAP_MAYMOVE:0);
+    if(addr == MAP_FAILED)
+    {
+        /* the range stays where it was, and so must its guard */
+        if(h->committed < old_reserved)
+        {
+            mprotect(base + h->committed, old_reserved - h->committed, PROT_NONE);
+        }
+        return 0;
+    }
+    
+    h = vm_header(addr + offset);
+    h->reserved = reserved;
+    h->committed = reserved;
+    cpl_stats_shards_local(&vm->shards)->mapped += reserved - old_reserved;
+    return h;
+#else
+    (void)vm; (void)h; (void)reserved; (void)may_move;
+    return 0;
+#endif
+}
+
+static void* vm_malloc(struct cpl_vm_allocator* vm, size_t sz, size_t align)
+{
+    if(align > vm->page_size)
+    {
+        return 0;
+    }
+    
+    struct vm_header* h;
+    if(align <= VM_MALLOC_ALIGNMENT && sz < vm->page_size - VM_HEADER_SIZE)
+    {
+        h = malloc(VM_HEADER_SIZE + sz);
+        if(!h)
+        {
+            return 0;
+        }
+        h->reserved = 0;
+        h->committed = VM_HEADER_SIZE + sz;
+        h->offset = VM_HEADER_SIZE;
+    }
+    else
+    {
+        size_t offset = (align > VM_HEADER_SIZE)?align:VM_HEADER_SIZE;
+        size_t committed = vm_commit_size(vm, offset, sz);
+        if(!committed)
+        {
+            return 0;
+        }
+        
+        /* reserve the range and make the pages of the chunk accessible */
+        size_t reserved = (vm->reserve > committed)?vm->reserve:committed;
+        char* base = mmap(0, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(base == MAP_FAILED)
+        {
+            return 0;
+        }
+        if(mprotect(base, committed, PROT_READ | PROT_WRITE))
+        {
+            munmap(base, reserved);
+            return 0;
+        }
+        
+        h = vm_header(base + offset);
+        h->reserved = reserved;
+        h->committed = committed;
+        h->offset = offset;
+        cpl_stats_shards_local(&vm->shards)->mapped += reserved;
+    }
+    
+    cpl_counters_alloc(cpl_stats_shards_local(&vm->shards), sz, vm_usable_size(h));
+    return vm_chunk(h);
+}
+
+static void* cpl_vm_malloc(struct cpl_allocator* allocator, size_t sz)
+{
+    return vm_malloc((struct cpl_vm_allocator *)allocator, sz, VM_MALLOC_ALIGNMENT);
+}
+
+static void* cpl_vm_malloc_aligned(struct cpl_allocator* allocator, size_t sz, size_t align)
+{
+    return vm_malloc((struct cpl_vm_allocator *)allocator, sz, align);
+}
+
+static void cpl_vm_free(struct cpl_allocator* allocator, void* ptr)
+{
+    struct cpl_vm_allocator* vm = (struct cpl_vm_allocator *)allocator;
+    if(!ptr)
+    {
+        return ;
+    }
+    
+    struct vm_header* h = vm_header(ptr);
+    struct cpl_allocator_counters* counters = cpl_stats_shards_local(&vm->shards);
+    cpl_counters_free(counters, vm_usable_size(h));
+    if(h->reserved)
+    {
+        size_t reserved = h->reserved;
+        counters->mapped -= reserved;
+        int rc = munmap(vm_base(h), reserved);
+        assert(rc == 0);
+    }
+    else
+    {
+        free(h);
+    }
+}
+
+static size_t cpl_vm_usable_size(struct cpl_allocator* allocator, void* ptr)
+{
+    return vm_usable_size(vm_header(ptr));
+}
+
+static int cpl_vm_try_expand(struct cpl_allocator* allocator, void* ptr, size_t sz)
+{
+    struct cpl_vm_allocator* vm = (struct cpl_vm_allocator *)allocator;
+    struct vm_header* h = vm_header(ptr);
+    if(sz <= vm_usable_size(h))
+    {
+        return _CPL_OK;
+    }
+    
+    size_t committed = h->reserved?vm_commit_size(vm, h->offset, sz):0;
+    if(!committed)
+    {
+        return _CPL_NOMEM;
+    }
+    
+    size_t old_usable = vm_usable_size(h);
+    if(committed > h->reserved)
+    {
+        /* double the range, so that steady growth rarely remaps */
+        size_t reserved = (committed / 2 > h->reserved)?committed:h->reserved * 2;
+        if(!vm_remap(vm, h, reserved, 0))
+        {
+            return _CPL_NOMEM;
+        }
+    }
+    if(!vm_commit(h, committed))
+    {
+        return _CPL_NOMEM;
+    }
+    
+    cpl_counters_resize(cpl_stats_shards_local(&vm->shards), old_usable, vm_usable_size(h));
+    return _CPL_OK;
+}
+
+static void* vm_realloc(struct cpl_vm_allocator* vm, void* ptr, size_t sz, size_t align)
+{
+    if(!ptr)
+    {
+        return vm_malloc(vm, sz, align);
+    }
+    
+    struct vm_header* h = vm_header(ptr);
+    size_t old_usable = vm_usable_size(h);
+    if(((size_t)ptr & (align - 1)) == 0)
+    {
+        if(sz <= old_usable)
+        {
+            /* give back whole pages past the new end */
+            size_t committed = vm_commit_size(vm, h->offset, sz);
+            if(h->reserved && committed < h->committed && vm_commit(h, committed))
+            {
+                cpl_counters_resize(cpl_stats_shards_local(&vm->shards), old_usable, vm_usable_size(h));
+            }
+            return ptr;
+        }
+        if(cpl_vm_try_expand((struct cpl_allocator *)vm, ptr, sz) == _CPL_OK)
+        {
+            return ptr;
+        }
+        
+        /* move the range as a whole, pages are not copied */
+        size_t committed = h->reserved?vm_commit_size(vm, h->offset, sz):0;
+        if(committed)
+        {
+            size_t reserved = (committed / 2 > h->reserved)?committed:h->reserved * 2;
+            struct vm_header* moved = vm_remap(vm, h, reserved, 1);
+            if(moved)
+            {
+                vm_commit(moved, committed);
+                cpl_counters_resize(cpl_stats_shards_local(&vm->shards), old_usable, vm_usable_size(moved));
+                return vm_chunk(moved);
+            }
+        }
+    }
+    
+    /* small chunks, and all of them without mremap(), are copied */
+    void* mem = vm_malloc(vm, sz, align);
+    if(mem)
+    {
+        memcpy(mem, ptr, (old_usable < sz)?old_usable:sz);
+        cpl_vm_free((struct cpl_allocator *)vm, ptr);
+    }
+    return mem;
+}
+
+static void* cpl_vm_realloc(struct cpl_allocator* allocator, void* ptr, size_t sz)
+{
+    return vm_realloc((struct cpl_vm_allocator *)allocator, ptr, sz, VM_MALLOC_ALIGNMENT);
+}
+
+static void* cpl_vm_realloc_aligned(struct cpl_allocator* allocator, void* ptr, size_t sz, size_t align)
+{
+    return vm_realloc((struct cpl_vm_allocator *)allocator, ptr, sz, align);
+}
+
+static void cpl_vm_stats(struct cpl_allocator* allocator, cpl_allocator_stats_t* stats)
+{
+    cpl_stats_shards_collect(&((struct cpl_vm_allocator *)allocator)->shards, stats);
+}
+
+cpl_allocator_ref cpl_allocator_create_vm(size_t reserve)
+{
+    struct cpl_vm_allocator* vm = malloc(sizeof(struct cpl_vm_allocator));
+    if(!vm)
+    {
+        return 0;
+    }
+    if(!cpl_stats_shards_init(&vm->shards))
+    {
+        free(vm);
+        return 0;
+    }
+    
+    vm->xAllocate = cpl_vm_malloc;
+    vm->xRealloc = cpl_vm_realloc;
+    vm->xFree = cpl_vm_free;
+    vm->xStats = cpl_vm_stats;
+    vm->xTrim = 0;
+    vm->xAllocateAligned = cpl_vm_malloc_aligned;
+    vm->xReallocAligned = cpl_vm_realloc_aligned;
+    vm->xUsableSize = cpl_vm_usable_size;
+    vm->xTryExpand = cpl_vm_try_expand;
+    vm->xAllocateBatch = 0;
+    vm->xFreeBatch = 0;
+    vm->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    vm->reserve = vm_page_align(vm, reserve);
+    
+    return (cpl_allocator_ref)vm;
+}
+
+void cpl_allocator_destroy_vm(cpl_allocator_ref allocator)
+{
+    assert(allocator != cpl_allocator_get_default());
+    struct cpl_vm_allocator* vm = (struct cpl_vm_allocator *)allocator;
+    cpl_stats_shards_destroy(&vm->shards);
+    free(vm);
+}
@@ -52,6 +52,13 @@ int cpl_array_init(cpl_array_ref a, size_t sz, size_t nreserv)
     return res;
 }
 
+void cpl_array_init_inline(cpl_array_ref a, size_t sz, void* storage, size_t nbytes)
+{
+    cpl_region_init_inline(cpl_allocator_get_default(), &a->region, storage, nbytes);
+    a->szelem = sz;
+    a->count = 0;
+}
+
 cpl_array_ref cpl_array_copy(cpl_array_ref __restrict o)
 {
     cpl_array_ref a = cpl_array_create(o->szelem, o->region.alloc/o->szelem);
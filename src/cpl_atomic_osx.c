@@ -34,3 +34,18 @@ int64_t cpl_atomic_increment64(volatile int64_t* value)
 {
     return OSAtomicIncrement64(value);
 }
+
+int32_t cpl_atomic_decrement(volatile int32_t* value)
+{
+    return OSAtomicDecrement32Barrier(value);
+}
+
+int cpl_atomic_compare_and_swap(volatile int32_t* value, int32_t old_value, int32_t new_value)
+{
+    return OSAtomicCompareAndSwap32Barrier(old_value, new_value, value);
+}
+
+int cpl_atomic_compare_and_swap64(volatile int64_t* value, int64_t old_value, int64_t new_value)
+{
+    return OSAtomicCompareAndSwap64Barrier(old_value, new_value, value);
+}
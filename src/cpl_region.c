@@ -24,11 +24,20 @@
 #include "cpl_region.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <math.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "cpl_allocator_private.h"
+#include "cpl_atomic.h"
 #include "cpl_error.h"
 
+#define CPL_REGION_READ_CHUNK       ((size_t)0x10000)
+#define CPL_REGION_WRITE_CHUNK      ((size_t)0x40000000)
+
 static size_t _cpl_p2(size_t in)
 {
     in |= (in >> 1);
@@ -40,16 +49,63 @@ static size_t _cpl_p2(size_t in)
     return in;
 }
 
+/* the allocator may hand out more than was asked for, the region uses it all */
+static inline size_t _cpl_capacity(cpl_region_ref __restrict r, size_t sz)
+{
+    size_t usable = cpl_allocator_usable_size(r->allocator, r->data);
+    return (usable > sz)?usable:sz;
+}
+
 static inline int _cpl_resize_up(cpl_region_ref __restrict r, size_t sz)
 {
-    size_t alloc = _cpl_p2(sz);
-    void *ptr = cpl_allocator_realloc(r->allocator, r->data, alloc);
-    if(!ptr)
+    if(!r->data || (r->flags & CPL_REGION_INLINE))
+    {
+        /* outgrew the storage of the owner or gave the data away, take new */
+        void *ptr = cpl_allocator_allocate(r->allocator, sz);
+        if(!ptr)
+        {
+            return _CPL_NOMEM;
+        }
+        if(r->offset)
+        {
+            memcpy(ptr, r->data, r->offset);
+        }
+        r->data = ptr;
+        r->flags &= ~CPL_REGION_INLINE;
+    }
+    else if(cpl_allocator_try_expand(r->allocator, r->data, sz) != _CPL_OK)
+    {
+        /* growing in place saves copying the data */
+        void *ptr = cpl_allocator_realloc(r->allocator, r->data, sz);
+        if(!ptr)
+        {
+            return _CPL_NOMEM;
+        }
+        r->data = ptr;
+    }
+    r->alloc = _cpl_capacity(r, sz);
+    return _CPL_OK;
+}
+
+/* makes room for _sz_ bytes past the offset, doubling the buffer */
+static int _cpl_make_room(cpl_region_ref __restrict r, size_t sz)
+{
+    size_t new_offset = r->offset + sz;
+    if(new_offset < sz)
     {
         return _CPL_NOMEM;
     }
-    r->data = ptr;
-    r->alloc = alloc;
+    
+    size_t alloc = r->alloc ? r->alloc : 1;
+    while(new_offset > alloc)
+    {
+        alloc *= 2;
+    }
+    
+    if(alloc > r->alloc)
+    {
+        return _cpl_resize_up(r, alloc);
+    }
     return _CPL_OK;
 }
 
@@ -82,34 +138,45 @@ int cpl_region_init(cpl_allocator_ref allocator, cpl_region_ref __restrict r, si
     r->allocator = allocator;
     r->alloc = sz;
     r->offset = 0;
+    r->flags = 0;
     r->data = cpl_allocator_allocate(allocator, sz);
     if(!r->data)
     {
         return _CPL_NOMEM;
     }
+    r->alloc = _cpl_capacity(r, sz);
     
     return _CPL_OK;
 }
 
-int cpl_region_append_data(cpl_region_ref __restrict r, const void* __restrict data, size_t sz)
+void cpl_region_init_inline(cpl_allocator_ref allocator, cpl_region_ref __restrict r, void* storage, size_t sz)
 {
     assert(r);
-    assert(data && sz);
-    
-    size_t new_offset = r->offset + sz;
-    size_t alloc = r->alloc;
-    while(new_offset > alloc)
+    assert(storage || !sz);
+    r->allocator = allocator;
+    r->alloc = sz;
+    r->offset = 0;
+    r->data = storage;
+    r->flags = CPL_REGION_INLINE;
+}
+
+void cpl_region_deinit(cpl_region_ref __restrict r)
+{
+    if(!(r->flags & CPL_REGION_INLINE))
     {
-        alloc *= 2;
+        cpl_allocator_free(r->allocator, r->data);
     }
+}
+
+int cpl_region_append_data(cpl_region_ref __restrict r, const void* __restrict data, size_t sz)
+{
+    assert(r);
+    assert(data && sz);
     
-    if(alloc > r->alloc)
+    int res = _cpl_make_room(r, sz);
+    if(res)
     {
-        int res = _cpl_resize_up(r, alloc);
-        if(res)
-        {
-            return res;
-        }
+        return res;
     }
     
     memcpy((char*)r->data + r->offset, data, sz);
@@ -118,16 +185,295 @@ int cpl_region_append_data(cpl_region_ref __restrict r, const void* __restrict d
     return _CPL_OK;
 }
 
+void* cpl_region_reserve(cpl_region_ref __restrict r, size_t sz)
+{
+    assert(r);
+    if(_cpl_make_room(r, sz))
+    {
+        return 0;
+    }
+    return (char*)r->data + r->offset;
+}
+
+void cpl_region_commit(cpl_region_ref __restrict r, size_t sz)
+{
+    assert(r);
+    assert(sz <= r->alloc - r->offset);
+    r->offset += sz;
+}
+
 int cpl_region_resize(cpl_region_ref __restrict r, size_t sz)
 {
     size_t alloc = _cpl_p2(sz);
+    if(alloc > r->alloc)
+    {
+        return _cpl_resize_up(r, alloc);
+    }
+    if(r->flags & CPL_REGION_INLINE)
+    {
+        /* the storage of the owner is kept whole */
+        return _CPL_OK;
+    }
+    
     void *ptr = cpl_allocator_realloc(r->allocator, r->data, alloc);
     if(!ptr)
     {
         return _CPL_NOMEM;
     }
     r->data = ptr;
-    r->alloc = alloc;
-    r->offset = (r->offset > alloc)?alloc:r->offset;
+    r->alloc = _cpl_capacity(r, alloc);
+    r->offset = (r->offset > r->alloc)?r->alloc:r->offset;
+    return _CPL_OK;
+}
+
+int cpl_region_read_fd(cpl_region_ref __restrict r, int fd, size_t sz)
+{
+    assert(r);
+    while(sz)
+    {
+        /* read straight into the region, as much as fits */
+        if(!cpl_region_reserve(r, (sz < CPL_REGION_READ_CHUNK)?sz:CPL_REGION_READ_CHUNK))
+        {
+            return _CPL_NOMEM;
+        }
+        size_t room = cpl_region_room(r);
+        ssize_t n = read(fd, (char*)r->data + r->offset, (room < sz)?room:sz);
+        if(n > 0)
+        {
+            r->offset += (size_t)n;
+            sz -= (size_t)n;
+        }
+        else if(n == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            break;
+        }
+        else if(errno != EINTR)
+        {
+            return _CPL_IO_ERROR;
+        }
+    }
     return _CPL_OK;
 }
+
+int cpl_region_write_fd(cpl_region_ref __restrict r, int fd)
+{
+    assert(r);
+    const char* p = (const char*)r->data;
+    size_t left = r->offset;
+    while(left)
+    {
+        ssize_t n = write(fd, p, (left < CPL_REGION_WRITE_CHUNK)?left:CPL_REGION_WRITE_CHUNK);
+        if(n > 0)
+        {
+            p += n;
+            left -= (size_t)n;
+        }
+        else if(n == 0 || errno != EINTR)
+        {
+            /* nothing written is no progress either */
+            return _CPL_IO_ERROR;
+        }
+    }
+    return _CPL_OK;
+}
+
+/*
+ * A mapped region is the only user of its allocator, which owns the mapping.
+ * Freeing the region data unmaps the file and frees the allocator as well.
+ */
+struct cpl_region_mapping
+{
+    /* struct cpl_allocator */
+    CPL_ALLOCATOR_INTERFACE
+    
+    size_t      size;
+};
+
+static void* _cpl_mapping_malloc(struct cpl_allocator* allocator, size_t sz)
+{
+    return 0;
+}
+
+static void* _cpl_mapping_realloc(struct cpl_allocator* allocator, void* ptr, size_t sz)
+{
+    /* the mapping is read-only, it may only be used for less */
+    return (ptr && sz <= ((struct cpl_region_mapping *)allocator)->size)?ptr:0;
+}
+
+static void _cpl_mapping_free(struct cpl_allocator* allocator, void* ptr)
+{
+    if(ptr)
+    {
+        munmap(ptr, ((struct cpl_region_mapping *)allocator)->size);
+    }
+    free(allocator);
+}
+
+static size_t _cpl_mapping_usable_size(struct cpl_allocator* allocator, void* ptr)
+{
+    return ((struct cpl_region_mapping *)allocator)->size;
+}
+
+int cpl_region_init_mapped(cpl_region_ref __restrict r, int fd)
+{
+    assert(r);
+    struct stat st;
+    if(fstat(fd, &st))
+    {
+        return _CPL_IO_ERROR;
+    }
+    if(!S_ISREG(st.st_mode))
+    {
+        return _CPL_INVALID_ARG;
+    }
+    
+    struct cpl_region_mapping* mapping = malloc(sizeof(struct cpl_region_mapping));
+    if(!mapping)
+    {
+        return _CPL_NOMEM;
+    }
+    mapping->xAllocate = _cpl_mapping_malloc;
+    mapping->xRealloc = _cpl_mapping_realloc;
+    mapping->xFree = _cpl_mapping_free;
+    mapping->xStats = 0;
+    mapping->xTrim = 0;
+    mapping->xAllocateAligned = 0;
+    mapping->xReallocAligned = 0;
+    mapping->xUsableSize = _cpl_mapping_usable_size;
+    mapping->xTryExpand = 0;
+    mapping->xAllocateBatch = 0;
+    mapping->xFreeBatch = 0;
+    mapping->size = (size_t)st.st_size;
+    
+    void* data = 0;
+    if(mapping->size)
+    {
+        data = mmap(0, mapping->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED)
+        {
+            free(mapping);
+            return _CPL_IO_ERROR;
+        }
+        madvise(data, mapping->size, MADV_SEQUENTIAL);
+    }
+    
+    r->allocator = (cpl_allocator_ref)mapping;
+    r->alloc = mapping->size;
+    r->offset = mapping->size;
+    r->data = data;
+    r->flags = 0;
+    return _CPL_OK;
+}
+
+/* buffer headers are freed by whichever thread drops the last reference */
+static cpl_region_buffer_t* _cpl_buffer_create(cpl_allocator_ref allocator, void* data, size_t size)
+{
+    cpl_region_buffer_t* b = cpl_allocator_allocate(cpl_allocator_get_default(), sizeof(cpl_region_buffer_t));
+    if(b)
+    {
+        b->refs = 1;
+        b->readonly = 0;
+        b->allocator = allocator;
+        b->data = data;
+        b->size = size;
+    }
+    return b;
+}
+
+int cpl_region_share(cpl_region_ref __restrict r, cpl_region_slice_ref __restrict s)
+{
+    assert(r && s);
+    void* data = r->data;
+    if(r->flags & CPL_REGION_INLINE)
+    {
+        /* storage of the owner cannot outlive it */
+        data = cpl_allocator_allocate(r->allocator, r->offset ? r->offset : 1);
+        if(!data)
+        {
+            return _CPL_NOMEM;
+        }
+        memcpy(data, r->data, r->offset);
+    }
+    
+    cpl_region_buffer_t* b = _cpl_buffer_create(r->allocator, data, r->offset);
+    if(!b)
+    {
+        if(data != r->data)
+        {
+            cpl_allocator_free(r->allocator, data);
+        }
+        return _CPL_NOMEM;
+    }
+    s->buffer = b;
+    s->offset = 0;
+    s->length = r->offset;
+    
+    if(r->allocator->xFree == _cpl_mapping_free)
+    {
+        /* the mapping goes with the buffer, the region grows on the heap */
+        b->readonly = 1;
+        r->allocator = cpl_allocator_get_default();
+    }
+    
+    /* the region takes a new buffer on the next append */
+    r->data = 0;
+    r->alloc = 0;
+    r->offset = 0;
+    r->flags = 0;
+    return _CPL_OK;
+}
+
+void cpl_region_slice_sub(cpl_region_slice_ref __restrict s, const cpl_region_slice_t* __restrict o,
+                          size_t offset, size_t length)
+{
+    assert(offset <= o->length && length <= o->length - offset);
+    cpl_atomic_increment(&o->buffer->refs);
+    s->buffer = o->buffer;
+    s->offset = o->offset + offset;
+    s->length = length;
+}
+
+void cpl_region_slice_release(cpl_region_slice_ref __restrict s)
+{
+    cpl_region_buffer_t* b = s->buffer;
+    if(b && cpl_atomic_decrement(&b->refs) == 0)
+    {
+        cpl_allocator_free(b->allocator, b->data);
+        cpl_allocator_free(cpl_allocator_get_default(), b);
+    }
+    s->buffer = 0;
+    s->offset = 0;
+    s->length = 0;
+}
+
+void* cpl_region_slice_writable(cpl_region_slice_ref __restrict s)
+{
+    cpl_region_buffer_t* b = s->buffer;
+    if(!b->readonly && cpl_atomic_compare_and_swap(&b->refs, 1, 1))
+    {
+        /* nobody else sees the buffer, and nobody can start to */
+        return (char*)b->data + s->offset;
+    }
+    
+    /* copy on write; mapped files cannot allocate, copies go to the heap */
+    cpl_allocator_ref allocator = b->readonly ? cpl_allocator_get_default() : b->allocator;
+    void* data = cpl_allocator_allocate(allocator, s->length ? s->length : 1);
+    if(!data)
+    {
+        return 0;
+    }
+    memcpy(data, (char*)b->data + s->offset, s->length);
+    
+    cpl_region_buffer_t* copy = _cpl_buffer_create(allocator, data, s->length);
+    if(!copy)
+    {
+        cpl_allocator_free(allocator, data);
+        return 0;
+    }
+    
+    size_t length = s->length;
+    cpl_region_slice_release(s);
+    s->buffer = copy;
+    s->length = length;
+    return data;
+}
@@ -0,0 +1,184 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cpl_rope.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cpl_error.h"
+
+#define CPL_ROPE_HEADER             (offsetof(struct cpl_rope_block, data))
+#define CPL_ROPE_DEFAULT_BLOCK      (0x1000 - CPL_ROPE_HEADER)
+
+#define _cpl_rope_first(r)          cpl_dlist_entry((r)->blocks.next, struct cpl_rope_block, link)
+#define _cpl_rope_last(r)           cpl_dlist_entry((r)->blocks.prev, struct cpl_rope_block, link)
+
+static struct cpl_rope_block* _cpl_rope_new_block(cpl_rope_ref __restrict r, size_t sz)
+{
+    size_t size = (sz > r->block_size)?sz:r->block_size;
+    if(size > (size_t)-1 - CPL_ROPE_HEADER)
+    {
+        return 0;
+    }
+    
+    struct cpl_rope_block* block = cpl_allocator_allocate(r->allocator, CPL_ROPE_HEADER + size);
+    if(block)
+    {
+        /* the allocator may hand out more than was asked for, the block uses it all */
+        size_t usable = cpl_allocator_usable_size(r->allocator, block);
+        block->size = (usable > CPL_ROPE_HEADER + size)?usable - CPL_ROPE_HEADER:size;
+        block->begin = 0;
+        block->end = 0;
+    }
+    return block;
+}
+
+cpl_rope_ref cpl_rope_create(cpl_allocator_ref allocator, size_t block_size)
+{
+    cpl_rope_ref r = (cpl_rope_ref)cpl_allocator_allocate(allocator, sizeof(cpl_rope_t));
+    if(r)
+    {
+        cpl_rope_init(allocator, r, block_size);
+    }
+    return r;
+}
+
+void cpl_rope_init(cpl_allocator_ref allocator, cpl_rope_ref __restrict r, size_t block_size)
+{
+    assert(r);
+    r->allocator = allocator;
+    r->block_size = block_size ? block_size : CPL_ROPE_DEFAULT_BLOCK;
+    r->length = 0;
+    r->blocks.next = r->blocks.prev = &r->blocks;
+}
+
+void cpl_rope_deinit(cpl_rope_ref __restrict r)
+{
+    while(!cpl_dlist_empty(&r->blocks))
+    {
+        struct cpl_rope_block* block = _cpl_rope_first(r);
+        cpl_dlist_del(&block->link);
+        cpl_allocator_free(r->allocator, block);
+    }
+    r->length = 0;
+}
+
+int cpl_rope_append_data(cpl_rope_ref __restrict r, const void* __restrict data, size_t sz)
+{
+    assert(r);
+    assert(data && sz);
+    
+    /* fill the room left in the last block first */
+    size_t room = 0;
+    struct cpl_rope_block* last = 0;
+    if(!cpl_dlist_empty(&r->blocks))
+    {
+        last = _cpl_rope_last(r);
+        room = last->size - last->end;
+    }
+    
+    size_t head = (room < sz)?room:sz;
+    struct cpl_rope_block* block = 0;
+    if(head < sz)
+    {
+        block = _cpl_rope_new_block(r, sz - head);
+        if(!block)
+        {
+            return _CPL_NOMEM;
+        }
+    }
+    
+    if(head)
+    {
+        memcpy(last->data + last->end, data, head);
+        last->end += head;
+    }
+    if(block)
+    {
+        memcpy(block->data, (const char *)data + head, sz - head);
+        block->end = sz - head;
+        cpl_dlist_add_tail(&block->link, &r->blocks);
+    }
+    r->length += sz;
+    
+    return _CPL_OK;
+}
+
+void cpl_rope_splice(cpl_rope_ref __restrict r, cpl_rope_ref __restrict o)
+{
+    assert(r->allocator == o->allocator);
+    cpl_dlist_splice_tail(&o->blocks, &r->blocks);
+    r->length += o->length;
+    o->length = 0;
+}
+
+size_t cpl_rope_iovec(cpl_rope_ref __restrict r, struct iovec* iov, size_t n)
+{
+    size_t count = 0;
+    struct cpl_dlist* iter;
+    cpl_dlist_foreach(iter, &r->blocks)
+    {
+        if(count == n)
+        {
+            break;
+        }
+        
+        struct cpl_rope_block* block = cpl_dlist_entry(iter, struct cpl_rope_block, link);
+        if(block->end > block->begin)
+        {
+            iov[count].iov_base = block->data + block->begin;
+            iov[count].iov_len = block->end - block->begin;
+            ++count;
+        }
+    }
+    return count;
+}
+
+void cpl_rope_consume(cpl_rope_ref __restrict r, size_t sz)
+{
+    assert(sz <= r->length);
+    r->length -= sz;
+    
+    while(!cpl_dlist_empty(&r->blocks))
+    {
+        struct cpl_rope_block* block = _cpl_rope_first(r);
+        size_t avail = block->end - block->begin;
+        if(sz < avail)
+        {
+            block->begin += sz;
+            break;
+        }
+        
+        sz -= avail;
+        if(block->link.next == &r->blocks)
+        {
+            /* keep the last block for appends to come */
+            block->begin = block->end = 0;
+            break;
+        }
+        cpl_dlist_del(&block->link);
+        cpl_allocator_free(r->allocator, block);
+    }
+}
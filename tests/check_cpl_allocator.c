@@ -27,8 +27,18 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <check.h>
 #include "../include/cpl/cpl_allocator.h"
+#include "../include/cpl/cpl_array.h"
+#include "../include/cpl/cpl_error.h"
+#include "../include/cpl/cpl_pool.h"
+#include "../include/cpl/cpl_region.h"
+#include "../include/cpl/cpl_rope.h"
 
 #define SMALLSIZE   72
 #define MEDIUMSIZE  896
@@ -136,8 +146,1740 @@ START_TEST(test_default_allocator_test2)
 }
 END_TEST
 
+START_TEST(test_slab_allocator_test1)
+{
+    cpl_allocator_ref a = cpl_allocator_create_slab();
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x[512];
+    unsigned i;
+    
+    /* all size classes, several magazines worth each */
+    for(i = 0; i < 512; ++i)
+    {
+        size_t size = 16 + (i * 131) % (8192 - 16);
+        x[i] = cpl_allocator_allocate(a, size);
+        ck_assert_ptr_ne(x[i], 0);
+        markblock(x[i], size, i, 0);
+    }
+    
+    for(i = 0; i < 512; ++i)
+    {
+        size_t size = 16 + (i * 131) % (8192 - 16);
+        ck_assert(checkblock(x[i], size, i, 0));
+        cpl_allocator_free(a, x[i]);
+    }
+    
+    /* grow through the classes up to a directly mapped chunk */
+    void* y = cpl_allocator_allocate(a, SMALLSIZE);
+    markblock(y, SMALLSIZE, 0, 0);
+    y = cpl_allocator_realloc(a, y, MEDIUMSIZE);
+    ck_assert_ptr_ne(y, 0);
+    ck_assert(checkblock(y, SMALLSIZE, 0, 0));
+    y = cpl_allocator_realloc(a, y, BIGSIZE);
+    ck_assert_ptr_ne(y, 0);
+    ck_assert(checkblock(y, SMALLSIZE, 0, 0));
+    
+    /* large objects grow without losing their bytes, next to each other */
+    markblock(y, BIGSIZE, 1, 0);
+    void* z = cpl_allocator_allocate(a, BIGSIZE);
+    ck_assert_ptr_ne(z, 0);
+    markblock(z, BIGSIZE, 2, 0);
+    size_t sz;
+    for(sz = BIGSIZE; sz < BIGSIZE * 64; sz *= 2)
+    {
+        y = cpl_allocator_realloc(a, y, sz * 2);
+        ck_assert_ptr_ne(y, 0);
+        ck_assert(checkblock(y, BIGSIZE, 1, 0));
+        z = cpl_allocator_realloc(a, z, sz * 2);
+        ck_assert_ptr_ne(z, 0);
+        ck_assert(checkblock(z, BIGSIZE, 2, 0));
+    }
+    cpl_allocator_free(a, y);
+    cpl_allocator_free(a, z);
+    
+    /* freed mappings are kept for reuse until trimmed */
+    cpl_allocator_stats_t stats;
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0);
+    size_t mapped = stats.mapped_bytes;
+    y = cpl_allocator_allocate(a, BIGSIZE);
+    ck_assert_ptr_ne(y, 0);
+    ck_assert(cpl_allocator_usable_size(a, y) >= BIGSIZE);
+    cpl_allocator_free(a, y);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.mapped_bytes == mapped);
+    ck_assert(cpl_allocator_trim(a, 0) >= 2 * BIGSIZE * 64);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.mapped_bytes < mapped);
+    
+    cpl_allocator_destroy_slab(a);
+}
+END_TEST
+
+static void* slab_allocator_free_odd(void* arg)
+{
+    cpl_allocator_ref a = (cpl_allocator_ref)((void **)arg)[0];
+    void** x = (void **)arg + 1;
+    size_t i;
+    for(i = 1; i < 70; i += 2)
+    {
+        cpl_allocator_free(a, x[i]);
+    }
+    return 0;
+}
+
+START_TEST(test_slab_allocator_partial)
+{
+    cpl_allocator_ref a = cpl_allocator_create_slab();
+    ck_assert_ptr_ne(a, 0);
+    
+    /* slabs of the largest class hold 7 objects */
+    void* arg[71];
+    size_t i;
+    arg[0] = a;
+    for(i = 0; i < 70; ++i)
+    {
+        arg[i + 1] = cpl_allocator_allocate(a, 8192);
+        ck_assert_ptr_ne(arg[i + 1], 0);
+    }
+    
+    /* every slab becomes partial once the thread and the depot are drained */
+    pthread_t thread;
+    ck_assert_int_eq(pthread_create(&thread, 0, slab_allocator_free_odd, arg), 0);
+    pthread_join(thread, 0);
+    cpl_allocator_trim(a, 0);
+    
+    /* and is filled up before the next one is touched */
+    void* y = cpl_allocator_allocate(a, 8192);
+    for(i = 0; i < 2; ++i)
+    {
+        void* z = cpl_allocator_allocate(a, 8192);
+        ck_assert(((size_t)z & ~(size_t)0xffff) == ((size_t)y & ~(size_t)0xffff));
+    }
+    
+    cpl_allocator_destroy_slab(a);
+}
+END_TEST
+
+START_TEST(test_slab_allocator_trim)
+{
+    cpl_allocator_ref a = cpl_allocator_create_slab();
+    ck_assert_ptr_ne(a, 0);
+    
+    size_t n = 16384, i;
+    void** x = malloc(n * sizeof(void *));
+    ck_assert_ptr_ne(x, 0);
+    for(i = 0; i < n; ++i)
+    {
+        x[i] = cpl_allocator_allocate(a, 64);
+        ck_assert_ptr_ne(x[i], 0);
+    }
+    cpl_allocator_stats_t stats;
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    size_t mapped = stats.mapped_bytes;
+    
+    /* objects freed in a burst pile up in the depot until trimmed */
+    for(i = 0; i < n; ++i)
+    {
+        cpl_allocator_free(a, x[i]);
+    }
+    ck_assert(cpl_allocator_trim(a, 0) > 0);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.mapped_bytes < mapped / 4);
+    
+    /* and the allocator keeps working */
+    for(i = 0; i < n; ++i)
+    {
+        x[i] = cpl_allocator_allocate(a, 64);
+        ck_assert_ptr_ne(x[i], 0);
+        markblock(x[i], 64, (unsigned)i, 0);
+    }
+    for(i = 0; i < n; ++i)
+    {
+        ck_assert(checkblock(x[i], 64, (unsigned)i, 0));
+        cpl_allocator_free(a, x[i]);
+    }
+    free(x);
+    cpl_allocator_destroy_slab(a);
+}
+END_TEST
+
+START_TEST(test_arena_allocator_test1)
+{
+    cpl_allocator_ref a = cpl_allocator_create_arena(BIGSIZE);
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x = cpl_allocator_allocate(a, SMALLSIZE);
+    ck_assert_ptr_ne(x, 0);
+    markblock(x, SMALLSIZE, 1, 0);
+    
+    cpl_arena_mark_t mark = cpl_allocator_arena_mark(a);
+    
+    /* the most recent chunk grows in place */
+    void* y = cpl_allocator_allocate(a, SMALLSIZE);
+    ck_assert_ptr_ne(y, 0);
+    markblock(y, SMALLSIZE, 2, 0);
+    ck_assert_ptr_eq(cpl_allocator_realloc(a, y, MEDIUMSIZE), y);
+    
+    /* older chunks move */
+    void* z = cpl_allocator_realloc(a, x, MEDIUMSIZE);
+    ck_assert_ptr_ne(z, x);
+    ck_assert(checkblock(z, SMALLSIZE, 1, 0));
+    
+    /* spill into more blocks, including an oversized one */
+    unsigned i;
+    for(i = 0; i < 64; ++i)
+    {
+        ck_assert_ptr_ne(cpl_allocator_allocate(a, MEDIUMSIZE), 0);
+    }
+    ck_assert_ptr_ne(cpl_allocator_allocate(a, BIGSIZE * 4), 0);
+    
+    /* everything after the mark is gone, the chunk before is intact */
+    cpl_allocator_arena_release_to_mark(a, mark);
+    ck_assert_ptr_eq(cpl_allocator_allocate(a, SMALLSIZE), y);
+    ck_assert(checkblock(x, SMALLSIZE, 1, 0));
+    
+    cpl_allocator_arena_reset(a);
+    ck_assert_ptr_eq(cpl_allocator_allocate(a, SMALLSIZE), x);
+    
+    /* empty chunks are distinct and may be resized */
+    void* e = cpl_allocator_allocate(a, 0);
+    ck_assert_ptr_ne(e, 0);
+    void* f = cpl_allocator_allocate(a, SMALLSIZE);
+    ck_assert_ptr_ne(f, e);
+    e = cpl_allocator_realloc(a, e, SMALLSIZE);
+    ck_assert_ptr_ne(e, 0);
+    ck_assert_ptr_ne(e, f);
+    
+    cpl_allocator_destroy_arena(a);
+}
+END_TEST
+
+START_TEST(test_dl_allocator_test1)
+{
+    cpl_allocator_ref a = cpl_allocator_create_dl(BIGSIZE * 1024);
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x[256];
+    size_t i;
+    
+    /* mix of small and large chunks */
+    for(i = 0; i < 256; ++i)
+    {
+        size_t size = (i % 2)?(SMALLSIZE + i):(MEDIUMSIZE * (i % 7 + 1));
+        x[i] = cpl_allocator_allocate(a, size);
+        ck_assert_ptr_ne(x[i], 0);
+        markblock(x[i], size, (unsigned)i, 0);
+    }
+    
+    /* punch holes of every size class */
+    for(i = 0; i < 256; i += 3)
+    {
+        cpl_allocator_free(a, x[i]);
+        x[i] = 0;
+    }
+    
+    for(i = 0; i < 256; ++i)
+    {
+        size_t size = (i % 2)?(SMALLSIZE + i):(MEDIUMSIZE * (i % 7 + 1));
+        if(x[i])
+        {
+            ck_assert(checkblock(x[i], size, (unsigned)i, 0));
+        }
+        else
+        {
+            x[i] = cpl_allocator_allocate(a, size);
+            ck_assert_ptr_ne(x[i], 0);
+            markblock(x[i], size, (unsigned)i, 0);
+        }
+    }
+    
+    for(i = 0; i < 256; ++i)
+    {
+        cpl_allocator_free(a, x[i]);
+    }
+    
+    /* everything is coalesced back, so the whole heap is available again */
+    cpl_allocator_dl_set_mmap_threshold(a, HUGESIZE);
+    void* y = cpl_allocator_allocate(a, BIGSIZE * 1000);
+    ck_assert_ptr_ne(y, 0);
+    cpl_allocator_free(a, y);
+    
+    cpl_allocator_destroy_dl(a);
+}
+END_TEST
+
+START_TEST(test_dl_allocator_realloc)
+{
+    cpl_allocator_ref a = cpl_allocator_create_dl(BIGSIZE * 1024);
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x = cpl_allocator_allocate(a, SMALLSIZE);
+    void* y = cpl_allocator_allocate(a, SMALLSIZE);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert_ptr_ne(y, 0);
+    markblock(x, SMALLSIZE, 1, 0);
+    
+    /* the neighbour is busy, so the chunk has to move */
+    x = cpl_allocator_realloc(a, x, MEDIUMSIZE);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(checkblock(x, SMALLSIZE, 1, 0));
+    markblock(x, MEDIUMSIZE, 2, 0);
+    
+    /* the top chunk follows, so the chunk grows in place */
+    void* z = cpl_allocator_realloc(a, x, BIGSIZE);
+    ck_assert_ptr_eq(z, x);
+    ck_assert(checkblock(z, MEDIUMSIZE, 2, 0));
+    
+    z = cpl_allocator_realloc(a, z, SMALLSIZE);
+    ck_assert_ptr_eq(z, x);
+    
+    cpl_allocator_free(a, y);
+    cpl_allocator_free(a, z);
+    cpl_allocator_destroy_dl(a);
+}
+END_TEST
+
+START_TEST(test_dl_allocator_stats)
+{
+    cpl_allocator_ref a = cpl_allocator_create_dl(BIGSIZE * 1024);
+    ck_assert_ptr_ne(a, 0);
+    
+    cpl_allocator_stats_t stats;
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0 && stats.nallocs == 0);
+    ck_assert(stats.mapped_bytes > 0);
+    
+    void* x = cpl_allocator_allocate(a, SMALLSIZE);
+    void* y = cpl_allocator_allocate(a, MEDIUMSIZE);
+    void* z = cpl_allocator_allocate(a, SMALLSIZE);
+    ck_assert(x && y && z);
+    
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.nallocs == 3 && stats.nfrees == 0);
+    ck_assert(stats.live_bytes >= 2 * SMALLSIZE + MEDIUMSIZE);
+    ck_assert(stats.peak_bytes == stats.live_bytes);
+    size_t peak = stats.peak_bytes;
+    
+    /* y is surrounded by busy chunks and stays in a bin */
+    cpl_allocator_free(a, y);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.nfrees == 1);
+    ck_assert(stats.live_bytes < peak && stats.peak_bytes == peak);
+    ck_assert(stats.free_chunks == 2);
+    ck_assert(stats.largest_free >= MEDIUMSIZE);
+    
+    uint64_t nhist = 0;
+    for(int i = 0; i < CPL_ALLOCATOR_STATS_NBUCKETS; ++i)
+    {
+        nhist += stats.histogram[i];
+    }
+    ck_assert(nhist == 3);
+    
+    cpl_allocator_free(a, x);
+    cpl_allocator_free(a, z);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0 && stats.free_chunks == 1);
+    cpl_allocator_destroy_dl(a);
+    
+    /* the default allocator counts as well */
+    cpl_allocator_stats_t before;
+    ck_assert_int_eq(cpl_allocator_get_stats(cpl_allocator_get_default(), &before), 0);
+    x = cpl_allocator_allocate(cpl_allocator_get_default(), MEDIUMSIZE);
+    ck_assert_int_eq(cpl_allocator_get_stats(cpl_allocator_get_default(), &stats), 0);
+    ck_assert(stats.nallocs == before.nallocs + 1);
+    ck_assert(stats.live_bytes >= before.live_bytes + MEDIUMSIZE);
+    cpl_allocator_free(cpl_allocator_get_default(), x);
+    
+    /* resizing to nothing is a free */
+    x = cpl_allocator_allocate(cpl_allocator_get_default(), MEDIUMSIZE);
+    ck_assert_ptr_eq(cpl_allocator_realloc(cpl_allocator_get_default(), x, 0), 0);
+    ck_assert_int_eq(cpl_allocator_get_stats(cpl_allocator_get_default(), &stats), 0);
+    ck_assert(stats.live_bytes == before.live_bytes);
+    ck_assert(stats.nfrees == before.nfrees + 2);
+}
+END_TEST
+
+START_TEST(test_dl_allocator_trim)
+{
+    cpl_allocator_ref a = cpl_allocator_create_dl(BIGSIZE * 1024);
+    ck_assert_ptr_ne(a, 0);
+    cpl_allocator_dl_set_mmap_threshold(a, HUGESIZE);
+    
+    cpl_allocator_stats_t stats;
+    void* x = cpl_allocator_allocate(a, BIGSIZE * 256);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    size_t mapped = stats.mapped_bytes;
+    
+    /* freeing into a large top chunk gives the tail back */
+    cpl_allocator_free(a, x);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.mapped_bytes < mapped);
+    
+    /* a freed chunk between busy ones has its pages released on trim */
+    x = cpl_allocator_allocate(a, SMALLSIZE);
+    void* y = cpl_allocator_allocate(a, BIGSIZE * 64);
+    void* z = cpl_allocator_allocate(a, SMALLSIZE);
+    ck_assert(x && y && z);
+    markblock(y, BIGSIZE * 64, 3, 0);
+    cpl_allocator_free(a, y);
+    ck_assert(cpl_allocator_trim(a, 0) > 0);
+    
+    /* released memory is still usable */
+    y = cpl_allocator_allocate(a, BIGSIZE * 64);
+    ck_assert_ptr_ne(y, 0);
+    markblock(y, BIGSIZE * 64, 4, 0);
+    ck_assert(checkblock(y, BIGSIZE * 64, 4, 0));
+    
+    cpl_allocator_free(a, x);
+    cpl_allocator_free(a, y);
+    cpl_allocator_free(a, z);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0);
+    cpl_allocator_destroy_dl(a);
+}
+END_TEST
+
+START_TEST(test_dl_allocator_mmap)
+{
+    cpl_allocator_ref a = cpl_allocator_create_dl(BIGSIZE * 64);
+    ck_assert_ptr_ne(a, 0);
+    
+    cpl_allocator_stats_t stats;
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    size_t mapped = stats.mapped_bytes;
+    
+    /* bigger than the whole heap, but mapped on its own */
+    void* x = cpl_allocator_allocate(a, BIGSIZE * 256);
+    ck_assert_ptr_ne(x, 0);
+    markblock(x, BIGSIZE * 256, 1, 0);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.mapped_bytes >= mapped + BIGSIZE * 256);
+    
+    /* the mapping grows and shrinks keeping the contents */
+    x = cpl_allocator_realloc(a, x, BIGSIZE * 1024);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(checkblock(x, BIGSIZE * 256, 1, 0));
+    markblock(x, BIGSIZE * 1024, 2, 0);
+    x = cpl_allocator_realloc(a, x, BIGSIZE * 128);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(checkblock(x, BIGSIZE * 128, 2, 0));
+    
+    /* below the threshold the chunk moves into the heap and back */
+    x = cpl_allocator_realloc(a, x, BIGSIZE);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(checkblock(x, BIGSIZE, 2, 0));
+    x = cpl_allocator_realloc(a, x, BIGSIZE * 128);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(checkblock(x, BIGSIZE, 2, 0));
+    
+    cpl_allocator_free(a, x);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0 && stats.mapped_bytes == mapped);
+    
+    /* mappings still alive are released with the allocator */
+    ck_assert_ptr_ne(cpl_allocator_allocate(a, BIGSIZE * 128), 0);
+    cpl_allocator_destroy_dl(a);
+    
+    /* mapped chunks go back to the arena they came from */
+    a = cpl_allocator_create_dl_arenas(BIGSIZE * 64, 2);
+    ck_assert_ptr_ne(a, 0);
+    x = cpl_allocator_allocate(a, BIGSIZE * 256);
+    ck_assert_ptr_ne(x, 0);
+    markblock(x, BIGSIZE * 256, 3, 0);
+    x = cpl_allocator_realloc(a, x, BIGSIZE * 512);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(checkblock(x, BIGSIZE * 256, 3, 0));
+    cpl_allocator_free(a, x);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0);
+    cpl_allocator_destroy_dl_arenas(a);
+}
+END_TEST
+
+START_TEST(test_dl_allocator_aligned)
+{
+    cpl_allocator_ref a = cpl_allocator_create_dl(BIGSIZE * 1024);
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x[64];
+    size_t i;
+    
+    /* the gaps split off in front of aligned chunks are reused */
+    for(i = 0; i < 64; ++i)
+    {
+        size_t align = (size_t)16 << (i % 8);
+        x[i] = cpl_allocator_allocate_aligned(a, SMALLSIZE + i * 8, align);
+        ck_assert_ptr_ne(x[i], 0);
+        ck_assert(((size_t)x[i] & (align - 1)) == 0);
+        markblock(x[i], SMALLSIZE + i * 8, (unsigned)i, 0);
+        ck_assert_ptr_ne(cpl_allocator_allocate(a, SMALLSIZE), 0);
+    }
+    for(i = 0; i < 64; ++i)
+    {
+        ck_assert(checkblock(x[i], SMALLSIZE + i * 8, (unsigned)i, 0));
+    }
+    
+    /* growing keeps the alignment, in place or not */
+    for(i = 0; i < 64; i += 2)
+    {
+        size_t align = (size_t)16 << (i % 8);
+        x[i] = cpl_allocator_realloc_aligned(a, x[i], MEDIUMSIZE * 4, align);
+        ck_assert_ptr_ne(x[i], 0);
+        ck_assert(((size_t)x[i] & (align - 1)) == 0);
+        ck_assert(checkblock(x[i], SMALLSIZE + i * 8, (unsigned)i, 0));
+    }
+    for(i = 0; i < 64; ++i)
+    {
+        cpl_allocator_free(a, x[i]);
+    }
+    
+    /* mapped chunks are aligned within their mapping */
+    void* y = cpl_allocator_allocate_aligned(a, BIGSIZE * 128, 0x10000);
+    ck_assert_ptr_ne(y, 0);
+    ck_assert(((size_t)y & 0xFFFF) == 0);
+    markblock(y, BIGSIZE * 128, 3, 0);
+    y = cpl_allocator_realloc_aligned(a, y, BIGSIZE * 256, 0x10000);
+    ck_assert_ptr_ne(y, 0);
+    ck_assert(((size_t)y & 0xFFFF) == 0);
+    ck_assert(checkblock(y, BIGSIZE * 128, 3, 0));
+    cpl_allocator_free(a, y);
+    cpl_allocator_destroy_dl(a);
+    
+    a = cpl_allocator_create_dl_arenas(BIGSIZE * 64, 2);
+    ck_assert_ptr_ne(a, 0);
+    y = cpl_allocator_allocate_aligned(a, MEDIUMSIZE, 1024);
+    ck_assert_ptr_ne(y, 0);
+    ck_assert(((size_t)y & 1023) == 0);
+    cpl_allocator_free(a, y);
+    cpl_allocator_destroy_dl_arenas(a);
+}
+END_TEST
+
+START_TEST(test_dl_allocator_expand)
+{
+    cpl_allocator_ref a = cpl_allocator_create_dl(BIGSIZE * 64);
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x = cpl_allocator_allocate(a, SMALLSIZE);
+    void* y = cpl_allocator_allocate(a, SMALLSIZE);
+    void* z = cpl_allocator_allocate(a, SMALLSIZE);
+    ck_assert(x && y && z);
+    ck_assert(cpl_allocator_usable_size(a, x) >= SMALLSIZE);
+    markblock(x, SMALLSIZE, 1, 0);
+    
+    /* the busy neighbour blocks growth, once freed it is taken over */
+    ck_assert_int_eq(cpl_allocator_try_expand(a, x, SMALLSIZE * 2), _CPL_NOMEM);
+    cpl_allocator_free(a, y);
+    ck_assert_int_eq(cpl_allocator_try_expand(a, x, SMALLSIZE * 2), _CPL_OK);
+    ck_assert(cpl_allocator_usable_size(a, x) >= SMALLSIZE * 2);
+    ck_assert(checkblock(x, SMALLSIZE, 1, 0));
+    markblock(x, SMALLSIZE * 2, 2, 0);
+    
+    /* the last chunk grows into the top */
+    ck_assert_int_eq(cpl_allocator_try_expand(a, z, BIGSIZE), _CPL_OK);
+    ck_assert(cpl_allocator_usable_size(a, z) >= BIGSIZE);
+    markblock(z, BIGSIZE, 3, 0);
+    ck_assert(checkblock(x, SMALLSIZE * 2, 2, 0));
+    ck_assert_int_eq(cpl_allocator_try_expand(a, z, BIGSIZE * 64), _CPL_NOMEM);
+    cpl_allocator_free(a, x);
+    cpl_allocator_free(a, z);
+    
+    /* a region at the end of the heap grows without moving */
+    cpl_region_ref r = cpl_region_create(a, 0);
+    ck_assert_ptr_ne(r, 0);
+    void* data = r->data;
+    char buf[SMALLSIZE] = { 0 };
+    for(int i = 0; i < 64; ++i)
+    {
+        ck_assert_int_eq(cpl_region_append_data(r, buf, sizeof(buf)), _CPL_OK);
+    }
+    ck_assert_ptr_eq(r->data, data);
+    ck_assert(r->alloc <= cpl_allocator_usable_size(a, r->data));
+    cpl_region_destroy(r);
+    cpl_allocator_destroy_dl(a);
+    
+    /* the default allocator only grows into its slack */
+    x = cpl_allocator_allocate(cpl_allocator_get_default(), SMALLSIZE);
+    ck_assert_ptr_ne(x, 0);
+    size_t usable = cpl_allocator_usable_size(cpl_allocator_get_default(), x);
+    ck_assert(usable >= SMALLSIZE);
+    ck_assert_int_eq(cpl_allocator_try_expand(cpl_allocator_get_default(), x, usable), _CPL_OK);
+    cpl_allocator_free(cpl_allocator_get_default(), x);
+}
+END_TEST
+
+START_TEST(test_dl_allocator_batch)
+{
+    cpl_allocator_ref a = cpl_allocator_create_dl(BIGSIZE * 64);
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x[256];
+    size_t i;
+    
+    ck_assert(cpl_allocator_allocate_batch(a, SMALLSIZE, 256, x) == 256);
+    for(i = 0; i < 256; ++i)
+    {
+        markblock(x[i], SMALLSIZE, (unsigned)i, 0);
+    }
+    for(i = 0; i < 256; ++i)
+    {
+        ck_assert(checkblock(x[i], SMALLSIZE, (unsigned)i, 0));
+    }
+    
+    /* freed chunks merge with each other and their neighbours */
+    cpl_allocator_stats_t stats;
+    void* x100 = x[100];
+    x[100] = 0;
+    cpl_allocator_free_batch(a, x + 1, 254);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.free_chunks == 3);
+    
+    void* y = cpl_allocator_allocate(a, SMALLSIZE * 99);
+    ck_assert_ptr_eq(y, x[1]);
+    cpl_allocator_free(a, y);
+    cpl_allocator_free(a, x[0]);
+    cpl_allocator_free(a, x100);
+    cpl_allocator_free(a, x[255]);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0);
+    
+    /* more than the heap holds */
+    size_t n = cpl_allocator_allocate_batch(a, BIGSIZE * 4, 256, x);
+    ck_assert(n > 0 && n < 256);
+    cpl_allocator_free_batch(a, x, n);
+    cpl_allocator_destroy_dl(a);
+    
+    a = cpl_allocator_create_dl_arenas(BIGSIZE * 64, 2);
+    ck_assert_ptr_ne(a, 0);
+    n = cpl_allocator_allocate_batch(a, BIGSIZE * 4, 256, x);
+    ck_assert(n > 16 && n < 256);
+    for(i = 0; i < n; ++i)
+    {
+        markblock(x[i], BIGSIZE * 4, (unsigned)i, 0);
+    }
+    for(i = 0; i < n; ++i)
+    {
+        ck_assert(checkblock(x[i], BIGSIZE * 4, (unsigned)i, 0));
+    }
+    cpl_allocator_free_batch(a, x, n);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0);
+    cpl_allocator_destroy_dl_arenas(a);
+}
+END_TEST
+
+START_TEST(test_dl_allocator_file)
+{
+    char path[] = "/tmp/check_cpl_allocator.XXXXXX";
+    int fd = mkstemp(path);
+    ck_assert(fd >= 0);
+    close(fd);
+    
+    cpl_allocator_ref a = cpl_allocator_create_dl_file(path, BIGSIZE * 64, 0);
+    ck_assert_ptr_ne(a, 0);
+    ck_assert_ptr_eq(cpl_allocator_dl_get_root(a), 0);
+    
+    /* the root keeps a table of blocks, some freed in between */
+    void** x = cpl_allocator_allocate(a, 16 * sizeof(void *));
+    ck_assert_ptr_ne(x, 0);
+    size_t i;
+    for(i = 0; i < 16; ++i)
+    {
+        x[i] = cpl_allocator_allocate(a, (i & 1)?MEDIUMSIZE:SMALLSIZE);
+        ck_assert_ptr_ne(x[i], 0);
+        markblock(x[i], SMALLSIZE, (unsigned)i, 0);
+    }
+    for(i = 0; i < 16; i += 4)
+    {
+        cpl_allocator_free(a, x[i]);
+        x[i] = 0;
+    }
+    cpl_allocator_dl_set_root(a, x);
+    ck_assert_int_eq(cpl_allocator_dl_sync(a), _CPL_OK);
+    
+    /* the address range is taken while attached */
+    ck_assert_ptr_eq(cpl_allocator_create_dl_file(path, BIGSIZE * 64, 0), 0);
+    cpl_allocator_destroy_dl_file(a);
+    
+    a = cpl_allocator_create_dl_file(path, BIGSIZE * 64, 0);
+    ck_assert_ptr_ne(a, 0);
+    ck_assert_ptr_eq(cpl_allocator_dl_get_root(a), x);
+    for(i = 0; i < 16; ++i)
+    {
+        if(x[i])
+        {
+            ck_assert(checkblock(x[i], SMALLSIZE, (unsigned)i, 0));
+        }
+    }
+    
+    cpl_allocator_destroy_dl_file(a);
+    
+    /* a heap left attached is checked on the next attach */
+    pid_t pid = fork();
+    ck_assert(pid >= 0);
+    if(pid == 0)
+    {
+        a = cpl_allocator_create_dl_file(path, BIGSIZE * 64, 0);
+        _exit(a == 0 || (x[0] = cpl_allocator_allocate(a, BIGSIZE)) == 0);
+    }
+    int status = 0;
+    ck_assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    
+    a = cpl_allocator_create_dl_file(path, BIGSIZE * 64, 0);
+    ck_assert_ptr_ne(a, 0);
+    ck_assert_ptr_ne(x[0], 0);
+    for(i = 0; i < 16; ++i)
+    {
+        cpl_allocator_free(a, x[i]);
+    }
+    cpl_allocator_dl_set_root(a, 0);
+    cpl_allocator_free(a, x);
+    
+    cpl_allocator_stats_t stats;
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.free_chunks == 1);
+    
+    /* a create that fails leaves an empty file, not a heap without magic */
+    char other[] = "/tmp/check_cpl_allocator.XXXXXX";
+    fd = mkstemp(other);
+    ck_assert(fd >= 0);
+    ck_assert_ptr_eq(cpl_allocator_create_dl_file(other, BIGSIZE * 64, a), 0);
+    struct stat st;
+    ck_assert(fstat(fd, &st) == 0 && st.st_size == 0);
+    
+    /* and a create that did not finish is done again */
+    ck_assert(ftruncate(fd, BIGSIZE * 64) == 0);
+    close(fd);
+    cpl_allocator_ref b = cpl_allocator_create_dl_file(other, BIGSIZE * 64, 0);
+    ck_assert_ptr_ne(b, 0);
+    ck_assert_ptr_ne(cpl_allocator_allocate(b, MEDIUMSIZE), 0);
+    cpl_allocator_destroy_dl_file(b);
+    unlink(other);
+    
+    cpl_allocator_destroy_dl_file(a);
+    unlink(path);
+}
+END_TEST
+
+START_TEST(test_dl_allocator_shared)
+{
+    /* a range free in this process, the children are forked from it */
+    char* base = mmap(0, BIGSIZE * 64, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ck_assert(base != MAP_FAILED);
+    munmap(base, BIGSIZE * 64);
+    
+    cpl_allocator_ref a = cpl_allocator_create_dl_shared(0, BIGSIZE * 64, base);
+    ck_assert_ptr_ne(a, 0);
+    ck_assert_ptr_eq(cpl_allocator_create_dl_shared(0, BIGSIZE * 64, base), 0);
+    
+    void* msg = cpl_allocator_allocate(a, MEDIUMSIZE);
+    ck_assert_ptr_ne(msg, 0);
+    ck_assert((char *)msg > base && (char *)msg < base + BIGSIZE * 64);
+    markblock(msg, MEDIUMSIZE, 1, 0);
+    size_t off = cpl_allocator_dl_shared_offset(a, msg);
+    ck_assert(off != 0);
+    ck_assert_ptr_eq(cpl_allocator_dl_shared_pointer(a, off), msg);
+    ck_assert(cpl_allocator_dl_shared_offset(a, 0) == 0);
+    
+    /* the range is taken in this process */
+    ck_assert_ptr_eq(cpl_allocator_attach_dl_shared_fd(cpl_allocator_dl_shared_fd(a)), 0);
+    
+    pid_t pid = fork();
+    ck_assert(pid >= 0);
+    if(pid == 0)
+    {
+        /* attach as an unrelated process would and answer the message */
+        int fd = dup(cpl_allocator_dl_shared_fd(a));
+        cpl_allocator_destroy_dl_shared(a);
+        a = cpl_allocator_attach_dl_shared_fd(fd);
+        close(fd);
+        if(!a || cpl_allocator_dl_shared_pointer(a, off) != msg ||
+           !checkblock(msg, MEDIUMSIZE, 1, 0))
+        {
+            _exit(1);
+        }
+        
+        for(int i = 0; i < 1000; ++i)
+        {
+            cpl_allocator_free(a, cpl_allocator_allocate(a, SMALLSIZE));
+        }
+        void* reply = cpl_allocator_allocate(a, SMALLSIZE);
+        if(!reply)
+        {
+            _exit(1);
+        }
+        markblock(reply, SMALLSIZE, 2, 0);
+        cpl_allocator_dl_set_root(a, reply);
+        cpl_allocator_destroy_dl_shared(a);
+        _exit(0);
+    }
+    
+    for(int i = 0; i < 1000; ++i)
+    {
+        cpl_allocator_free(a, cpl_allocator_allocate(a, MEDIUMSIZE));
+    }
+    int status = 0;
+    ck_assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    
+    void* reply = cpl_allocator_dl_get_root(a);
+    ck_assert_ptr_ne(reply, 0);
+    ck_assert(checkblock(reply, SMALLSIZE, 2, 0));
+    cpl_allocator_free(a, reply);
+    cpl_allocator_free(a, msg);
+    
+    cpl_allocator_stats_t stats;
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0);
+    cpl_allocator_destroy_dl_shared(a);
+}
+END_TEST
+
+START_TEST(test_dl_arenas_allocator_test1)
+{
+    cpl_allocator_ref a = cpl_allocator_create_dl_arenas(BIGSIZE * 64, 2);
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x[24];
+    size_t i;
+    
+    /* more than a single arena holds */
+    for(i = 0; i < 24; ++i)
+    {
+        x[i] = cpl_allocator_allocate(a, BIGSIZE * 4);
+        ck_assert_ptr_ne(x[i], 0);
+        markblock(x[i], BIGSIZE * 4, (unsigned)i, 0);
+    }
+    
+    for(i = 0; i < 24; ++i)
+    {
+        ck_assert(checkblock(x[i], BIGSIZE * 4, (unsigned)i, 0));
+        x[i] = cpl_allocator_realloc(a, x[i], SMALLSIZE);
+        ck_assert_ptr_ne(x[i], 0);
+    }
+    
+    for(i = 0; i < 24; ++i)
+    {
+        cpl_allocator_free(a, x[i]);
+    }
+    
+    cpl_allocator_destroy_dl_arenas(a);
+}
+END_TEST
+
+static void* pool_allocator_worker(void* arg)
+{
+    cpl_allocator_ref a = (cpl_allocator_ref)arg;
+    void* x[16];
+    unsigned i, j;
+    
+    for(j = 0; j < 10000; ++j)
+    {
+        for(i = 0; i < 16; ++i)
+        {
+            x[i] = cpl_allocator_allocate(a, SMALLSIZE);
+            ck_assert_ptr_ne(x[i], 0);
+            markblock(x[i], SMALLSIZE, i + j, 0);
+        }
+        for(i = 0; i < 16; ++i)
+        {
+            ck_assert(checkblock(x[i], SMALLSIZE, i + j, 0));
+            cpl_allocator_free(a, x[i]);
+        }
+    }
+    
+    return 0;
+}
+
+START_TEST(test_allocator_aligned)
+{
+    cpl_allocator_ref def = cpl_allocator_get_default();
+    ck_assert_ptr_eq(cpl_allocator_allocate_aligned(def, SMALLSIZE, 48), 0);
+    
+    void* x = cpl_allocator_allocate_aligned(def, SMALLSIZE, 64);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(((size_t)x & 63) == 0);
+    markblock(x, SMALLSIZE, 1, 0);
+    x = cpl_allocator_realloc_aligned(def, x, BIGSIZE, 4096);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(((size_t)x & 4095) == 0);
+    ck_assert(checkblock(x, SMALLSIZE, 1, 0));
+    cpl_allocator_free(def, x);
+    
+    /* pools align chunks as far as their size allows */
+    cpl_allocator_ref a = cpl_allocator_create_pool(128, 16);
+    ck_assert_ptr_ne(a, 0);
+    x = cpl_allocator_allocate_aligned(a, 128, 128);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(((size_t)x & 127) == 0);
+    ck_assert_ptr_eq(cpl_allocator_allocate_aligned(a, 128, 256), 0);
+    cpl_allocator_destroy_pool(a);
+    
+    a = cpl_allocator_create_pool_growable(192, 16, 0);
+    ck_assert_ptr_ne(a, 0);
+    x = cpl_allocator_allocate_aligned(a, 192, 64);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(((size_t)x & 63) == 0);
+    ck_assert_ptr_eq(cpl_allocator_allocate_aligned(a, 192, 128), 0);
+    cpl_allocator_destroy_pool_growable(a);
+    
+    /* arenas pad the bump pointer */
+    a = cpl_allocator_create_arena(BIGSIZE);
+    ck_assert_ptr_ne(a, 0);
+    ck_assert_ptr_ne(cpl_allocator_allocate(a, 8), 0);
+    x = cpl_allocator_allocate_aligned(a, SMALLSIZE, 256);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(((size_t)x & 255) == 0);
+    markblock(x, SMALLSIZE, 2, 0);
+    void* y = cpl_allocator_realloc_aligned(a, x, MEDIUMSIZE, 256);
+    ck_assert_ptr_eq(y, x);
+    x = cpl_allocator_allocate_aligned(a, BIGSIZE, 4096);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(((size_t)x & 4095) == 0);
+    cpl_allocator_destroy_arena(a);
+    
+    /* others only guarantee word alignment */
+    a = cpl_allocator_create_slab();
+    ck_assert_ptr_ne(a, 0);
+    x = cpl_allocator_allocate_aligned(a, SMALLSIZE, sizeof(void *));
+    ck_assert_ptr_ne(x, 0);
+    ck_assert_ptr_eq(cpl_allocator_realloc_aligned(a, x, MEDIUMSIZE, 4096), 0);
+    cpl_allocator_free(a, x);
+    cpl_allocator_destroy_slab(a);
+}
+END_TEST
+
+START_TEST(test_pool_allocator_lockfree)
+{
+    cpl_allocator_ref a = cpl_allocator_create_pool_lockfree(SMALLSIZE, 64);
+    ck_assert_ptr_ne(a, 0);
+    
+    pthread_t threads[4];
+    int i;
+    
+    for(i = 0; i < 4; ++i)
+    {
+        ck_assert_int_eq(pthread_create(&threads[i], 0, pool_allocator_worker, a), 0);
+    }
+    for(i = 0; i < 4; ++i)
+    {
+        pthread_join(threads[i], 0);
+    }
+    
+    /* every chunk is back in the pool */
+    for(i = 0; i < 64; ++i)
+    {
+        ck_assert_ptr_ne(cpl_allocator_allocate(a, SMALLSIZE), 0);
+    }
+    ck_assert_ptr_eq(cpl_allocator_allocate(a, SMALLSIZE), 0);
+    
+    cpl_allocator_destroy_pool(a);
+}
+END_TEST
+
+START_TEST(test_pool_allocator_mapped)
+{
+    /* huge pages are rarely reserved, the pool falls back to normal ones */
+    cpl_allocator_ref a = cpl_allocator_create_pool_ex(SMALLSIZE, 1024,
+                                                       CPL_ALLOCATOR_MAP_HUGETLB | CPL_ALLOCATOR_MAP_POPULATE);
+    ck_assert_ptr_ne(a, 0);
+    
+    int i;
+    for(i = 0; i < 1024; ++i)
+    {
+        void* x = cpl_allocator_allocate(a, SMALLSIZE);
+        ck_assert_ptr_ne(x, 0);
+        markblock(x, SMALLSIZE, (unsigned)i, 0);
+    }
+    ck_assert_ptr_eq(cpl_allocator_allocate(a, SMALLSIZE), 0);
+    cpl_allocator_destroy_pool(a);
+    
+    /* prefaulted heaps keep their pages */
+    a = cpl_allocator_create_dl_ex(BIGSIZE * 64, CPL_ALLOCATOR_MAP_HUGEPAGE | CPL_ALLOCATOR_MAP_POPULATE);
+    ck_assert_ptr_ne(a, 0);
+    void* x = cpl_allocator_allocate(a, BIGSIZE * 32);
+    ck_assert_ptr_ne(x, 0);
+    markblock(x, BIGSIZE * 32, 1, 0);
+    cpl_allocator_free(a, x);
+    ck_assert(cpl_allocator_trim(a, 0) == 0);
+    cpl_allocator_destroy_dl(a);
+}
+END_TEST
+
+START_TEST(test_pool_allocator_growable)
+{
+    cpl_allocator_ref a = cpl_allocator_create_pool_growable(SMALLSIZE, 16, 1);
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x[1024];
+    unsigned i;
+    
+    /* far more than a single slab */
+    for(i = 0; i < 1024; ++i)
+    {
+        x[i] = cpl_allocator_allocate(a, SMALLSIZE);
+        ck_assert_ptr_ne(x[i], 0);
+        markblock(x[i], SMALLSIZE, i, 0);
+    }
+    
+    for(i = 0; i < 1024; ++i)
+    {
+        ck_assert(checkblock(x[i], SMALLSIZE, i, 0));
+        cpl_allocator_free(a, x[i]);
+    }
+    
+    /* slabs are reused or mapped again after being released */
+    for(i = 0; i < 1024; ++i)
+    {
+        x[i] = cpl_allocator_allocate(a, SMALLSIZE);
+        ck_assert_ptr_ne(x[i], 0);
+    }
+    
+    /* a partial slab is filled up before the next one is touched; slabs of
+     * 16 small chunks take a page */
+    for(i = 0; i < 1024; i += 2)
+    {
+        cpl_allocator_free(a, x[i]);
+    }
+    size_t slab = (size_t)cpl_allocator_allocate(a, SMALLSIZE) & ~(size_t)4095;
+    for(i = 1; i < 16; ++i)
+    {
+        ck_assert(((size_t)cpl_allocator_allocate(a, SMALLSIZE) & ~(size_t)4095) == slab);
+    }
+    
+    cpl_allocator_destroy_pool_growable(a);
+}
+END_TEST
+
+START_TEST(test_pool_allocator_batch)
+{
+    cpl_allocator_ref a = cpl_allocator_create_pool(SMALLSIZE, 64);
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x[128];
+    size_t i;
+    
+    /* the batch is cut short when the pool runs out */
+    ck_assert(cpl_allocator_allocate_batch(a, SMALLSIZE, 48, x) == 48);
+    ck_assert(cpl_allocator_allocate_batch(a, SMALLSIZE, 48, x + 48) == 16);
+    for(i = 0; i < 64; ++i)
+    {
+        markblock(x[i], SMALLSIZE, (unsigned)i, 0);
+    }
+    for(i = 0; i < 64; ++i)
+    {
+        ck_assert(checkblock(x[i], SMALLSIZE, (unsigned)i, 0));
+    }
+    x[10] = 0;
+    cpl_allocator_free_batch(a, x, 64);
+    ck_assert(cpl_allocator_allocate_batch(a, SMALLSIZE, 64, x) == 63);
+    cpl_allocator_destroy_pool(a);
+    
+    a = cpl_allocator_create_pool_lockfree(SMALLSIZE, 64);
+    ck_assert_ptr_ne(a, 0);
+    ck_assert(cpl_allocator_allocate_batch(a, SMALLSIZE, 100, x) == 64);
+    ck_assert_ptr_eq(cpl_allocator_allocate(a, SMALLSIZE), 0);
+    cpl_allocator_free_batch(a, x, 32);
+    cpl_allocator_free_batch(a, x + 32, 32);
+    ck_assert(cpl_allocator_allocate_batch(a, SMALLSIZE, 100, x) == 64);
+    cpl_allocator_destroy_pool(a);
+    
+    /* runs span several slabs */
+    a = cpl_allocator_create_pool_growable(SMALLSIZE, 16, 0);
+    ck_assert_ptr_ne(a, 0);
+    ck_assert(cpl_allocator_allocate_batch(a, SMALLSIZE, 128, x) == 128);
+    for(i = 0; i < 128; ++i)
+    {
+        markblock(x[i], SMALLSIZE, (unsigned)i, 0);
+    }
+    for(i = 0; i < 128; ++i)
+    {
+        ck_assert(checkblock(x[i], SMALLSIZE, (unsigned)i, 0));
+    }
+    cpl_allocator_free_batch(a, x, 128);
+    
+    cpl_allocator_stats_t stats;
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0 && stats.mapped_bytes == 0);
+    cpl_allocator_destroy_pool_growable(a);
+}
+END_TEST
+
+START_TEST(test_pool_allocator_inline)
+{
+    cpl_allocator_ref a = cpl_allocator_create_pool(SMALLSIZE, 64);
+    ck_assert_ptr_ne(a, 0);
+    cpl_pool_ref pool = cpl_allocator_get_pool(a);
+    ck_assert_ptr_ne(pool, 0);
+    
+    void* x[64];
+    int i;
+    
+    /* inline and interface calls work on the same free list */
+    for(i = 0; i < 64; ++i)
+    {
+        x[i] = (i % 2) ? cpl_pool_alloc_inline(pool) : cpl_allocator_allocate(a, SMALLSIZE);
+        ck_assert_ptr_ne(x[i], 0);
+        markblock(x[i], SMALLSIZE, (unsigned)i, 0);
+    }
+    ck_assert_ptr_eq(cpl_pool_alloc_inline(pool), 0);
+    for(i = 0; i < 64; ++i)
+    {
+        ck_assert(checkblock(x[i], SMALLSIZE, (unsigned)i, 0));
+        if(i % 3)
+        {
+            cpl_pool_free_inline(pool, x[i]);
+        }
+        else
+        {
+            cpl_allocator_free(a, x[i]);
+        }
+    }
+    
+    cpl_allocator_stats_t stats;
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.nallocs == 64 && stats.nfrees == 64);
+    ck_assert(stats.live_bytes == 0 && stats.peak_bytes == 64 * SMALLSIZE);
+    cpl_allocator_destroy_pool(a);
+    
+    /* other allocators have no inline path */
+    a = cpl_allocator_create_pool_lockfree(SMALLSIZE, 64);
+    ck_assert_ptr_ne(a, 0);
+    ck_assert_ptr_eq(cpl_allocator_get_pool(a), 0);
+    cpl_allocator_destroy_pool(a);
+    ck_assert_ptr_eq(cpl_allocator_get_pool(cpl_allocator_get_default()), 0);
+}
+END_TEST
+
+static void* cache_allocator_worker(void* arg)
+{
+    cpl_allocator_ref a = (cpl_allocator_ref)((void **)arg)[0];
+    void** x = (void **)arg + 1;
+    size_t i;
+    
+    /* free chunks allocated by the main thread and hand out new ones */
+    for(i = 0; i < 128; ++i)
+    {
+        ck_assert(checkblock(x[i], SMALLSIZE, (unsigned)i, 0));
+        cpl_allocator_free(a, x[i]);
+        x[i] = cpl_allocator_allocate(a, SMALLSIZE);
+        markblock(x[i], SMALLSIZE, (unsigned)i, 0);
+    }
+    
+    return 0;
+}
+
+START_TEST(test_cache_allocator_test1)
+{
+    cpl_allocator_ref dl = cpl_allocator_create_dl(BIGSIZE * 1024);
+    cpl_allocator_ref a = cpl_allocator_create_cache(dl);
+    ck_assert_ptr_ne(a, 0);
+    
+    void* arg[129];
+    size_t i;
+    
+    arg[0] = a;
+    for(i = 0; i < 128; ++i)
+    {
+        arg[i + 1] = cpl_allocator_allocate(a, SMALLSIZE);
+        ck_assert_ptr_ne(arg[i + 1], 0);
+        markblock(arg[i + 1], SMALLSIZE, (unsigned)i, 0);
+    }
+    
+    pthread_t thread;
+    ck_assert_int_eq(pthread_create(&thread, 0, cache_allocator_worker, arg), 0);
+    pthread_join(thread, 0);
+    
+    for(i = 0; i < 128; ++i)
+    {
+        ck_assert(checkblock(arg[i + 1], SMALLSIZE, (unsigned)i, 0));
+        cpl_allocator_free(a, arg[i + 1]);
+    }
+    
+    /* large chunks bypass the caches */
+    void* y = cpl_allocator_allocate(a, BIGSIZE);
+    ck_assert_ptr_ne(y, 0);
+    markblock(y, BIGSIZE, 0, 0);
+    y = cpl_allocator_realloc(a, y, BIGSIZE * 2);
+    ck_assert_ptr_ne(y, 0);
+    ck_assert(checkblock(y, BIGSIZE, 0, 0));
+    cpl_allocator_free(a, y);
+    
+    cpl_allocator_destroy_cache(a);
+    cpl_allocator_destroy_dl(dl);
+}
+END_TEST
+
+START_TEST(test_cache_allocator_test2)
+{
+    /* a DL backing aligns chunks to a word only, and so does the cache */
+    cpl_allocator_ref dl = cpl_allocator_create_dl(BIGSIZE * 1024);
+    cpl_allocator_ref a = cpl_allocator_create_cache(dl);
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x[64];
+    size_t i;
+    for(i = 0; i < 64; ++i)
+    {
+        x[i] = cpl_allocator_allocate(a, (i + 1) * 16);
+        ck_assert_ptr_ne(x[i], 0);
+        ck_assert(((size_t)x[i] & (sizeof(void *) - 1)) == 0);
+        ck_assert(cpl_allocator_usable_size(a, x[i]) == (i + 1) * 16);
+        markblock(x[i], (i + 1) * 16, (unsigned)i, 0);
+    }
+    for(i = 0; i < 64; ++i)
+    {
+        ck_assert(checkblock(x[i], (i + 1) * 16, (unsigned)i, 0));
+        x[i] = cpl_allocator_realloc(a, x[i], BIGSIZE + i);
+        ck_assert_ptr_ne(x[i], 0);
+        ck_assert(((size_t)x[i] & (sizeof(void *) - 1)) == 0);
+        ck_assert(checkblock(x[i], (i + 1) * 16, (unsigned)i, 0));
+    }
+    for(i = 0; i < 64; ++i)
+    {
+        cpl_allocator_free(a, x[i]);
+    }
+    cpl_allocator_destroy_cache(a);
+    
+    cpl_allocator_stats_t stats;
+    ck_assert_int_eq(cpl_allocator_get_stats(dl, &stats), 0);
+    ck_assert(stats.live_bytes == 0);
+    cpl_allocator_destroy_dl(dl);
+}
+END_TEST
+
+START_TEST(test_vm_allocator_test1)
+{
+    cpl_allocator_ref a = cpl_allocator_create_vm(BIGSIZE * 512);
+    ck_assert_ptr_ne(a, 0);
+    unsigned i;
+    
+    /* small chunks are not worth a range of their own */
+    void* x = cpl_allocator_allocate(a, SMALLSIZE);
+    ck_assert_ptr_ne(x, 0);
+    ck_assert(cpl_allocator_usable_size(a, x) == SMALLSIZE);
+    markblock(x, SMALLSIZE, 1, 0);
+    
+    /* stricter alignment than malloc() gives is honored for small chunks too */
+    void* z[64];
+    for(i = 0; i < 64; ++i)
+    {
+        z[i] = cpl_allocator_allocate_aligned(a, 100, 32);
+        ck_assert_ptr_ne(z[i], 0);
+        ck_assert(((size_t)z[i] & 31) == 0);
+        z[i] = cpl_allocator_realloc_aligned(a, z[i], 200, 32);
+        ck_assert_ptr_ne(z[i], 0);
+        ck_assert(((size_t)z[i] & 31) == 0);
+    }
+    for(i = 0; i < 64; ++i)
+    {
+        cpl_allocator_free(a, z[i]);
+    }
+    
+    void* y = cpl_allocator_allocate_aligned(a, MEDIUMSIZE, 4096);
+    ck_assert_ptr_ne(y, 0);
+    ck_assert(((size_t)y & 4095) == 0);
+    markblock(y, MEDIUMSIZE, 2, 0);
+    ck_assert_int_eq(cpl_allocator_try_expand(a, y, BIGSIZE * 64), _CPL_OK);
+    ck_assert(cpl_allocator_usable_size(a, y) >= BIGSIZE * 64);
+    ck_assert(checkblock(y, MEDIUMSIZE, 2, 0));
+    
+    /* once mapped, the region grows within its range without moving */
+    cpl_region_ref r = cpl_region_create(a, 0);
+    ck_assert_ptr_ne(r, 0);
+    char buf[BIGSIZE];
+    ck_assert_int_eq(cpl_region_append_data(r, buf, sizeof(buf)), _CPL_OK);
+    void* data = r->data;
+    for(i = 1; i < 256; ++i)
+    {
+        memset(buf, (int)i, sizeof(buf));
+        ck_assert_int_eq(cpl_region_append_data(r, buf, sizeof(buf)), _CPL_OK);
+    }
+    ck_assert_ptr_eq(r->data, data);
+    
+    /* and keeps its bytes past the range */
+    for(; i < 1024; ++i)
+    {
+        memset(buf, (int)i, sizeof(buf));
+        ck_assert_int_eq(cpl_region_append_data(r, buf, sizeof(buf)), _CPL_OK);
+    }
+    ck_assert(r->offset == BIGSIZE * 1024);
+    for(i = 1; i < 1024; ++i)
+    {
+        ck_assert(((unsigned char *)r->data)[i * BIGSIZE] == (unsigned char)i);
+        ck_assert(((unsigned char *)r->data)[i * BIGSIZE + BIGSIZE - 1] == (unsigned char)i);
+    }
+    
+    ck_assert_int_eq(cpl_region_resize(r, BIGSIZE), _CPL_OK);
+    ck_assert(r->alloc < BIGSIZE * 2);
+    cpl_region_destroy(r);
+    
+    ck_assert(checkblock(x, SMALLSIZE, 1, 0));
+    ck_assert(checkblock(y, MEDIUMSIZE, 2, 0));
+    cpl_allocator_free(a, x);
+    cpl_allocator_free(a, y);
+    
+    cpl_allocator_stats_t stats;
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0 && stats.mapped_bytes == 0);
+    cpl_allocator_destroy_vm(a);
+}
+END_TEST
+
+START_TEST(test_vm_allocator_guard)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    cpl_allocator_ref a = cpl_allocator_create_vm(BIGSIZE * 4);
+    ck_assert_ptr_ne(a, 0);
+    char* y = cpl_allocator_allocate(a, BIGSIZE);
+    ck_assert_ptr_ne(y, 0);
+    size_t usable = cpl_allocator_usable_size(a, y);
+    
+    /* a mapping right past the range keeps it from growing in place; if the
+     * hint is not taken, the page is in use already */
+    char* base = (char *)((size_t)y & ~(page - 1));
+    void* blocker = mmap(base + BIGSIZE * 4, page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ck_assert(blocker != MAP_FAILED);
+    ck_assert_int_eq(cpl_allocator_try_expand(a, y, BIGSIZE * 8), _CPL_NOMEM);
+    ck_assert(cpl_allocator_usable_size(a, y) == usable);
+    
+    /* and the pages past the chunk are still inaccessible */
+    pid_t pid = fork();
+    ck_assert(pid >= 0);
+    if(pid == 0)
+    {
+        y[usable] = 1;
+        _exit(0);
+    }
+    int status;
+    ck_assert(waitpid(pid, &status, 0) == pid);
+    ck_assert(!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+    munmap(blocker, page);
+    
+    cpl_allocator_free(a, y);
+    cpl_allocator_destroy_vm(a);
+}
+END_TEST
+
+START_TEST(test_region_reserve)
+{
+    cpl_region_t r;
+    ck_assert_int_eq(cpl_region_init(cpl_allocator_get_default(), &r, 0), _CPL_OK);
+    
+    /* producers write in place and commit what they wrote */
+    char* p = cpl_region_reserve(&r, SMALLSIZE);
+    ck_assert_ptr_ne(p, 0);
+    ck_assert(cpl_region_room(&r) >= SMALLSIZE);
+    markblock(p, SMALLSIZE, 0, 0);
+    cpl_region_commit(&r, SMALLSIZE);
+    ck_assert(r.offset == SMALLSIZE);
+    
+    /* reserving more keeps what was committed */
+    p = cpl_region_reserve(&r, BIGSIZE);
+    ck_assert_ptr_ne(p, 0);
+    ck_assert(p == (char*)r.data + SMALLSIZE);
+    ck_assert(cpl_region_room(&r) >= BIGSIZE);
+    ck_assert(checkblock(r.data, SMALLSIZE, 0, 0));
+    cpl_region_commit(&r, 0);
+    ck_assert(r.offset == SMALLSIZE);
+    
+    int fds[2];
+    ck_assert_int_eq(pipe(fds), 0);
+    ck_assert(write(fds[1], "0123456789", 10) == 10);
+    p = cpl_region_reserve(&r, 64);
+    ck_assert_ptr_ne(p, 0);
+    ssize_t n = read(fds[0], p, cpl_region_room(&r));
+    ck_assert(n == 10);
+    cpl_region_commit(&r, (size_t)n);
+    ck_assert(r.offset == SMALLSIZE + 10);
+    ck_assert(memcmp((char*)r.data + SMALLSIZE, "0123456789", 10) == 0);
+    close(fds[0]);
+    close(fds[1]);
+    
+    ck_assert_ptr_eq(cpl_region_reserve(&r, (size_t)-1), 0);
+    cpl_region_deinit(&r);
+}
+END_TEST
+
+START_TEST(test_region_fd)
+{
+    FILE* f = tmpfile();
+    ck_assert_ptr_ne(f, 0);
+    int fd = fileno(f);
+    
+    cpl_region_t r;
+    ck_assert_int_eq(cpl_region_init(cpl_allocator_get_default(), &r, 0), _CPL_OK);
+    char* p = cpl_region_reserve(&r, BIGSIZE * 16);
+    ck_assert_ptr_ne(p, 0);
+    markblock(p, BIGSIZE * 16, 0, 0);
+    cpl_region_commit(&r, BIGSIZE * 16);
+    ck_assert_int_eq(cpl_region_write_fd(&r, fd), _CPL_OK);
+    cpl_region_deinit(&r);
+    
+    /* reads stop at the end of file */
+    ck_assert(lseek(fd, 0, SEEK_SET) == 0);
+    ck_assert_int_eq(cpl_region_init(cpl_allocator_get_default(), &r, 0), _CPL_OK);
+    ck_assert_int_eq(cpl_region_read_fd(&r, fd, SMALLSIZE), _CPL_OK);
+    ck_assert(r.offset == SMALLSIZE);
+    ck_assert_int_eq(cpl_region_read_fd(&r, fd, (size_t)-1), _CPL_OK);
+    ck_assert(r.offset == BIGSIZE * 16);
+    ck_assert(checkblock(r.data, BIGSIZE * 16, 0, 0));
+    cpl_region_deinit(&r);
+    
+    /* the file as a read-only region */
+    ck_assert_int_eq(cpl_region_init_mapped(&r, fd), _CPL_OK);
+    ck_assert(r.offset == BIGSIZE * 16);
+    ck_assert(checkblock(r.data, BIGSIZE * 16, 0, 0));
+    ck_assert_int_eq(cpl_region_append_data(&r, "x", 1), _CPL_NOMEM);
+    ck_assert_ptr_eq(cpl_region_reserve(&r, 1), 0);
+    fclose(f);
+    ck_assert(checkblock(r.data, BIGSIZE * 16, 0, 0));
+    cpl_region_deinit(&r);
+    
+    int fds[2];
+    ck_assert_int_eq(pipe(fds), 0);
+    ck_assert_int_eq(cpl_region_init_mapped(&r, fds[0]), _CPL_INVALID_ARG);
+    close(fds[0]);
+    close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_region_inline)
+{
+    cpl_allocator_ref a = cpl_allocator_create_dl(BIGSIZE * 4);
+    ck_assert_ptr_ne(a, 0);
+    cpl_allocator_stats_t stats;
+    
+    /* nothing is allocated while the data fits the storage */
+    CPL_REGION_WITH_STORAGE(SMALLSIZE) s;
+    cpl_region_init_with_storage(a, &s);
+    ck_assert_ptr_eq(s.region.data, s.storage);
+    char buf[SMALLSIZE + 8];
+    markblock(buf, sizeof(buf), 0, 0);
+    ck_assert_int_eq(cpl_region_append_data(&s.region, buf, SMALLSIZE), _CPL_OK);
+    ck_assert_int_eq(cpl_region_resize(&s.region, SMALLSIZE / 2), _CPL_OK);
+    ck_assert_ptr_eq(s.region.data, s.storage);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.nallocs == 0);
+    
+    /* and moves to the heap once it does not */
+    ck_assert_int_eq(cpl_region_append_data(&s.region, buf + SMALLSIZE, 8), _CPL_OK);
+    ck_assert_ptr_ne(s.region.data, s.storage);
+    ck_assert(s.region.offset == SMALLSIZE + 8);
+    ck_assert(checkblock(s.region.data, SMALLSIZE + 8, 0, 0));
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.nallocs == 1);
+    cpl_region_deinit(&s.region);
+    
+    cpl_region_init_with_storage(a, &s);
+    cpl_region_deinit(&s.region);
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.nallocs == 1 && stats.live_bytes == 0);
+    cpl_allocator_destroy_dl(a);
+    
+    CPL_ARRAY_WITH_STORAGE(int, 4) arr;
+    cpl_array_init_with_storage(&arr);
+    int i;
+    for(i = 0; i < 4; ++i)
+    {
+        ck_assert_int_eq(cpl_array_push_back(&arr.array, i), _CPL_OK);
+    }
+    ck_assert_ptr_eq(cpl_array_data(&arr.array, int), arr.storage);
+    for(; i < 16; ++i)
+    {
+        ck_assert_int_eq(cpl_array_push_back(&arr.array, i), _CPL_OK);
+    }
+    ck_assert_ptr_ne(cpl_array_data(&arr.array, int), arr.storage);
+    ck_assert(cpl_array_count(&arr.array) == 16);
+    for(i = 0; i < 16; ++i)
+    {
+        ck_assert_int_eq(cpl_array_get(&arr.array, i, int), i);
+    }
+    cpl_array_deinit(&arr.array);
+}
+END_TEST
+
+static void* region_slice_worker(void* arg)
+{
+    /* the slice handed over is read and released here */
+    cpl_region_slice_ref s = (cpl_region_slice_ref)arg;
+    size_t i;
+    for(i = 0; i < 1000; ++i)
+    {
+        cpl_region_slice_t t;
+        cpl_region_slice_sub(&t, s, i % SMALLSIZE, SMALLSIZE);
+        ck_assert(memcmp(cpl_region_slice_data(&t), (const char*)cpl_region_slice_data(s) + i % SMALLSIZE, SMALLSIZE) == 0);
+        cpl_region_slice_release(&t);
+    }
+    cpl_region_slice_release(s);
+    return 0;
+}
+
+START_TEST(test_region_slice)
+{
+    cpl_allocator_ref a = cpl_allocator_create_dl(BIGSIZE * 4);
+    ck_assert_ptr_ne(a, 0);
+    cpl_allocator_stats_t stats;
+    
+    cpl_region_t r;
+    ck_assert_int_eq(cpl_region_init(a, &r, 0), _CPL_OK);
+    char* p = cpl_region_reserve(&r, MEDIUMSIZE);
+    ck_assert_ptr_ne(p, 0);
+    markblock(p, MEDIUMSIZE, 0, 0);
+    cpl_region_commit(&r, MEDIUMSIZE);
+    
+    /* the data moves to the slice, the region is empty but usable */
+    cpl_region_slice_t s, t;
+    ck_assert_int_eq(cpl_region_share(&r, &s), _CPL_OK);
+    ck_assert_ptr_eq(cpl_region_slice_data(&s), p);
+    ck_assert(cpl_region_slice_length(&s) == MEDIUMSIZE);
+    ck_assert(r.offset == 0 && r.data == 0);
+    ck_assert_int_eq(cpl_region_append_data(&r, "abc", 3), _CPL_OK);
+    ck_assert(memcmp(r.data, "abc", 3) == 0);
+    cpl_region_deinit(&r);
+    
+    /* a slice that shares the buffer is copied before writing */
+    cpl_region_slice_sub(&t, &s, SMALLSIZE, SMALLSIZE);
+    ck_assert_ptr_eq(cpl_region_slice_data(&t), p + SMALLSIZE);
+    char* w = cpl_region_slice_writable(&t);
+    ck_assert_ptr_ne(w, 0);
+    ck_assert_ptr_ne(w, p + SMALLSIZE);
+    ck_assert(memcmp(w, p + SMALLSIZE, SMALLSIZE) == 0);
+    memset(w, 0, SMALLSIZE);
+    ck_assert(checkblock(p, MEDIUMSIZE, 0, 0));
+    
+    /* the only reference writes in place */
+    ck_assert_ptr_eq(cpl_region_slice_writable(&t), w);
+    ck_assert_ptr_eq(cpl_region_slice_writable(&s), p);
+    cpl_region_slice_release(&t);
+    ck_assert_ptr_eq(t.buffer, 0);
+    cpl_region_slice_release(&s);
+    cpl_region_slice_release(&s);
+    
+    /* storage of the owner is copied */
+    CPL_REGION_WITH_STORAGE(SMALLSIZE) i;
+    cpl_region_init_with_storage(a, &i);
+    ck_assert_int_eq(cpl_region_append_data(&i.region, "abc", 3), _CPL_OK);
+    ck_assert_int_eq(cpl_region_share(&i.region, &s), _CPL_OK);
+    ck_assert(cpl_region_slice_data(&s) != (const void*)i.storage);
+    ck_assert(cpl_region_slice_length(&s) == 3);
+    ck_assert(memcmp(cpl_region_slice_data(&s), "abc", 3) == 0);
+    cpl_region_slice_release(&s);
+    cpl_region_deinit(&i.region);
+    
+    ck_assert_int_eq(cpl_allocator_get_stats(a, &stats), 0);
+    ck_assert(stats.live_bytes == 0);
+    cpl_allocator_destroy_dl(a);
+    
+    /* slices travel between threads */
+    ck_assert_int_eq(cpl_region_init(cpl_allocator_get_default(), &r, 0), _CPL_OK);
+    p = cpl_region_reserve(&r, MEDIUMSIZE);
+    ck_assert_ptr_ne(p, 0);
+    markblock(p, MEDIUMSIZE, 0, 0);
+    cpl_region_commit(&r, MEDIUMSIZE);
+    ck_assert_int_eq(cpl_region_share(&r, &s), _CPL_OK);
+    
+    cpl_region_slice_t slices[4];
+    pthread_t threads[4];
+    int k;
+    for(k = 0; k < 4; ++k)
+    {
+        cpl_region_slice_dup(&slices[k], &s);
+        ck_assert_int_eq(pthread_create(&threads[k], 0, region_slice_worker, &slices[k]), 0);
+    }
+    cpl_region_slice_release(&s);
+    for(k = 0; k < 4; ++k)
+    {
+        pthread_join(threads[k], 0);
+    }
+    
+    /* mapped files are never written, not even by the last reference */
+    FILE* f = tmpfile();
+    ck_assert_ptr_ne(f, 0);
+    ck_assert(write(fileno(f), "0123456789", 10) == 10);
+    ck_assert_int_eq(cpl_region_init_mapped(&r, fileno(f)), _CPL_OK);
+    ck_assert_int_eq(cpl_region_share(&r, &s), _CPL_OK);
+    fclose(f);
+    const void* m = cpl_region_slice_data(&s);
+    w = cpl_region_slice_writable(&s);
+    ck_assert_ptr_ne(w, 0);
+    ck_assert(w != m);
+    ck_assert(memcmp(w, "0123456789", 10) == 0);
+    ck_assert_ptr_eq(cpl_region_slice_writable(&s), w);
+    cpl_region_slice_release(&s);
+    cpl_region_deinit(&r);
+}
+END_TEST
+
+START_TEST(test_rope_test1)
+{
+    cpl_allocator_ref a = cpl_allocator_get_default();
+    cpl_rope_ref r = cpl_rope_create(a, MEDIUMSIZE);
+    ck_assert_ptr_ne(r, 0);
+    cpl_rope_t o;
+    cpl_rope_init(a, &o, 0);
+    
+    char buf[BIGSIZE];
+    markblock(buf, sizeof(buf), 0, 0);
+    
+    /* appends fill blocks up, a big one takes a block of its own */
+    size_t i;
+    for(i = 0; i < 16; ++i)
+    {
+        ck_assert_int_eq(cpl_rope_append_data(r, buf + i * SMALLSIZE, SMALLSIZE), _CPL_OK);
+    }
+    ck_assert_int_eq(cpl_rope_append_data(r, buf + 16 * SMALLSIZE, BIGSIZE - 16 * SMALLSIZE), _CPL_OK);
+    ck_assert(cpl_rope_length(r) == BIGSIZE);
+    
+    struct iovec iov[8];
+    size_t n = cpl_rope_iovec(r, iov, 8);
+    ck_assert(n >= 2 && n < 8);
+    ck_assert(iov[n - 1].iov_len >= BIGSIZE - 16 * SMALLSIZE - MEDIUMSIZE);
+    
+    /* blocks move between ropes without copying */
+    ck_assert_int_eq(cpl_rope_append_data(&o, buf, SMALLSIZE), _CPL_OK);
+    void* first = iov[0].iov_base;
+    cpl_rope_splice(&o, r);
+    ck_assert(cpl_rope_length(r) == 0 && cpl_rope_iovec(r, iov, 8) == 0);
+    ck_assert(cpl_rope_length(&o) == BIGSIZE + SMALLSIZE);
+    ck_assert(cpl_rope_iovec(&o, iov, 8) == n + 1);
+    ck_assert_ptr_eq(iov[1].iov_base, first);
+    
+    /* written out in one go and consumed as the reader catches up */
+    int fds[2];
+    ck_assert_int_eq(pipe(fds), 0);
+    ck_assert(writev(fds[1], iov, (int)(n + 1)) == (ssize_t)(BIGSIZE + SMALLSIZE));
+    cpl_rope_consume(&o, SMALLSIZE * 3);
+    ck_assert(cpl_rope_length(&o) == BIGSIZE - SMALLSIZE * 2);
+    ck_assert(cpl_rope_iovec(&o, iov, 8) == n);
+    ck_assert(memcmp(iov[0].iov_base, buf + SMALLSIZE * 2, iov[0].iov_len) == 0);
+    cpl_rope_consume(&o, cpl_rope_length(&o));
+    ck_assert(cpl_rope_length(&o) == 0 && cpl_rope_iovec(&o, iov, 8) == 0);
+    
+    char in[BIGSIZE + SMALLSIZE];
+    size_t got = 0;
+    while(got < sizeof(in))
+    {
+        ssize_t rc = read(fds[0], in + got, sizeof(in) - got);
+        ck_assert(rc > 0);
+        got += (size_t)rc;
+    }
+    ck_assert(checkblock(in, SMALLSIZE, 0, 0));
+    ck_assert(checkblock(in + SMALLSIZE, BIGSIZE, 0, 0));
+    close(fds[0]);
+    close(fds[1]);
+    
+    cpl_rope_deinit(&o);
+    cpl_rope_destroy(r);
+}
+END_TEST
 
 /************************************ Suits ***********************************/
+START_TEST(test_trace_allocator_replay)
+{
+    FILE* f = tmpfile();
+    ck_assert_ptr_ne(f, 0);
+    
+    cpl_allocator_ref a = cpl_allocator_create_trace(cpl_allocator_get_default(), fileno(f));
+    ck_assert_ptr_ne(a, 0);
+    
+    void* x[64];
+    size_t i;
+    for(i = 0; i < 64; ++i)
+    {
+        x[i] = cpl_allocator_allocate(a, SMALLSIZE);
+        ck_assert_ptr_ne(x[i], 0);
+    }
+    for(i = 0; i < 64; i += 2)
+    {
+        cpl_allocator_free(a, x[i]);
+    }
+    x[1] = cpl_allocator_realloc(a, x[1], MEDIUMSIZE);
+    ck_assert_ptr_ne(x[1], 0);
+    for(i = 1; i < 64; i += 2)
+    {
+        cpl_allocator_free(a, x[i]);
+    }
+    ck_assert_int_eq(cpl_allocator_trace_flush(a), _CPL_OK);
+    cpl_allocator_destroy_trace(a);
+    
+    rewind(f);
+    cpl_allocator_trace_t* trace = 0;
+    ck_assert_int_eq(cpl_allocator_trace_load(fileno(f), &trace), _CPL_OK);
+    fclose(f);
+    
+    cpl_allocator_trace_info_t info;
+    cpl_allocator_trace_get_info(trace, &info);
+    ck_assert(info.nops == 64 + 64 + 1);
+    ck_assert(info.min_size == SMALLSIZE && info.max_size == MEDIUMSIZE);
+    ck_assert(info.max_chunks == 64);
+    ck_assert(info.max_bytes == 64 * SMALLSIZE);
+    
+    cpl_allocator_replay_result_t result;
+    cpl_allocator_ref dl = cpl_allocator_create_dl(BIGSIZE * 1024);
+    ck_assert_int_eq(cpl_allocator_trace_replay(dl, trace, 0, &result), _CPL_OK);
+    ck_assert(result.nops == info.nops && result.nfailed == 0);
+    ck_assert(result.peak_footprint > 0);
+    cpl_allocator_destroy_dl(dl);
+    
+    /* fixed-size allocators serve every request with the largest size */
+    cpl_allocator_ref pool = cpl_allocator_create_pool(SMALLSIZE, 64);
+    ck_assert_int_eq(cpl_allocator_trace_replay(pool, trace, SMALLSIZE, &result), _CPL_INVALID_ARG);
+    cpl_allocator_destroy_pool(pool);
+    pool = cpl_allocator_create_pool(MEDIUMSIZE, 64);
+    ck_assert_int_eq(cpl_allocator_trace_replay(pool, trace, MEDIUMSIZE, &result), _CPL_OK);
+    ck_assert(result.nfailed == 0);
+    cpl_allocator_destroy_pool(pool);
+    
+    cpl_allocator_trace_free(trace);
+    
+    /* the default allocator frees a chunk resized to nothing */
+    f = tmpfile();
+    ck_assert_ptr_ne(f, 0);
+    a = cpl_allocator_create_trace(cpl_allocator_get_default(), fileno(f));
+    ck_assert_ptr_ne(a, 0);
+    x[0] = cpl_allocator_allocate(a, 40);
+    ck_assert_ptr_ne(x[0], 0);
+    ck_assert_ptr_eq(cpl_allocator_realloc(a, x[0], 0), 0);
+    x[0] = cpl_allocator_allocate(a, 40);
+    ck_assert_ptr_ne(x[0], 0);
+    cpl_allocator_free(a, x[0]);
+    ck_assert_int_eq(cpl_allocator_trace_flush(a), _CPL_OK);
+    cpl_allocator_destroy_trace(a);
+    
+    rewind(f);
+    ck_assert_int_eq(cpl_allocator_trace_load(fileno(f), &trace), _CPL_OK);
+    fclose(f);
+    cpl_allocator_trace_get_info(trace, &info);
+    ck_assert(info.nops == 4 && info.max_chunks == 1);
+    cpl_allocator_trace_free(trace);
+    
+    /* DL keeps it, and a replay over the default allocator frees it once */
+    f = tmpfile();
+    ck_assert_ptr_ne(f, 0);
+    dl = cpl_allocator_create_dl(BIGSIZE * 1024);
+    a = cpl_allocator_create_trace(dl, fileno(f));
+    ck_assert_ptr_ne(a, 0);
+    x[0] = cpl_allocator_allocate(a, 40);
+    ck_assert_ptr_ne(x[0], 0);
+    x[0] = cpl_allocator_realloc(a, x[0], 0);
+    ck_assert_ptr_ne(x[0], 0);
+    cpl_allocator_free(a, x[0]);
+    ck_assert_int_eq(cpl_allocator_trace_flush(a), _CPL_OK);
+    cpl_allocator_destroy_trace(a);
+    cpl_allocator_destroy_dl(dl);
+    
+    rewind(f);
+    ck_assert_int_eq(cpl_allocator_trace_load(fileno(f), &trace), _CPL_OK);
+    fclose(f);
+    ck_assert_int_eq(cpl_allocator_trace_replay(cpl_allocator_get_default(), trace, 0, &result), _CPL_OK);
+    ck_assert(result.nops == 3 && result.nfailed == 0);
+    cpl_allocator_trace_free(trace);
+}
+END_TEST
+
 static Suite* cpl_allocator_suit(void)
 {
     Suite* s = suite_create("Allocator");
@@ -149,9 +1891,94 @@ static Suite* cpl_allocator_suit(void)
     tcase_add_test(tc_def, test_cpl_allocator_get_default);
     tcase_add_test(tc_def, test_default_allocator_test1);
     tcase_add_test(tc_def, test_default_allocator_test2);
+    tcase_add_test(tc_def, test_allocator_aligned);
     
     suite_add_tcase(s, tc_def);
     
+    /* Pool Allocator test case */
+    TCase* tc_pool = tcase_create("Pool Allocator");
+    
+    tcase_add_test(tc_pool, test_pool_allocator_lockfree);
+    tcase_add_test(tc_pool, test_pool_allocator_growable);
+    tcase_add_test(tc_pool, test_pool_allocator_mapped);
+    tcase_add_test(tc_pool, test_pool_allocator_batch);
+    tcase_add_test(tc_pool, test_pool_allocator_inline);
+    
+    suite_add_tcase(s, tc_pool);
+    
+    /* Slab Allocator test case */
+    TCase* tc_slab = tcase_create("Slab Allocator");
+    
+    tcase_add_test(tc_slab, test_slab_allocator_test1);
+    tcase_add_test(tc_slab, test_slab_allocator_partial);
+    tcase_add_test(tc_slab, test_slab_allocator_trim);
+    
+    suite_add_tcase(s, tc_slab);
+    
+    /* Arena Allocator test case */
+    TCase* tc_arena = tcase_create("Arena Allocator");
+    
+    tcase_add_test(tc_arena, test_arena_allocator_test1);
+    
+    suite_add_tcase(s, tc_arena);
+    
+    /* DL Allocator test case */
+    TCase* tc_dl = tcase_create("DL Allocator");
+    
+    tcase_add_test(tc_dl, test_dl_allocator_test1);
+    tcase_add_test(tc_dl, test_dl_allocator_realloc);
+    tcase_add_test(tc_dl, test_dl_allocator_stats);
+    tcase_add_test(tc_dl, test_dl_allocator_trim);
+    tcase_add_test(tc_dl, test_dl_allocator_mmap);
+    tcase_add_test(tc_dl, test_dl_allocator_aligned);
+    tcase_add_test(tc_dl, test_dl_allocator_expand);
+    tcase_add_test(tc_dl, test_dl_allocator_batch);
+    tcase_add_test(tc_dl, test_dl_allocator_file);
+    tcase_add_test(tc_dl, test_dl_allocator_shared);
+    tcase_add_test(tc_dl, test_dl_arenas_allocator_test1);
+    
+    suite_add_tcase(s, tc_dl);
+    
+    /* Thread Caching Allocator test case */
+    TCase* tc_cache = tcase_create("Thread Caching Allocator");
+    
+    tcase_add_test(tc_cache, test_cache_allocator_test1);
+    tcase_add_test(tc_cache, test_cache_allocator_test2);
+    
+    suite_add_tcase(s, tc_cache);
+    
+    /* Virtual Memory Allocator test case */
+    TCase* tc_vm = tcase_create("Virtual Memory Allocator");
+    
+    tcase_add_test(tc_vm, test_vm_allocator_test1);
+    tcase_add_test(tc_vm, test_vm_allocator_guard);
+    
+    suite_add_tcase(s, tc_vm);
+    
+    /* Region test case */
+    TCase* tc_region = tcase_create("Region");
+    
+    tcase_add_test(tc_region, test_region_reserve);
+    tcase_add_test(tc_region, test_region_fd);
+    tcase_add_test(tc_region, test_region_inline);
+    tcase_add_test(tc_region, test_region_slice);
+    
+    suite_add_tcase(s, tc_region);
+    
+    /* Rope test case */
+    TCase* tc_rope = tcase_create("Rope");
+    
+    tcase_add_test(tc_rope, test_rope_test1);
+    
+    suite_add_tcase(s, tc_rope);
+    
+    /* Tracing Allocator test case */
+    TCase* tc_trace = tcase_create("Tracing Allocator");
+    
+    tcase_add_test(tc_trace, test_trace_allocator_replay);
+    
+    suite_add_tcase(s, tc_trace);
+    
     return s;
 }
 
@@ -0,0 +1,763 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Multithreaded allocator benchmarks. Runs the classic stress patterns
+ * against every allocator of the library and against system malloc (the
+ * default allocator) and reports throughput, latency percentiles and peak RSS
+ * for each thread count.
+ *
+ *     cpl_allocator_bench [-t 1,2,4,8] [-n ops per thread] [-w workload] [-a allocator]
+ *
+ * Workloads:
+ *  larson          random frees and allocations of 16..512 bytes in a set of
+ *                  live objects that is handed to another thread every round
+ *  threadtest      allocates a batch of 64 byte objects, then frees it
+ *  cache-scratch   every thread starts with an object allocated by the main
+ *                  thread, then allocates, writes and frees small objects
+ *  cache-thrash    every thread allocates, writes and frees small objects
+ *  prodcons        producers allocate, consumers on other threads free
+ *  realloc         buffers grow by half from 16 bytes up to 1 MB
+ *
+ * Allocators that are not thread-safe run single-threaded workloads only.
+ * Pools run workloads of a single object size; the arena never frees, so it
+ * runs only those that keep little memory live. pool-inline is the pool
+ * called through cpl_pool.h instead of the allocator interface.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/cpl/cpl_allocator.h"
+#include "../include/cpl/cpl_pool.h"
+#include "../include/cpl/cpl_system.h"
+
+/* latency of every BENCH_SAMPLE_RATE-th operation is measured */
+#define BENCH_SAMPLE_RATE       (8U)
+#define BENCH_DEFAULT_OPS       ((size_t)1000000)
+#define BENCH_MAX_THREADS       (64)
+#define BENCH_RSS_INTERVAL_US   (5000)
+
+/* allocator flags */
+#define BENCH_THREADSAFE        0x1
+#define BENCH_FIXED_SIZE        0x2     /* every chunk is of one size */
+#define BENCH_NO_FREE           0x4     /* free does not release memory */
+#define BENCH_INLINE            0x8     /* pool calls inlined from cpl_pool.h */
+
+/* workload flags */
+#define BENCH_CROSS_THREAD      0x1     /* frees chunks of other threads */
+#define BENCH_KEEPS_FREEING     0x2     /* allocates far more than keeps live */
+#define BENCH_PAIRS             0x4     /* runs on an even number of threads */
+
+/********************************** Utilities *********************************/
+
+struct bench_barrier
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             count;
+    int             waiting;
+    unsigned        phase;
+};
+
+static void bench_barrier_init(struct bench_barrier* b, int count)
+{
+    pthread_mutex_init(&b->lock, 0);
+    pthread_cond_init(&b->cond, 0);
+    b->count = count;
+    b->waiting = 0;
+    b->phase = 0;
+}
+
+static void bench_barrier_destroy(struct bench_barrier* b)
+{
+    pthread_cond_destroy(&b->cond);
+    pthread_mutex_destroy(&b->lock);
+}
+
+static void bench_barrier_wait(struct bench_barrier* b)
+{
+    pthread_mutex_lock(&b->lock);
+    unsigned phase = b->phase;
+    if(++b->waiting == b->count)
+    {
+        b->waiting = 0;
+        ++b->phase;
+        pthread_cond_broadcast(&b->cond);
+    }
+    else
+    {
+        while(phase == b->phase)
+        {
+            pthread_cond_wait(&b->cond, &b->lock);
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+static inline uint32_t bench_random(uint32_t* state)
+{
+    /* xorshift32 */
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int bench_compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/********************************** Threads ***********************************/
+
+struct bench_run;
+
+struct bench_thread
+{
+    struct bench_run*   run;
+    cpl_allocator_ref   allocator;
+    cpl_pool_ref        pool;       /* inline fast path, 0 for the interface */
+    int                 index;
+    uint32_t            seed;
+    size_t              nops;       /* done */
+    uint64_t            start;      /* of the workload, in ns */
+    uint64_t            end;
+    uint64_t*           samples;
+    size_t              nsamples;
+    size_t              maxSamples;
+    pthread_t           thread;
+};
+
+struct bench_run
+{
+    const struct bench_workload* workload;
+    cpl_allocator_ref   allocator;
+    int                 nthreads;
+    size_t              nops;       /* per thread */
+    struct bench_barrier barrier;
+    struct bench_thread threads[BENCH_MAX_THREADS];
+    /* workload state */
+    void**              objects;    /* larson: sets of all threads; cache-scratch: one per thread */
+    struct bench_ring*  rings;      /* prodcons: one per pair */
+    int                 finished;   /* threads, updated atomically */
+};
+
+static void bench_sample(struct bench_thread* t, uint64_t ns)
+{
+    if(t->nsamples < t->maxSamples)
+    {
+        t->samples[t->nsamples++] = ns;
+    }
+}
+
+#define bench_do_alloc(t, sz)   ((t)->pool ? cpl_pool_alloc_inline((t)->pool) : cpl_allocator_allocate((t)->allocator, sz))
+#define bench_do_free(t, ptr)   ((t)->pool ? cpl_pool_free_inline((t)->pool, ptr) : cpl_allocator_free((t)->allocator, ptr))
+
+static inline void* bench_alloc(struct bench_thread* t, size_t sz)
+{
+    void* ptr;
+    if(t->nops++ % BENCH_SAMPLE_RATE)
+    {
+        ptr = bench_do_alloc(t, sz);
+    }
+    else
+    {
+        uint64_t start = cpl_system_monotonic_time();
+        ptr = bench_do_alloc(t, sz);
+        bench_sample(t, cpl_system_monotonic_time() - start);
+    }
+    
+    if(!ptr)
+    {
+        fprintf(stderr, "out of memory allocating %zu bytes\n", sz);
+        abort();
+    }
+    return ptr;
+}
+
+static inline void bench_free(struct bench_thread* t, void* ptr)
+{
+    if(t->nops++ % BENCH_SAMPLE_RATE)
+    {
+        bench_do_free(t, ptr);
+    }
+    else
+    {
+        uint64_t start = cpl_system_monotonic_time();
+        bench_do_free(t, ptr);
+        bench_sample(t, cpl_system_monotonic_time() - start);
+    }
+}
+
+static inline void* bench_realloc(struct bench_thread* t, void* ptr, size_t sz)
+{
+    if(t->nops++ % BENCH_SAMPLE_RATE)
+    {
+        ptr = cpl_allocator_realloc(t->allocator, ptr, sz);
+    }
+    else
+    {
+        uint64_t start = cpl_system_monotonic_time();
+        ptr = cpl_allocator_realloc(t->allocator, ptr, sz);
+        bench_sample(t, cpl_system_monotonic_time() - start);
+    }
+    
+    if(!ptr)
+    {
+        fprintf(stderr, "out of memory reallocating to %zu bytes\n", sz);
+        abort();
+    }
+    return ptr;
+}
+
+/********************************* Workloads **********************************/
+
+#define LARSON_OBJECTS          (1000U)
+#define LARSON_ROUNDS           (16U)
+#define LARSON_MIN_SIZE         (16U)
+#define LARSON_MAX_SIZE         (512U)
+
+static void* bench_larson(struct bench_thread* t)
+{
+    struct bench_run* run = t->run;
+    size_t per_round = run->nops / 2 / LARSON_ROUNDS;
+    
+    for(unsigned round = 0; round < LARSON_ROUNDS; ++round)
+    {
+        /* every round works on the set left by the previous thread */
+        void** objects = run->objects + ((t->index + round) % run->nthreads) * LARSON_OBJECTS;
+        for(size_t i = 0; i < per_round; ++i)
+        {
+            unsigned idx = bench_random(&t->seed) % LARSON_OBJECTS;
+            size_t sz = LARSON_MIN_SIZE + bench_random(&t->seed) % (LARSON_MAX_SIZE - LARSON_MIN_SIZE + 1);
+            bench_free(t, objects[idx]);
+            objects[idx] = bench_alloc(t, sz);
+            *(char *)objects[idx] = (char)i;
+        }
+        bench_barrier_wait(&run->barrier);
+    }
+    return 0;
+}
+
+static void bench_larson_setup(struct bench_run* run)
+{
+    uint32_t seed = 1;
+    run->objects = malloc(sizeof(void*) * LARSON_OBJECTS * run->nthreads);
+    for(size_t i = 0; i < LARSON_OBJECTS * (size_t)run->nthreads; ++i)
+    {
+        size_t sz = LARSON_MIN_SIZE + bench_random(&seed) % (LARSON_MAX_SIZE - LARSON_MIN_SIZE + 1);
+        run->objects[i] = cpl_allocator_allocate(run->allocator, sz);
+    }
+}
+
+static void bench_larson_teardown(struct bench_run* run)
+{
+    for(size_t i = 0; i < LARSON_OBJECTS * (size_t)run->nthreads; ++i)
+    {
+        cpl_allocator_free(run->allocator, run->objects[i]);
+    }
+    free(run->objects);
+}
+
+#define THREADTEST_BATCH        (1000U)
+#define THREADTEST_SIZE         (64U)
+
+static void* bench_threadtest(struct bench_thread* t)
+{
+    void* objects[THREADTEST_BATCH];
+    for(size_t n = t->run->nops / (2 * THREADTEST_BATCH); n; --n)
+    {
+        for(unsigned i = 0; i < THREADTEST_BATCH; ++i)
+        {
+            objects[i] = bench_alloc(t, THREADTEST_SIZE);
+            *(char *)objects[i] = (char)i;
+        }
+        for(unsigned i = 0; i < THREADTEST_BATCH; ++i)
+        {
+            bench_free(t, objects[i]);
+        }
+    }
+    return 0;
+}
+
+#define CACHE_OBJECT_SIZE       (32U)
+#define CACHE_WRITES            (64U)
+
+static void bench_cache_work(struct bench_thread* t)
+{
+    for(size_t n = t->run->nops / 2; n; --n)
+    {
+        volatile char* obj = bench_alloc(t, CACHE_OBJECT_SIZE);
+        for(unsigned i = 0; i < CACHE_WRITES; ++i)
+        {
+            obj[i % CACHE_OBJECT_SIZE] = (char)i;
+        }
+        bench_free(t, (void *)obj);
+    }
+}
+
+static void* bench_cache_scratch(struct bench_thread* t)
+{
+    /* the object of the main thread may share a cache line with the others */
+    bench_free(t, t->run->objects[t->index]);
+    bench_cache_work(t);
+    return 0;
+}
+
+static void bench_cache_scratch_setup(struct bench_run* run)
+{
+    run->objects = malloc(sizeof(void*) * run->nthreads);
+    for(int i = 0; i < run->nthreads; ++i)
+    {
+        run->objects[i] = cpl_allocator_allocate(run->allocator, CACHE_OBJECT_SIZE);
+    }
+}
+
+static void bench_cache_scratch_teardown(struct bench_run* run)
+{
+    free(run->objects);
+}
+
+static void* bench_cache_thrash(struct bench_thread* t)
+{
+    bench_cache_work(t);
+    return 0;
+}
+
+/* single producer, single consumer ring */
+#define RING_SIZE               (1024U)
+#define PRODCONS_SIZE           (128U)
+
+struct bench_ring
+{
+    volatile size_t head __attribute__((aligned(64)));
+    volatile size_t tail __attribute__((aligned(64)));
+    void*           slots[RING_SIZE];
+};
+
+static void* bench_prodcons(struct bench_thread* t)
+{
+    struct bench_ring* ring = &t->run->rings[t->index / 2];
+    size_t n = t->run->nops;
+    
+    if(t->index % 2 == 0)
+    {
+        for(size_t i = 0; i < n; ++i)
+        {
+            void* obj = bench_alloc(t, PRODCONS_SIZE);
+            *(char *)obj = (char)i;
+            while(ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+            {
+                sched_yield();
+            }
+            ring->slots[ring->head % RING_SIZE] = obj;
+            __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+        }
+    }
+    else
+    {
+        for(size_t i = 0; i < n; ++i)
+        {
+            while(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail)
+            {
+                sched_yield();
+            }
+            void* obj = ring->slots[ring->tail % RING_SIZE];
+            __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+            bench_free(t, obj);
+        }
+    }
+    return 0;
+}
+
+static void bench_prodcons_setup(struct bench_run* run)
+{
+    posix_memalign((void **)&run->rings, 64, sizeof(struct bench_ring) * (run->nthreads / 2));
+    memset(run->rings, 0, sizeof(struct bench_ring) * (run->nthreads / 2));
+}
+
+static void bench_prodcons_teardown(struct bench_run* run)
+{
+    free(run->rings);
+}
+
+#define REALLOC_MIN_SIZE        ((size_t)16)
+#define REALLOC_MAX_SIZE        ((size_t)1 << 20)
+
+static void* bench_realloc_growth(struct bench_thread* t)
+{
+    size_t n = t->run->nops;
+    while(t->nops < n)
+    {
+        size_t sz = REALLOC_MIN_SIZE;
+        char* buf = bench_alloc(t, sz);
+        while(sz < REALLOC_MAX_SIZE && t->nops < n)
+        {
+            size_t new_sz = sz + sz / 2;
+            buf = bench_realloc(t, buf, new_sz);
+            buf[new_sz - 1] = (char)sz;
+            sz = new_sz;
+        }
+        bench_free(t, buf);
+    }
+    return 0;
+}
+
+struct bench_workload
+{
+    const char* name;
+    int         flags;
+    size_t      chunkSize;          /* of fixed-size workloads, 0 otherwise */
+    size_t      maxLive;            /* chunks per thread */
+    void*       (*run)(struct bench_thread*);
+    void        (*setup)(struct bench_run*);
+    void        (*teardown)(struct bench_run*);
+};
+
+static const struct bench_workload bench_workloads[] =
+{
+    { "larson",         BENCH_CROSS_THREAD | BENCH_KEEPS_FREEING, 0, LARSON_OBJECTS,
+      bench_larson, bench_larson_setup, bench_larson_teardown },
+    { "threadtest",     0, THREADTEST_SIZE, THREADTEST_BATCH,
+      bench_threadtest, 0, 0 },
+    { "cache-scratch",  BENCH_CROSS_THREAD, CACHE_OBJECT_SIZE, 2,
+      bench_cache_scratch, bench_cache_scratch_setup, bench_cache_scratch_teardown },
+    { "cache-thrash",   0, CACHE_OBJECT_SIZE, 1,
+      bench_cache_thrash, 0, 0 },
+    { "prodcons",       BENCH_CROSS_THREAD | BENCH_KEEPS_FREEING | BENCH_PAIRS, PRODCONS_SIZE, RING_SIZE + 2,
+      bench_prodcons, bench_prodcons_setup, bench_prodcons_teardown },
+    { "realloc",        BENCH_KEEPS_FREEING, 0, 1,
+      bench_realloc_growth, 0, 0 },
+};
+
+/********************************* Allocators *********************************/
+
+/* heaps of bounded size */
+#define BENCH_DL_SIZE           ((size_t)1 << 30)
+#define BENCH_DL_ARENAS         (8)
+#define BENCH_DL_ARENA_SIZE     ((size_t)256 << 20)
+
+static cpl_allocator_ref bench_backing;
+
+static cpl_allocator_ref bench_create_default(size_t chunkSize, size_t nChunks)
+{
+    return cpl_allocator_get_default();
+}
+
+static void bench_destroy_default(cpl_allocator_ref allocator)
+{
+}
+
+static cpl_allocator_ref bench_create_pool(size_t chunkSize, size_t nChunks)
+{
+    return cpl_allocator_create_pool(chunkSize, (int)nChunks);
+}
+
+static cpl_allocator_ref bench_create_pool_lockfree(size_t chunkSize, size_t nChunks)
+{
+    return cpl_allocator_create_pool_lockfree(chunkSize, (int)nChunks);
+}
+
+static cpl_allocator_ref bench_create_pool_growable(size_t chunkSize, size_t nChunks)
+{
+    return cpl_allocator_create_pool_growable(chunkSize, 256, 1);
+}
+
+static cpl_allocator_ref bench_create_slab(size_t chunkSize, size_t nChunks)
+{
+    return cpl_allocator_create_slab();
+}
+
+static cpl_allocator_ref bench_create_dl(size_t chunkSize, size_t nChunks)
+{
+    return cpl_allocator_create_dl(BENCH_DL_SIZE);
+}
+
+static cpl_allocator_ref bench_create_dl_arenas(size_t chunkSize, size_t nChunks)
+{
+    return cpl_allocator_create_dl_arenas(BENCH_DL_ARENA_SIZE, BENCH_DL_ARENAS);
+}
+
+static cpl_allocator_ref bench_create_cache(size_t chunkSize, size_t nChunks)
+{
+    bench_backing = cpl_allocator_create_dl(BENCH_DL_SIZE);
+    return bench_backing ? cpl_allocator_create_cache(bench_backing) : 0;
+}
+
+static void bench_destroy_cache(cpl_allocator_ref allocator)
+{
+    cpl_allocator_destroy_cache(allocator);
+    cpl_allocator_destroy_dl(bench_backing);
+}
+
+static cpl_allocator_ref bench_create_arena(size_t chunkSize, size_t nChunks)
+{
+    return cpl_allocator_create_arena(0);
+}
+
+struct bench_allocator
+{
+    const char* name;
+    int         flags;
+    cpl_allocator_ref (*create)(size_t chunkSize, size_t nChunks);
+    void        (*destroy)(cpl_allocator_ref);
+};
+
+static const struct bench_allocator bench_allocators[] =
+{
+    { "malloc",         BENCH_THREADSAFE,                       bench_create_default,       bench_destroy_default },
+    { "pool",           BENCH_FIXED_SIZE,                       bench_create_pool,          cpl_allocator_destroy_pool },
+    { "pool-inline",    BENCH_FIXED_SIZE | BENCH_INLINE,        bench_create_pool,          cpl_allocator_destroy_pool },
+    { "pool-lockfree",  BENCH_FIXED_SIZE | BENCH_THREADSAFE,    bench_create_pool_lockfree, cpl_allocator_destroy_pool },
+    { "pool-growable",  BENCH_FIXED_SIZE,                       bench_create_pool_growable, cpl_allocator_destroy_pool_growable },
+    { "slab",           BENCH_THREADSAFE,                       bench_create_slab,          cpl_allocator_destroy_slab },
+    { "dl",             0,                                      bench_create_dl,            cpl_allocator_destroy_dl },
+    { "dl-arenas",      BENCH_THREADSAFE,                       bench_create_dl_arenas,     cpl_allocator_destroy_dl_arenas },
+    { "cache(dl)",      BENCH_THREADSAFE,                       bench_create_cache,         bench_destroy_cache },
+    { "arena",          BENCH_NO_FREE,                          bench_create_arena,         cpl_allocator_destroy_arena },
+};
+
+#define BENCH_COUNT(a)          (sizeof(a) / sizeof((a)[0]))
+
+static int bench_applicable(const struct bench_allocator* a, const struct bench_workload* w, int nthreads)
+{
+    if((w->flags & BENCH_PAIRS) && (nthreads < 2 || nthreads % 2))
+    {
+        return 0;
+    }
+    if(nthreads > 1 && !(a->flags & BENCH_THREADSAFE))
+    {
+        return 0;
+    }
+    if((a->flags & BENCH_FIXED_SIZE) && !w->chunkSize)
+    {
+        return 0;
+    }
+    if((a->flags & BENCH_NO_FREE) && (w->flags & BENCH_KEEPS_FREEING))
+    {
+        return 0;
+    }
+    return 1;
+}
+
+/********************************** Driver ************************************/
+
+static void* bench_thread_main(void* arg)
+{
+    struct bench_thread* t = (struct bench_thread *)arg;
+    bench_barrier_wait(&t->run->barrier);
+    t->start = cpl_system_monotonic_time();
+    t->run->workload->run(t);
+    t->end = cpl_system_monotonic_time();
+    __atomic_add_fetch(&t->run->finished, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void bench_run(const struct bench_allocator* a, const struct bench_workload* w, int nthreads, size_t nops)
+{
+    static struct bench_run run;
+    memset(&run, 0, sizeof(run));
+    
+    run.workload = w;
+    run.nthreads = nthreads;
+    run.nops = nops;
+    run.allocator = a->create(w->chunkSize, w->maxLive * nthreads + 1);
+    if(!run.allocator)
+    {
+        printf("%-14s %-14s %4d   failed to create allocator\n", w->name, a->name, nthreads);
+        return ;
+    }
+    
+    bench_barrier_init(&run.barrier, nthreads + 1);
+    if(w->setup)
+    {
+        w->setup(&run);
+    }
+    
+    for(int i = 0; i < nthreads; ++i)
+    {
+        struct bench_thread* t = &run.threads[i];
+        t->run = &run;
+        t->allocator = run.allocator;
+        t->pool = (a->flags & BENCH_INLINE) ? cpl_allocator_get_pool(run.allocator) : 0;
+        t->index = i;
+        t->seed = 2463534242U + i;
+        t->maxSamples = nops / BENCH_SAMPLE_RATE + 1;
+        t->samples = malloc(t->maxSamples * sizeof(uint64_t));
+        pthread_create(&t->thread, 0, bench_thread_main, t);
+    }
+    
+    /* larson threads meet every round, the main thread keeps them company */
+    bench_barrier_wait(&run.barrier);
+    size_t rss, peak_rss = 0;
+    if(w->run == bench_larson)
+    {
+        for(unsigned round = 0; round < LARSON_ROUNDS; ++round)
+        {
+            bench_barrier_wait(&run.barrier);
+            rss = cpl_system_resident_size();
+            peak_rss = (rss > peak_rss)?rss:peak_rss;
+        }
+    }
+    
+    /* RSS is sampled while the threads run, they keep time themselves */
+    while(__atomic_load_n(&run.finished, __ATOMIC_ACQUIRE) < nthreads)
+    {
+        rss = cpl_system_resident_size();
+        peak_rss = (rss > peak_rss)?rss:peak_rss;
+        usleep(BENCH_RSS_INTERVAL_US);
+    }
+    
+    size_t ntotal = 0, nsamples = 0;
+    uint64_t start = UINT64_MAX, end = 0;
+    for(int i = 0; i < nthreads; ++i)
+    {
+        struct bench_thread* t = &run.threads[i];
+        pthread_join(t->thread, 0);
+        ntotal += t->nops;
+        nsamples += t->nsamples;
+        start = (t->start < start)?t->start:start;
+        end = (t->end > end)?t->end:end;
+    }
+    uint64_t elapsed = end - start;
+    rss = cpl_system_resident_size();
+    peak_rss = (rss > peak_rss)?rss:peak_rss;
+    
+    uint64_t* samples = malloc((nsamples + 1) * sizeof(uint64_t));
+    nsamples = 0;
+    for(int i = 0; i < nthreads; ++i)
+    {
+        memcpy(samples + nsamples, run.threads[i].samples, run.threads[i].nsamples * sizeof(uint64_t));
+        nsamples += run.threads[i].nsamples;
+        free(run.threads[i].samples);
+    }
+    qsort(samples, nsamples, sizeof(uint64_t), bench_compare_u64);
+    
+    printf("%-14s %-14s %4d %10.2f %8llu %8llu %8llu %10zu\n", w->name, a->name, nthreads,
+           elapsed ? (double)ntotal * 1000.0 / elapsed : 0.0,
+           (unsigned long long)(nsamples ? samples[nsamples / 2] : 0),
+           (unsigned long long)(nsamples ? samples[nsamples * 99 / 100] : 0),
+           (unsigned long long)(nsamples ? samples[nsamples * 999 / 1000] : 0),
+           peak_rss >> 10);
+    fflush(stdout);
+    free(samples);
+    
+    if(w->teardown)
+    {
+        w->teardown(&run);
+    }
+    bench_barrier_destroy(&run.barrier);
+    a->destroy(run.allocator);
+}
+
+static int bench_parse_threads(const char* arg, int* threads)
+{
+    int n = 0;
+    while(*arg && n < 16)
+    {
+        char* end;
+        long v = strtol(arg, &end, 10);
+        if(end == arg || v < 1 || v > BENCH_MAX_THREADS)
+        {
+            return 0;
+        }
+        threads[n++] = (int)v;
+        arg = (*end == ',')?end + 1:end;
+    }
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    int threads[16] = { 1, 2, 4, 8 };
+    int nthreads = 4;
+    size_t nops = BENCH_DEFAULT_OPS;
+    const char* workload = 0;
+    const char* allocator = 0;
+    
+    int opt;
+    while((opt = getopt(argc, argv, "t:n:w:a:")) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                if(!(nthreads = bench_parse_threads(optarg, threads)))
+                {
+                    goto Lusage;
+                }
+                break;
+            case 'n':
+                nops = strtoul(optarg, 0, 10);
+                break;
+            case 'w':
+                workload = optarg;
+                break;
+            case 'a':
+                allocator = optarg;
+                break;
+            default:
+                goto Lusage;
+        }
+    }
+    if(nops < 2 * THREADTEST_BATCH * LARSON_ROUNDS)
+    {
+        goto Lusage;
+    }
+    
+    printf("%-14s %-14s %4s %10s %8s %8s %8s %10s\n",
+           "workload", "allocator", "thr", "Mops/s", "p50 ns", "p99 ns", "p999 ns", "RSS KB");
+    for(size_t w = 0; w < BENCH_COUNT(bench_workloads); ++w)
+    {
+        if(workload && strcmp(workload, bench_workloads[w].name))
+        {
+            continue;
+        }
+        for(int n = 0; n < nthreads; ++n)
+        {
+            for(size_t a = 0; a < BENCH_COUNT(bench_allocators); ++a)
+            {
+                if(allocator && strcmp(allocator, bench_allocators[a].name))
+                {
+                    continue;
+                }
+                if(bench_applicable(&bench_allocators[a], &bench_workloads[w], threads[n]))
+                {
+                    bench_run(&bench_allocators[a], &bench_workloads[w], threads[n], nops);
+                }
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+    
+Lusage:
+    fprintf(stderr, "usage: %s [-t 1,2,4,8] [-n ops per thread] [-w workload] [-a allocator]\n", argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,141 @@
+/**
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 Alexey Komnin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Replays an allocation trace recorded by the tracing allocator against every
+ * allocator of the library and reports time per operation, peak RSS and
+ * fragmentation.
+ *
+ *     cpl_trace_replay <trace file>
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../include/cpl/cpl_allocator.h"
+#include "../include/cpl/cpl_error.h"
+
+#define REPLAY_MIN_HEAP         ((size_t)64 << 20)
+
+static void replay(const char* name, cpl_allocator_ref allocator, const cpl_allocator_trace_t* trace, size_t chunkSize)
+{
+    if(!allocator)
+    {
+        printf("%-16s failed to create\n", name);
+        return ;
+    }
+    
+    cpl_allocator_replay_result_t result;
+    int rc = cpl_allocator_trace_replay(allocator, trace, chunkSize, &result);
+    if(rc != _CPL_OK)
+    {
+        printf("%-16s replay failed (%d)\n", name, rc);
+        return ;
+    }
+    
+    printf("%-16s %10.1f %12zu %12zu %8.1f%% %10llu\n", name, result.ns_per_op,
+           result.peak_rss >> 10, result.peak_footprint >> 10, result.fragmentation * 100.0,
+           (unsigned long long)result.nfailed);
+}
+
+int main(int argc, char** argv)
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    int fd = open(argv[1], O_RDONLY);
+    if(fd < 0)
+    {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    
+    cpl_allocator_trace_t* trace = 0;
+    int rc = cpl_allocator_trace_load(fd, &trace);
+    close(fd);
+    if(rc != _CPL_OK)
+    {
+        fprintf(stderr, "%s: cannot load trace (%d)\n", argv[1], rc);
+        return EXIT_FAILURE;
+    }
+    
+    cpl_allocator_trace_info_t info;
+    cpl_allocator_trace_get_info(trace, &info);
+    printf("%llu ops, requests of %zu..%zu bytes, up to %zu chunks and %zu KB live\n\n",
+           (unsigned long long)info.nops, info.min_size, info.max_size, info.max_chunks, info.max_bytes >> 10);
+    printf("%-16s %10s %12s %12s %9s %10s\n", "allocator", "ns/op", "peak RSS KB", "footprint KB", "frag", "failed");
+    
+    /* heaps of bounded size get room for four times the live peak */
+    size_t heap_size = (info.max_bytes * 4 > REPLAY_MIN_HEAP)?info.max_bytes * 4:REPLAY_MIN_HEAP;
+    cpl_allocator_ref a;
+    
+    replay("default", cpl_allocator_get_default(), trace, 0);
+    
+    /* pools serve fixed-size chunks, only traces of small requests fit */
+    size_t chunkSize = (info.max_size + 15) & ~(size_t)15;
+    chunkSize = (chunkSize > 16)?chunkSize:32;
+    if(chunkSize < 8192)
+    {
+        a = cpl_allocator_create_pool(chunkSize, (int)info.max_chunks + 1);
+        replay("pool", a, trace, chunkSize);
+        if(a) cpl_allocator_destroy_pool(a);
+        
+        a = cpl_allocator_create_pool_lockfree(chunkSize, (int)info.max_chunks + 1);
+        replay("pool-lockfree", a, trace, chunkSize);
+        if(a) cpl_allocator_destroy_pool(a);
+        
+        a = cpl_allocator_create_pool_growable(chunkSize, 256, 1);
+        replay("pool-growable", a, trace, chunkSize);
+        if(a) cpl_allocator_destroy_pool_growable(a);
+    }
+    
+    a = cpl_allocator_create_slab();
+    replay("slab", a, trace, 0);
+    if(a) cpl_allocator_destroy_slab(a);
+    
+    a = cpl_allocator_create_dl(heap_size);
+    replay("dl", a, trace, 0);
+    if(a) cpl_allocator_destroy_dl(a);
+    
+    a = cpl_allocator_create_dl_arenas(heap_size, 4);
+    replay("dl-arenas", a, trace, 0);
+    if(a) cpl_allocator_destroy_dl_arenas(a);
+    
+    cpl_allocator_ref dl = cpl_allocator_create_dl(heap_size);
+    a = dl ? cpl_allocator_create_cache(dl) : 0;
+    replay("cache(dl)", a, trace, 0);
+    if(a) cpl_allocator_destroy_cache(a);
+    if(dl) cpl_allocator_destroy_dl(dl);
+    
+    a = cpl_allocator_create_arena(0);
+    replay("arena", a, trace, 0);
+    if(a) cpl_allocator_destroy_arena(a);
+    
+    cpl_allocator_trace_free(trace);
+    return EXIT_SUCCESS;
+}